@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bt_lib.h"
+#include "bt_assembly.h"
+#include "bt_io.h"
+#include "bt_cache.h"
+#include "bt_disk.h"
+#include "bt_request.h"
+
+/* an assembly buffer being flushed; it goes back to the pool once the last of its runs is written */
+typedef struct {
+    unsigned char *buf;
+    int n_runs; // writes in flight, plus one while more are being submitted
+} flush_t;
+
+/**
+ * pool_init() sizes the pool to the memory budget, in whole pieces
+ **/
+static int pool_init(bt_args_t *bt_args) {
+    download_t *download = &bt_args->download;
+
+    download->max_bufs = ASSEMBLY_POOL_BYTES / bt_args->bt_info->piece_length;
+    if (download->max_bufs < MIN_ASSEMBLY_BUFS) {
+        download->max_bufs = MIN_ASSEMBLY_BUFS;
+    }
+    if ( (download->spare_bufs = malloc(download->max_bufs * sizeof(unsigned char *))) == NULL ) {
+        return -1;
+    }
+    download->n_spare = 0;
+    download->n_bufs = 0;
+    return 0;
+}
+
+/**
+ * pool_charge() takes a buffer's worth of the memory budget, out of the read cache if need be
+ **/
+static int pool_charge(bt_args_t *bt_args) {
+    size_t bytes = bt_args->bt_info->piece_length;
+
+    if ( mem_charge(bt_args, bytes) == 0 ) {
+        return 0;
+    }
+    cache_shrink(bt_args, bytes);
+    return mem_charge(bt_args, bytes);
+}
+
+/**
+ * assembly_get() takes a spare buffer, else allocates one while the pool is below its size and the budget allows,
+ * else evicts. An evicted buffer only comes back once its writes land, so until then new pieces go without
+ **/
+int assembly_get(bt_args_t *bt_args, active_piece_t *active) {
+    download_t *download = &bt_args->download;
+    active_piece_t *victim = NULL;
+    void *buf;
+    int i;
+
+    active->buf = NULL;
+    if ( download->spare_bufs == NULL && pool_init(bt_args) < 0 ) {
+        return -1;
+    }
+
+    if (download->n_spare == 0 && download->n_bufs < download->max_bufs && pool_charge(bt_args) == 0) {
+        if ( posix_memalign(&buf, ASSEMBLY_ALIGN, bt_args->bt_info->piece_length) != 0 ) {
+            mem_release(bt_args, bt_args->bt_info->piece_length);
+            return -1;
+        }
+        download->spare_bufs[download->n_spare++] = buf;
+        download->n_bufs++;
+    }
+
+    // pool used up: the piece with the most blocks in makes the longest writes, and frees its buffer for good
+    if (download->n_spare == 0) {
+        for (i = 0; i < download->n_active; i++) {
+            if ( download->active[i].buf && (victim == NULL || download->active[i].n_received > victim->n_received) ) {
+                victim = &download->active[i];
+            }
+        }
+        if (victim == NULL) {
+            return -1;
+        }
+        if (bt_args->verbose) {
+            printf("Assembly pool full: piece %d flushed with %d of %d blocks in.\n", victim->index, victim->n_received,
+                    victim->n_blocks);
+        }
+        assembly_flush(bt_args, victim);
+        if (download->n_spare == 0) {
+            return -1;
+        }
+    }
+
+    active->buf = download->spare_bufs[--download->n_spare];
+    return 0;
+}
+
+void assembly_put(download_t *download, active_piece_t *active) {
+    if (active->buf) {
+        assembly_return(download, active->buf);
+        active->buf = NULL;
+    }
+}
+
+void assembly_return(download_t *download, unsigned char *buf) {
+    download->spare_bufs[download->n_spare++] = buf;
+}
+
+/**
+ * run_written() settles one run of a flushed buffer with its piece, and returns the buffer after the last
+ **/
+static void run_written(bt_args_t *bt_args, disk_op_t *op) {
+    flush_t *flush = op->arg;
+
+    if (--flush->n_runs == 0) {
+        assembly_return(&bt_args->download, flush->buf);
+        free(flush);
+    }
+    piece_part_written(bt_args, op->offset / bt_args->bt_info->piece_length, op->result);
+}
+
+/**
+ * assembly_flush() finds the runs of received blocks; a block past the end of a run is either free or requested
+ **/
+void assembly_flush(bt_args_t *bt_args, active_piece_t *active) {
+    int start, end, size = piece_size(bt_args->bt_info, active->index);
+    int begin, len;
+    flush_t *flush = NULL;
+
+    if ( bt_args->disk && (flush = malloc(sizeof(flush_t))) ) {
+        flush->buf = active->buf;
+        flush->n_runs = 1;
+    }
+
+    for (start = 0; start < active->n_blocks; start = end) {
+        if (active->blocks[start] != BLOCK_RECEIVED) {
+            end = start + 1;
+            continue;
+        }
+        for (end = start; end < active->n_blocks && active->blocks[end] == BLOCK_RECEIVED; end++)
+            ;
+
+        begin = start * BLOCK_SIZE;
+        len = (end * BLOCK_SIZE < size) ? end * BLOCK_SIZE - begin : size - begin;
+        if ( flush && disk_submit(bt_args, DISK_WRITE, bt_args->store.fd, active->buf + begin, len,
+                (off_t) active->index * bt_args->bt_info->piece_length + begin, run_written, flush) == 0 ) {
+            flush->n_runs++;
+            active->n_writing++;
+            continue;
+        }
+        if ( store_write(&bt_args->store, bt_args->bt_info, active->index, begin, active->buf + begin, len) < 0 ) {
+            active->write_failed = 1;   // settled by the piece's next check
+        }
+    }
+
+    // with runs in flight the buffer is theirs; otherwise it is free now
+    if ( flush && --flush->n_runs > 0 ) {
+        active->buf = NULL;
+        return;
+    }
+    free(flush);
+    assembly_put(&bt_args->download, active);
+}
+
+void assembly_free(download_t *download) {
+    int i;
+
+    for (i = 0; i < download->n_spare; i++) {
+        free(download->spare_bufs[i]);
+    }
+    free(download->spare_bufs);
+    download->spare_bufs = NULL;
+    download->n_spare = 0;
+    download->n_bufs = 0;
+}
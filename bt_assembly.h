@@ -0,0 +1,62 @@
+#ifndef _BT_ASSEMBLY_H
+#define _BT_ASSEMBLY_H
+
+#include "bt_lib.h"
+
+/* memory set aside for assembling pieces; the pool holds this many bytes' worth of piece-sized buffers */
+#define ASSEMBLY_POOL_BYTES (64 * 1024 * 1024)
+
+/* fewest buffers in the pool, however big the pieces */
+#define MIN_ASSEMBLY_BUFS 4
+
+/* alignment of the buffers, so that whole-piece writes start on a page */
+#define ASSEMBLY_ALIGN 4096
+
+/**
+ * assembly_get(bt_args_t *bt_args, active_piece_t *active) -> int
+ *
+ * give a piece that is starting an assembly buffer to gather its blocks
+ * in. When the pool is used up, the buffered piece furthest along is
+ * flushed to the payload (see assembly_flush()); its buffer is reused once
+ * the flush is written.
+ *
+ * Return: 0 with active->buf set, -1 if no buffer could be had (the piece
+ * is then written to the payload block by block)
+ **/
+int assembly_get(bt_args_t *bt_args, active_piece_t *active);
+
+/**
+ * assembly_put(download_t *download, active_piece_t *active) -> void
+ *
+ * return the piece's buffer (if it has one) to the pool
+ **/
+void assembly_put(download_t *download, active_piece_t *active);
+
+/**
+ * assembly_return(download_t *download, unsigned char *buf) -> void
+ *
+ * return a buffer taken off its piece earlier (a verified piece being
+ * written out) to the pool
+ **/
+void assembly_return(download_t *download, unsigned char *buf);
+
+/**
+ * assembly_flush(bt_args_t *bt_args, active_piece_t *active) -> void
+ *
+ * write the blocks received so far to the payload, one write per run of
+ * contiguous blocks, and take the buffer off the piece. The writes go to
+ * the disk backend and the buffer returns to the pool once they land
+ * (see piece_part_written()); without a backend they are done in place.
+ * Blocks still to come are saved straight to the payload. A failed write
+ * sends the piece back to be downloaded again.
+ **/
+void assembly_flush(bt_args_t *bt_args, active_piece_t *active);
+
+/**
+ * assembly_free(download_t *download) -> void
+ *
+ * free every spare buffer; pieces must have returned theirs
+ **/
+void assembly_free(download_t *download);
+
+#endif
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "bt_bencode.h"
+
+/**
+ * parse_digits() reads a run of decimal digits (with an optional leading '-') up to the terminator term
+ *
+ * Return: 0 on success, -1 on malformed or overflowing input
+ **/
+static int parse_digits(be_parser_t *p, char term, int allow_sign, long long *out) {
+    long long num = 0;
+    int negative = 0, n_digits = 0;
+
+    if (allow_sign && p->pos < p->end && *p->pos == '-') {
+        negative = 1;
+        p->pos++;
+    }
+
+    while (p->pos < p->end && *p->pos >= '0' && *p->pos <= '9') {
+        if (num > (LLONG_MAX - (*p->pos - '0')) / 10) {
+            p->error = "integer out of range";
+            return -1;
+        }
+        num = num * 10 + (*p->pos - '0');
+        p->pos++;
+        n_digits++;
+    }
+
+    if (n_digits == 0 || p->pos >= p->end || *p->pos != term) {
+        p->error = (term == ':') ? "bad string length" : "bad integer";
+        return -1;
+    }
+    p->pos++;   // skip the terminator
+
+    *out = negative ? -num : num;
+    return 0;
+}
+
+/**
+ * parse_value() reads the value at p->pos into node, handing it and everything inside it to the callback
+ **/
+static int parse_value(be_parser_t *p, int depth, be_node_t *node, be_callback_t callback, void *ctx) {
+    be_node_t child;
+    long long len;
+
+    if (p->pos >= p->end) {
+        p->error = "unexpected end of data";
+        return -1;
+    }
+
+    memset(node, 0x00, sizeof(*node));
+    node->start = p->pos;
+
+    switch (*p->pos) {
+        case 'i':   // integer
+            p->pos++;
+            node->type = BE_INT;
+            if ( parse_digits(p, 'e', 1, &node->num) < 0 ) {
+                return -1;
+            }
+            break;
+
+        case 'l':   // list
+        case 'd':   // dictionary
+            if (depth == BE_MAX_DEPTH) {
+                p->error = "nested too deeply";
+                return -1;
+            }
+            node->type = (*p->pos == 'l') ? BE_LIST : BE_DICT;
+            p->pos++;
+
+            while (p->pos < p->end && *p->pos != 'e') {
+                p->keys[depth + 1].type = -1;
+
+                if (node->type == BE_DICT) {    // every value in a dictionary is preceded by a string key
+                    if (*p->pos < '0' || *p->pos > '9') {
+                        p->error = "dictionary key is not a string";
+                        return -1;
+                    }
+                    if ( parse_value(p, depth + 1, &p->keys[depth + 1], NULL, NULL) < 0 ) {
+                        return -1;
+                    }
+                }
+
+                if ( parse_value(p, depth + 1, &child, callback, ctx) < 0 ) {
+                    return -1;
+                }
+            }
+
+            if (p->pos >= p->end) {
+                p->error = "unterminated list or dictionary";
+                return -1;
+            }
+            p->pos++;   // skip the 'e'
+            break;
+
+        case '0': case '1': case '2': case '3': case '4':
+        case '5': case '6': case '7': case '8': case '9':   // string
+            node->type = BE_STR;
+            if ( parse_digits(p, ':', 0, &len) < 0 ) {
+                return -1;
+            }
+            if (len > p->end - p->pos) {
+                p->error = "string runs past the end of data";
+                return -1;
+            }
+            node->str = p->pos;
+            node->len = len;
+            p->pos += len;
+            break;
+
+        default:
+            p->error = "unknown value type";
+            return -1;
+    }
+
+    node->end = p->pos;
+
+    if ( callback && callback(ctx, p, depth, node) < 0 ) {
+        if (p->error == NULL) {
+            p->error = "rejected by caller";
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * be_parse() walks one bencoded value
+ **/
+int be_parse(const unsigned char *buf, size_t len, be_callback_t callback, void *ctx, const char **error) {
+    be_parser_t p;
+    be_node_t top;
+
+    memset(&p, 0x00, sizeof(p));
+    p.pos = buf;
+    p.end = buf + len;
+    p.keys[0].type = -1;
+
+    if ( parse_value(&p, 0, &top, callback, ctx) == 0 && p.pos != p.end ) {
+        p.error = "trailing data after value";
+    }
+
+    if (p.error) {
+        if (error) {
+            *error = p.error;
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * be_str_eq() compares a string slice with a C string
+ **/
+int be_str_eq(be_node_t *node, const char *str) {
+    size_t len = strlen(str);
+
+    return node->type == BE_STR && node->len == len && memcmp(node->str, str, len) == 0;
+}
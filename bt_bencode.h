@@ -0,0 +1,62 @@
+#ifndef _BT_BENCODE_H
+#define _BT_BENCODE_H
+
+#include <stddef.h>
+
+/* types of bencoded values */
+#define BE_INT 0   // i<digits>e
+#define BE_STR 1   // <length>:<bytes>
+#define BE_LIST 2  // l<values>e
+#define BE_DICT 3  // d<string key><value>...e
+
+/* deepest nesting of lists/dictionaries accepted; bounds the parser's stack */
+#define BE_MAX_DEPTH 32
+
+/* a bencoded value, as a slice of the buffer being parsed; nothing is copied */
+typedef struct {
+    int type;   // BE_INT, BE_STR, BE_LIST or BE_DICT
+    const unsigned char *start; // first byte of the encoded value
+    const unsigned char *end;   // one past its last byte
+    const unsigned char *str;   // BE_STR: the string's bytes (not null-terminated)
+    size_t len; // BE_STR: length of str
+    long long num;  // BE_INT: the integer
+} be_node_t;
+
+/* state of one parse; lives on the caller's stack, so parses in different threads never share anything */
+typedef struct be_parser {
+    const unsigned char *pos;   // next byte to read
+    const unsigned char *end;   // one past the last byte of the buffer
+    be_node_t keys[BE_MAX_DEPTH + 1];   // keys[d]: dictionary key the value at depth d sits under (type -1 if none)
+    const char *error;  // what was wrong with the input, set when be_parse() fails
+} be_parser_t;
+
+/**
+ * be_callback_t(void *ctx, be_parser_t *parser, int depth, be_node_t *value) -> int
+ *
+ * called once for every value in the buffer, in the order values end:
+ * scalars as they are read, lists and dictionaries after their last
+ * element (so that value->end spans the whole container). depth is 0 for
+ * the top-level value; parser->keys[1..depth] is the key path leading to
+ * the value. Returning a negative number stops the parse.
+ **/
+typedef int (*be_callback_t)(void *ctx, be_parser_t *parser, int depth, be_node_t *value);
+
+/**
+ * be_parse(const unsigned char *buf, size_t len, be_callback_t callback, void *ctx, const char **error) -> int
+ *
+ * validate and walk the single bencoded value in buf in one pass, handing
+ * every value to callback as a slice of buf
+ *
+ * Return: 0 on success, -1 on malformed input or if callback stopped the
+ * parse; *error (if not NULL) then says why
+ **/
+int be_parse(const unsigned char *buf, size_t len, be_callback_t callback, void *ctx, const char **error);
+
+/**
+ * be_str_eq(be_node_t *node, const char *str) -> int
+ *
+ * Return: 1 if node is a string equal to the null-terminated str, 0 otherwise
+ **/
+int be_str_eq(be_node_t *node, const char *str);
+
+#endif
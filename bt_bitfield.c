@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "bt_lib.h"
+#include "bt_bitfield.h"
+
+/* the set kernels are built once per instruction set and picked at load time for the CPU we run on
+ * (GCC function multi-versioning); their plain 64-bit word loops vectorize under avx2 */
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+#define BITFIELD_KERNEL __attribute__((target_clones("avx2", "popcnt", "default")))
+#else
+#define BITFIELD_KERNEL
+#endif
+
+/**
+ * padded_bytes() is the allocated size of a bitfield of n_pieces pieces: whole BITFIELD_ALIGN-byte vectors
+ **/
+static size_t padded_bytes(size_t n_pieces) {
+    size_t bytes = (n_pieces + 7) / 8;
+
+    return (bytes + BITFIELD_ALIGN - 1) / BITFIELD_ALIGN * BITFIELD_ALIGN;
+}
+
+/**
+ * n_words() is the number of 64-bit words in a bitfield's (padded) storage
+ **/
+static size_t n_words(bt_bitfield_t *bitfield) {
+    return padded_bytes(bitfield->size) / 8;
+}
+
+/**
+ * load_word() reads word w so that piece 64 * w is its most significant bit, whatever the host byte order
+ **/
+static inline uint64_t load_word(const unsigned char *bits, size_t w) {
+    uint64_t word;
+
+    memcpy(&word, bits + 8 * w, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+/**
+ * bitfield_init() allocates zeroed, vector-aligned storage; padding bits stay zero forever, so the kernels can
+ * run over whole words without masking the tail
+ **/
+int bitfield_init(bt_bitfield_t *bitfield, size_t n_pieces) {
+    size_t bytes = padded_bytes(n_pieces);
+
+    bitfield->size = n_pieces;
+    if ( (bitfield->bits = aligned_alloc(BITFIELD_ALIGN, bytes ? bytes : BITFIELD_ALIGN)) == NULL ) {
+        return -1;
+    }
+    memset(bitfield->bits, 0x00, bytes ? bytes : BITFIELD_ALIGN);
+    return 0;
+}
+
+/**
+ * bitfield_free() releases a bitfield's storage
+ **/
+void bitfield_free(bt_bitfield_t *bitfield) {
+    free(bitfield->bits);
+    bitfield->bits = NULL;
+    bitfield->size = 0;
+}
+
+/**
+ * bitfield_load() copies a wire bitfield in after checking its length and spare bits
+ **/
+int bitfield_load(bt_bitfield_t *bitfield, const unsigned char *wire, size_t len) {
+    size_t spare;   // bits of the last byte past the last piece
+
+    if (len != bitfield_bytes(bitfield)) {
+        return -1;
+    }
+    spare = 8 * len - bitfield->size;
+    if ( len > 0 && (wire[len - 1] & ((1 << spare) - 1)) != 0 ) {
+        return -1;  // bits past the last piece must be zero
+    }
+
+    memcpy(bitfield->bits, wire, len);
+    return 0;
+}
+
+/**
+ * bitfield_count() sums the population count of every word
+ **/
+BITFIELD_KERNEL
+size_t bitfield_count(bt_bitfield_t *bitfield) {
+    const uint64_t *words = (const uint64_t *) bitfield->bits;  // byte order does not matter for a count
+    size_t n = n_words(bitfield), w, count = 0;
+
+    for (w = 0; w < n; w++) {
+        count += __builtin_popcountll(words[w]);
+    }
+    return count;
+}
+
+/**
+ * bitfield_any_andnot() ORs a & ~b across each vector and stops at the first one that is not empty
+ **/
+BITFIELD_KERNEL
+int bitfield_any_andnot(bt_bitfield_t *a, bt_bitfield_t *b) {
+    const uint64_t *x = (const uint64_t *) a->bits, *y = (const uint64_t *) b->bits;
+    size_t n = n_words(a), w, k;
+    uint64_t acc;
+
+    for (w = 0; w < n; w += BITFIELD_ALIGN / 8) {
+        acc = 0;
+        for (k = 0; k < BITFIELD_ALIGN / 8; k++) {
+            acc |= x[w + k] & ~y[w + k];
+        }
+        if (acc) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * bitfield_find_first() skips empty words and takes the leading zero count of the first non-empty one
+ **/
+long bitfield_find_first(bt_bitfield_t *bitfield, size_t from) {
+    size_t n = n_words(bitfield), w = from / 64;
+    uint64_t word;
+
+    if (from >= bitfield->size) {
+        return -1;
+    }
+
+    word = load_word(bitfield->bits, w) & (~0ULL >> (from % 64)); // ignore pieces before from
+    while (word == 0) {
+        if (++w == n) {
+            return -1;
+        }
+        word = load_word(bitfield->bits, w);
+    }
+    return 64 * w + __builtin_clzll(word);
+}
+
+/**
+ * print_bitfield() writes the bitfield as a '0'/'1' string
+ **/
+void print_bitfield(FILE *file, bt_bitfield_t *bitfield) {
+    size_t i;
+
+    for (i = 0; i < bitfield->size; i++) {
+        fputc(bitfield_test(bitfield, i) ? '1' : '0', file);
+    }
+}
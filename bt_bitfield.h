@@ -0,0 +1,89 @@
+#ifndef _BT_BITFIELD_H
+#define _BT_BITFIELD_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "bt_lib.h"
+
+/* bitfield storage is padded to a multiple of this many bytes so the set kernels can work in whole vectors */
+#define BITFIELD_ALIGN 32
+
+/**
+ * bitfield_init(bt_bitfield_t *bitfield, size_t n_pieces) -> int
+ *
+ * allocate an all-zero bitfield for n_pieces pieces
+ *
+ * Return: 0 on success, -1 on allocation failure
+ **/
+int bitfield_init(bt_bitfield_t *bitfield, size_t n_pieces);
+
+/**
+ * bitfield_free(bt_bitfield_t *bitfield) -> void
+ **/
+void bitfield_free(bt_bitfield_t *bitfield);
+
+/* number of bytes of the bitfield on the wire (the BT_BITFILED payload) */
+static inline size_t bitfield_bytes(bt_bitfield_t *bitfield) {
+    return (bitfield->size + 7) / 8;
+}
+
+/* does the bitfield have piece index? */
+static inline int bitfield_test(bt_bitfield_t *bitfield, size_t index) {
+    return (bitfield->bits[index >> 3] >> (7 - (index & 7))) & 1;
+}
+
+/* mark piece index as present */
+static inline void bitfield_set(bt_bitfield_t *bitfield, size_t index) {
+    bitfield->bits[index >> 3] |= 0x80 >> (index & 7);
+}
+
+/* mark piece index as missing */
+static inline void bitfield_clear(bt_bitfield_t *bitfield, size_t index) {
+    bitfield->bits[index >> 3] &= ~(0x80 >> (index & 7));
+}
+
+/* mark piece index as present; safe against other threads setting bits in the same byte */
+static inline void bitfield_set_atomic(bt_bitfield_t *bitfield, size_t index) {
+    __atomic_fetch_or(&bitfield->bits[index >> 3], 0x80 >> (index & 7), __ATOMIC_RELAXED);
+}
+
+/**
+ * bitfield_load(bt_bitfield_t *bitfield, const unsigned char *wire, size_t len) -> int
+ *
+ * fill bitfield from a BT_BITFILED payload of len bytes
+ *
+ * Return: 0 on success, -1 if len is wrong or spare bits past the last piece are set
+ **/
+int bitfield_load(bt_bitfield_t *bitfield, const unsigned char *wire, size_t len);
+
+/**
+ * bitfield_count(bt_bitfield_t *bitfield) -> size_t
+ *
+ * Return: number of pieces present (population count)
+ **/
+size_t bitfield_count(bt_bitfield_t *bitfield);
+
+/**
+ * bitfield_any_andnot(bt_bitfield_t *a, bt_bitfield_t *b) -> int
+ *
+ * Return: 1 if a has any piece b lacks ("does this peer have anything I
+ * need"), 0 otherwise; nothing is written
+ **/
+int bitfield_any_andnot(bt_bitfield_t *a, bt_bitfield_t *b);
+
+/**
+ * bitfield_find_first(bt_bitfield_t *bitfield, size_t from) -> long
+ *
+ * Return: index of the first piece >= from that is present, -1 if none
+ **/
+long bitfield_find_first(bt_bitfield_t *bitfield, size_t from);
+
+/**
+ * print_bitfield(FILE *file, bt_bitfield_t *bitfield) -> void
+ *
+ * print one '0'/'1' per piece
+ **/
+void print_bitfield(FILE *file, bt_bitfield_t *bitfield);
+
+#endif
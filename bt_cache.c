@@ -0,0 +1,383 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bt_lib.h"
+#include "bt_cache.h"
+#include "bt_io.h"
+#include "bt_disk.h"
+
+/**
+ * cache_init() splits as many pieces as the memory budget holds over the shards
+ **/
+static int cache_init(bt_args_t *bt_args) {
+    read_cache_t *cache;
+    read_cache_shard_t *shard;
+    int i, j, pieces = MEMORY_BUDGET / bt_args->bt_info->piece_length;
+
+    if (pieces < 1) {
+        pieces = 1;
+    }
+    if ( (cache = calloc(1, sizeof(read_cache_t))) == NULL ) {
+        return -1;
+    }
+    if ( (cache->node_of = malloc(bt_args->bt_info->num_pieces * sizeof(int))) == NULL ) {
+        free(cache);
+        return -1;
+    }
+    for (i = 0; i < bt_args->bt_info->num_pieces; i++) {
+        cache->node_of[i] = -1;
+    }
+
+    cache->n_shards = (pieces < CACHE_SHARDS) ? pieces : CACHE_SHARDS;
+    for (i = 0; i < cache->n_shards; i++) {
+        shard = &cache->shards[i];
+        shard->capacity = pieces / cache->n_shards;
+        if ( (shard->nodes = malloc(2 * shard->capacity * sizeof(arc_node_t))) == NULL ) {
+            while (--i >= 0) {
+                free(cache->shards[i].nodes);
+                pthread_mutex_destroy(&cache->shards[i].lock);
+            }
+            free(cache->node_of);
+            free(cache);
+            return -1;
+        }
+        for (j = 0; j < 2 * shard->capacity; j++) {
+            shard->nodes[j].index = -1;
+            shard->nodes[j].piece = NULL;
+            shard->nodes[j].next = (j + 1 < 2 * shard->capacity) ? j + 1 : -1;
+        }
+        shard->free_node = 0;
+        for (j = 0; j < ARC_LISTS; j++) {
+            shard->head[j] = shard->tail[j] = -1;
+        }
+        pthread_mutex_init(&shard->lock, NULL);
+    }
+
+    bt_args->cache = cache;
+    return 0;
+}
+
+static void list_unlink(read_cache_shard_t *shard, int n) {
+    arc_node_t *node = &shard->nodes[n];
+
+    if (node->prev >= 0) {
+        shard->nodes[node->prev].next = node->next;
+    } else {
+        shard->head[node->list] = node->next;
+    }
+    if (node->next >= 0) {
+        shard->nodes[node->next].prev = node->prev;
+    } else {
+        shard->tail[node->list] = node->prev;
+    }
+    shard->size[node->list]--;
+}
+
+static void list_push(read_cache_shard_t *shard, int n, int list) {
+    arc_node_t *node = &shard->nodes[n];
+
+    node->list = list;
+    node->prev = -1;
+    node->next = shard->head[list];
+    if (node->next >= 0) {
+        shard->nodes[node->next].prev = n;
+    } else {
+        shard->tail[list] = n;
+    }
+    shard->head[list] = n;
+    shard->size[list]++;
+}
+
+/**
+ * unref() drops a reference and frees the piece with the last one; returns the bytes given back to the budget
+ **/
+static size_t unref(bt_args_t *bt_args, cached_piece_t *piece) {
+    size_t bytes = sizeof(cached_piece_t) + piece->length;
+
+    if ( __atomic_sub_fetch(&piece->refs, 1, __ATOMIC_ACQ_REL) > 0 ) {
+        return 0;
+    }
+    free(piece);
+    mem_release(bt_args, bytes);
+    return bytes;
+}
+
+/**
+ * forget() takes a node off its list and back to the free list; the piece is neither cached nor remembered then
+ **/
+static size_t forget(bt_args_t *bt_args, read_cache_shard_t *shard, int n) {
+    arc_node_t *node = &shard->nodes[n];
+    size_t freed = 0;
+
+    if (node->piece) {
+        freed = unref(bt_args, node->piece);
+        node->piece = NULL;
+    }
+    list_unlink(shard, n);
+    bt_args->cache->node_of[node->index] = -1;
+    node->index = -1;
+    node->next = shard->free_node;
+    shard->free_node = n;
+    return freed;
+}
+
+/**
+ * replace() is ARC's REPLACE: evicts the least recently used piece of T1 if T1 is over target (or T2 is empty),
+ * else of T2, and remembers it as a ghost. from_b2 is set when the miss was a ghost hit in B2
+ **/
+static size_t replace(bt_args_t *bt_args, read_cache_shard_t *shard, int from_b2) {
+    arc_node_t *node;
+    size_t freed = 0;
+    int n, ghost;
+
+    if ( shard->size[ARC_T1] > 0 && (shard->size[ARC_T1] > shard->target || shard->size[ARC_T2] == 0 ||
+            (from_b2 && shard->size[ARC_T1] == shard->target)) ) {
+        n = shard->tail[ARC_T1];
+        ghost = ARC_B1;
+    } else if (shard->size[ARC_T2] > 0) {
+        n = shard->tail[ARC_T2];
+        ghost = ARC_B2;
+    } else {
+        return 0;
+    }
+
+    node = &shard->nodes[n];
+    freed = unref(bt_args, node->piece);
+    node->piece = NULL;
+    list_unlink(shard, n);
+    list_push(shard, n, ghost);
+    return freed;
+}
+
+/**
+ * make_room() is ARC's handling of a piece seen for the first time: keeps T1 + B1 and all four lists within
+ * bounds, then takes a free node for the piece
+ **/
+static int make_room(bt_args_t *bt_args, read_cache_shard_t *shard) {
+    int n, cached = shard->size[ARC_T1] + shard->size[ARC_T2];
+    int total = cached + shard->size[ARC_B1] + shard->size[ARC_B2];
+
+    if (shard->size[ARC_T1] + shard->size[ARC_B1] >= shard->capacity) {
+        if (shard->size[ARC_B1] > 0) {
+            forget(bt_args, shard, shard->tail[ARC_B1]);
+            if (cached >= shard->capacity) {
+                replace(bt_args, shard, 0);
+            }
+        } else {
+            forget(bt_args, shard, shard->tail[ARC_T1]);
+        }
+    } else if (total >= shard->capacity) {
+        if (total >= 2 * shard->capacity) {
+            forget(bt_args, shard, shard->tail[ARC_B2]);
+        }
+        if (cached >= shard->capacity) {
+            replace(bt_args, shard, 0);
+        }
+    }
+
+    if ( (n = shard->free_node) >= 0 ) {
+        shard->free_node = shard->nodes[n].next;
+    }
+    return n;
+}
+
+/**
+ * admit() makes room for a piece, evicting this shard's coldest pieces while the budget is short
+ **/
+static cached_piece_t * admit(bt_args_t *bt_args, read_cache_shard_t *shard, int index, int length) {
+    cached_piece_t *piece;
+    size_t bytes = sizeof(cached_piece_t) + length;
+
+    while ( mem_charge(bt_args, bytes) < 0 ) {
+        if (shard->size[ARC_T1] + shard->size[ARC_T2] == 0) {
+            return NULL;
+        }
+        replace(bt_args, shard, 0);
+    }
+    if ( (piece = malloc(bytes)) == NULL ) {
+        mem_release(bt_args, bytes);
+        return NULL;
+    }
+    piece->refs = 1;
+    piece->index = index;
+    piece->length = length;
+    piece->ready = 0;
+    return piece;
+}
+
+/**
+ * piece_loaded() is called on the event loop once a piece was read in; a piece that could not be read is
+ * dropped from the cache, and uploads waiting for it send from the payload instead
+ **/
+static void piece_loaded(bt_args_t *bt_args, disk_op_t *op) {
+    cached_piece_t *piece = op->arg;
+    read_cache_t *cache = bt_args->cache;
+    read_cache_shard_t *shard;
+    int n;
+
+    if (op->result < 0) {
+        piece->ready = -1;
+        shard = &cache->shards[piece->index % cache->n_shards];
+        pthread_mutex_lock(&shard->lock);
+        if ( (n = cache->node_of[piece->index]) >= 0 && shard->nodes[n].piece == piece ) {
+            forget(bt_args, shard, n);
+        }
+        pthread_mutex_unlock(&shard->lock);
+    } else {
+        piece->ready = 1;
+    }
+    unref(bt_args, piece);  // the read's
+}
+
+/**
+ * cache_get() hits move to the front of T2; misses are admitted to T1, or to T2 if the piece was a ghost, whose
+ * list then had been too short and grows by target moving its way
+ **/
+cached_piece_t * cache_get(bt_args_t *bt_args, int index) {
+    read_cache_t *cache;
+    read_cache_shard_t *shard;
+    arc_node_t *node;
+    cached_piece_t *piece = NULL;
+    unsigned char *data;
+    int n, list, delta, length = piece_size(bt_args->bt_info, index);
+
+    if ( (data = store_view(&bt_args->store, bt_args->bt_info, index, 0, length)) == NULL ) {
+        return NULL;
+    }
+    if ( bt_args->cache == NULL && cache_init(bt_args) < 0 ) {
+        return NULL;
+    }
+    cache = bt_args->cache;
+    shard = &cache->shards[index % cache->n_shards];
+
+    pthread_mutex_lock(&shard->lock);
+    n = cache->node_of[index];
+
+    if (n >= 0 && shard->nodes[n].piece) {
+        shard->hits++;
+        list_unlink(shard, n);
+        list_push(shard, n, ARC_T2);
+        piece = shard->nodes[n].piece;
+        __atomic_add_fetch(&piece->refs, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&shard->lock);
+        return piece;
+    }
+
+    shard->misses++;
+    if (n >= 0) {
+        if (shard->nodes[n].list == ARC_B1) {
+            delta = (shard->size[ARC_B2] > shard->size[ARC_B1]) ? shard->size[ARC_B2] / shard->size[ARC_B1] : 1;
+            shard->target = (shard->target + delta < shard->capacity) ? shard->target + delta : shard->capacity;
+        } else {
+            delta = (shard->size[ARC_B1] > shard->size[ARC_B2]) ? shard->size[ARC_B1] / shard->size[ARC_B2] : 1;
+            shard->target = (shard->target > delta) ? shard->target - delta : 0;
+        }
+        if (shard->size[ARC_T1] + shard->size[ARC_T2] >= shard->capacity) {
+            replace(bt_args, shard, shard->nodes[n].list == ARC_B2);
+        }
+        list_unlink(shard, n);
+        list = ARC_T2;
+    } else {
+        if ( (n = make_room(bt_args, shard)) < 0 ) {
+            pthread_mutex_unlock(&shard->lock);
+            return NULL;
+        }
+        shard->nodes[n].index = index;
+        cache->node_of[index] = n;
+        list = ARC_T1;
+    }
+
+    // no memory for the data: the piece is still remembered, as a ghost
+    node = &shard->nodes[n];
+    if ( (node->piece = admit(bt_args, shard, index, length)) == NULL ) {
+        list = (list == ARC_T1) ? ARC_B1 : ARC_B2;
+    } else {
+        piece = node->piece;
+        __atomic_add_fetch(&piece->refs, 2, __ATOMIC_RELAXED);  // the caller's, and the read's
+
+        // off the event loop if the disk backend takes it; a stalled disk then only holds up this piece
+        if ( disk_submit(bt_args, DISK_READ, bt_args->store.fd, piece->data, length,
+                (off_t) index * bt_args->bt_info->piece_length, piece_loaded, piece) < 0 ) {
+            memcpy(piece->data, data, length);
+            piece->ready = 1;
+            __atomic_sub_fetch(&piece->refs, 1, __ATOMIC_RELAXED);
+        }
+    }
+    list_push(shard, n, list);
+
+    pthread_mutex_unlock(&shard->lock);
+    return piece;
+}
+
+void cache_release(bt_args_t *bt_args, cached_piece_t *piece) {
+    unref(bt_args, piece);
+}
+
+/**
+ * cache_shrink() evicts from the shards in turn, so that no shard is emptied while others stay full
+ **/
+size_t cache_shrink(bt_args_t *bt_args, size_t bytes) {
+    read_cache_t *cache = bt_args->cache;
+    read_cache_shard_t *shard;
+    size_t freed = 0;
+    int i, evicted;
+
+    if (cache == NULL) {
+        return 0;
+    }
+
+    do {
+        evicted = 0;
+        for (i = 0; i < cache->n_shards && freed < bytes; i++) {
+            shard = &cache->shards[i];
+            pthread_mutex_lock(&shard->lock);
+            if (shard->size[ARC_T1] + shard->size[ARC_T2] > 0) {
+                freed += replace(bt_args, shard, 0);
+                evicted = 1;
+            }
+            pthread_mutex_unlock(&shard->lock);
+        }
+    } while (evicted && freed < bytes);
+
+    return freed;
+}
+
+void cache_stats(bt_args_t *bt_args, unsigned long long *hits, unsigned long long *misses) {
+    read_cache_t *cache = bt_args->cache;
+    int i;
+
+    *hits = *misses = 0;
+    if (cache == NULL) {
+        return;
+    }
+    for (i = 0; i < cache->n_shards; i++) {
+        pthread_mutex_lock(&cache->shards[i].lock);
+        *hits += cache->shards[i].hits;
+        *misses += cache->shards[i].misses;
+        pthread_mutex_unlock(&cache->shards[i].lock);
+    }
+}
+
+void cache_free(bt_args_t *bt_args) {
+    read_cache_t *cache = bt_args->cache;
+    read_cache_shard_t *shard;
+    int i, j;
+
+    if (cache == NULL) {
+        return;
+    }
+    for (i = 0; i < cache->n_shards; i++) {
+        shard = &cache->shards[i];
+        for (j = 0; j < 2 * shard->capacity; j++) {
+            if (shard->nodes[j].piece) {
+                unref(bt_args, shard->nodes[j].piece);
+            }
+        }
+        free(shard->nodes);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free(cache->node_of);
+    free(cache);
+    bt_args->cache = NULL;
+}
@@ -0,0 +1,106 @@
+#ifndef _BT_CACHE_H
+#define _BT_CACHE_H
+
+#include <pthread.h>
+
+#include "bt_lib.h"
+
+/* most shards of the read cache; a piece lives in shard index % n_shards, each behind its own lock */
+#define CACHE_SHARDS 8
+
+/* ARC lists of a shard, read_cache_shard_t.head etc. */
+#define ARC_T1 0   // cached, asked for once lately
+#define ARC_T2 1   // cached, asked for again while cached or remembered
+#define ARC_B1 2   // ghosts: pieces evicted from T1, remembered without their data
+#define ARC_B2 3   // ghosts: pieces evicted from T2
+#define ARC_LISTS 4
+
+/* copy of a piece held by the cache. Uploads sending from it hold a reference, so eviction only frees it once
+ * the last of them is done */
+typedef struct cached_piece {
+    int refs;   // the cache's own reference, while the piece is in T1 or T2, plus one per upload and one while
+                // the piece is being read in (atomic)
+    int index;  // which piece
+    int length; // bytes in data
+    int ready;  // 1 once data holds the piece, 0 while it is being read from disk, -1 if that failed
+    unsigned char data[];
+} cached_piece_t;
+
+/* entry of an ARC list, for a cached or a ghost piece */
+typedef struct {
+    int index;  // which piece (-1 if the node is free)
+    int list;   // ARC_* list it is on
+    int prev, next; // neighbouring nodes, most recently used first (-1 at the ends); next links the free list too
+    cached_piece_t *piece;  // the data (NULL for ghosts)
+} arc_node_t;
+
+/* one shard: an Adaptive Replacement Cache of at most capacity pieces. A piece asked for once sits in T1 and
+ * a sequential scan only ever churns T1; pieces asked for again move to T2, which the scan cannot touch. Hits
+ * on the ghost lists move target, the share of capacity T1 gets */
+typedef struct {
+    pthread_mutex_t lock;   // guards everything below and node_of[] of this shard's pieces
+    arc_node_t *nodes;  // 2 * capacity nodes: the four lists together never hold more
+    int free_node;  // first free node, -1 if none
+    int head[ARC_LISTS], tail[ARC_LISTS];   // most and least recently used node of each list (-1 if empty)
+    int size[ARC_LISTS];    // nodes on each list
+    int capacity;   // most pieces cached (T1 + T2)
+    int target; // ARC's p: size T1 is steered to, between 0 and capacity
+    unsigned long long hits, misses;
+} read_cache_shard_t;
+
+/* read cache of the pieces we serve, in front of the payload mapping */
+typedef struct read_cache {
+    read_cache_shard_t shards[CACHE_SHARDS];
+    int n_shards;   // shards in use, fewer than CACHE_SHARDS when the budget holds only a few pieces
+    int *node_of;   // node of each piece in its shard, -1 if neither cached nor remembered
+} read_cache_t;
+
+/**
+ * cache_get(bt_args_t *bt_args, int index) -> cached_piece_t *
+ *
+ * look piece index up in the read cache and, on a miss, read it in from
+ * the payload in the background (see bt_disk.h): the piece is not ready
+ * until the read completes. The cache is set up on first use. Admitting a piece draws
+ * on the memory budget shared with the assembly buffers (see mem_charge());
+ * when that is spent, the cache's own coldest pieces go first.
+ *
+ * Return: the piece with a reference taken for the caller, to be given
+ * back with cache_release(); NULL if the piece is not in the payload or
+ * no memory could be had (read it from the payload then)
+ **/
+cached_piece_t * cache_get(bt_args_t *bt_args, int index);
+
+/**
+ * cache_release(bt_args_t *bt_args, cached_piece_t *piece) -> void
+ *
+ * drop a reference taken by cache_get(); the piece's memory goes back to
+ * the budget once it is evicted and unreferenced
+ **/
+void cache_release(bt_args_t *bt_args, cached_piece_t *piece);
+
+/**
+ * cache_shrink(bt_args_t *bt_args, size_t bytes) -> size_t
+ *
+ * evict cached pieces, coldest first, until bytes of the memory budget are
+ * back or the cache is empty. Called when the download needs the memory.
+ *
+ * Return: bytes given back to the budget (pieces still being uploaded
+ * are evicted, but only give theirs back when the upload is done)
+ **/
+size_t cache_shrink(bt_args_t *bt_args, size_t bytes);
+
+/**
+ * cache_stats(bt_args_t *bt_args, unsigned long long *hits, unsigned long long *misses) -> void
+ *
+ * lookups served from the cache and lookups that went to the payload
+ **/
+void cache_stats(bt_args_t *bt_args, unsigned long long *hits, unsigned long long *misses);
+
+/**
+ * cache_free(bt_args_t *bt_args) -> void
+ *
+ * evict and free everything; uploads must have released their pieces
+ **/
+void cache_free(bt_args_t *bt_args);
+
+#endif
@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>  // for inet_ntoa()
+
+#include "bt_lib.h"
+#include "bt_choke.h"
+#include "bt_bitfield.h"
+
+/**
+ * candidate() is true for a peer that may be given a slot: connected, handshake done, and interested
+ **/
+static int candidate(bt_args_t *bt_args, int slot) {
+    peer_table_t *peers = &bt_args->peers;
+
+    return peers->fd[slot] >= 0 && !(peers->flags[slot] & PEER_CONNECTING) &&
+            (peers->peer[slot]->hs_state & HS_RECEIVED) && (peers->flags[slot] & PEER_INTERESTED);
+}
+
+/**
+ * set_choked() chokes or unchokes the peer, if that is a change. A choked peer's requests are dropped, as the
+ * protocol says; the block being sent goes out whole
+ *
+ * Return: 0 on success, -1 if the peer should be dropped
+ **/
+static int set_choked(bt_args_t *bt_args, peer_t *peer, int choke) {
+    unsigned char *flags = &bt_args->peers.flags[peer->slot];
+
+    if ( choke == !!(*flags & PEER_AM_CHOKING) ) {
+        return 0;
+    }
+    *flags ^= PEER_AM_CHOKING;
+    if (choke) {
+        peer->up_count = 0;
+    }
+    if (bt_args->verbose) {
+        printf("%s PEER: '%s:%u'\n", choke ? "CHOKED" : "UNCHOKED", inet_ntoa(peer->sockaddr.sin_addr), peer->port);
+    }
+    return send_control(bt_args, peer, choke ? BT_CHOKE : BT_UNCHOKE);
+}
+
+/**
+ * pick_optimistic() draws one of the interested peers that the rates leave choked, NULL if there is none
+ **/
+static peer_t * pick_optimistic(bt_args_t *bt_args, const unsigned char *unchoke) {
+    peer_table_t *peers = &bt_args->peers;
+    int slot, n = 0, pick;
+
+    for (slot = 0; slot < peers->n_peers; slot++) {
+        n += candidate(bt_args, slot) && !unchoke[slot];
+    }
+    if (n == 0) {
+        return NULL;
+    }
+    pick = rand() % n;
+    for (slot = 0; slot < peers->n_peers; slot++) {
+        if ( candidate(bt_args, slot) && !unchoke[slot] && pick-- == 0 ) {
+            return peers->peer[slot];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * choke_round() picks the UPLOAD_SLOTS fastest interested peers, keeps (or, when due, moves) the optimistic
+ * unchoke, and chokes the rest
+ **/
+static void choke_round(bt_args_t *bt_args, long long now) {
+    peer_table_t *peers = &bt_args->peers;
+    choker_t *choker = &bt_args->choker;
+    int seeding = bitfield_count(bt_args->bitfield) == (size_t) bt_args->bt_info->num_pieces;
+    unsigned int *rate = seeding ? peers->up_rate : peers->down_rate;
+    int best[UPLOAD_SLOTS];
+    int n_best = 0, slot, k;
+    unsigned char *unchoke;
+
+    if ( (unchoke = calloc(peers->n_peers + 1, 1)) == NULL ) {
+        return; // keep the slots as they are until the next round
+    }
+
+    // the fastest first; a handful of slots, so insertion into a short sorted list does
+    for (slot = 0; slot < peers->n_peers; slot++) {
+        if ( !candidate(bt_args, slot) ) {
+            continue;
+        }
+        for (k = n_best; k > 0 && rate[best[k - 1]] < rate[slot]; k--) {
+            if (k < UPLOAD_SLOTS) {
+                best[k] = best[k - 1];
+            }
+        }
+        if (k < UPLOAD_SLOTS) {
+            best[k] = slot;
+            if (n_best < UPLOAD_SLOTS) {
+                n_best++;
+            }
+        }
+    }
+    for (k = 0; k < n_best; k++) {
+        unchoke[best[k]] = 1;
+    }
+
+    // the optimistic unchoke only counts while it still is one: a peer that earned a slot frees it
+    if ( choker->optimistic && (unchoke[choker->optimistic->slot] || !candidate(bt_args, choker->optimistic->slot)) ) {
+        choker->optimistic = NULL;
+    }
+    if (choker->optimistic == NULL || now >= choker->next_optimistic_ms) {
+        choker->optimistic = pick_optimistic(bt_args, unchoke);
+        choker->next_optimistic_ms = now + OPTIMISTIC_INTERVAL_MS;
+    }
+    if (choker->optimistic) {
+        unchoke[choker->optimistic->slot] = 1;
+    }
+
+    // from the last slot down, so dropping a peer (the last one moves into its slot) never skips one
+    for (slot = peers->n_peers - 1; slot >= 0; slot--) {
+        if ( peers->fd[slot] < 0 || (peers->flags[slot] & PEER_CONNECTING) ) {
+            continue;
+        }
+        if ( set_choked(bt_args, peers->peer[slot], !unchoke[slot]) < 0 ) {
+            drop_peer(peers->peer[slot], bt_args);
+        }
+    }
+    free(unchoke);
+}
+
+/**
+ * choke_tick() runs a round when one is due
+ **/
+void choke_tick(bt_args_t *bt_args) {
+    long long now = now_ms();
+
+    if (now < bt_args->choker.next_round_ms) {
+        return;
+    }
+    choke_round(bt_args, now);
+    bt_args->choker.next_round_ms = now + CHOKE_INTERVAL_MS;
+}
+
+/**
+ * choke_interested() counts the unchoked interested peers; below UPLOAD_SLOTS plus the optimistic one there is room
+ **/
+int choke_interested(bt_args_t *bt_args, peer_t *peer) {
+    peer_table_t *peers = &bt_args->peers;
+    int slot, n_unchoked = 0;
+
+    for (slot = 0; slot < peers->n_peers; slot++) {
+        n_unchoked += candidate(bt_args, slot) && !(peers->flags[slot] & PEER_AM_CHOKING);
+    }
+    if (n_unchoked >= UPLOAD_SLOTS + 1) {
+        return 0;
+    }
+    return set_choked(bt_args, peer, 0);
+}
+
+/**
+ * choke_forget() clears the optimistic unchoke if it is this peer; a slot the peer held is handed out at the next
+ * turn of the event loop instead of the next round
+ **/
+void choke_forget(bt_args_t *bt_args, peer_t *peer) {
+    if (bt_args->choker.optimistic == peer) {
+        bt_args->choker.optimistic = NULL;
+    }
+    if ( peer->slot >= 0 && candidate(bt_args, peer->slot) && !(bt_args->peers.flags[peer->slot] & PEER_AM_CHOKING) ) {
+        bt_args->choker.next_round_ms = 0;
+    }
+}
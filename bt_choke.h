@@ -0,0 +1,47 @@
+#ifndef _BT_CHOKE_H
+#define _BT_CHOKE_H
+
+#include "bt_lib.h"
+
+/* peers unchoked for their rate, besides the optimistic unchoke */
+#define UPLOAD_SLOTS 4
+
+/* how often (ms) the unchoked peers are chosen again */
+#define CHOKE_INTERVAL_MS 10000
+
+/* how often (ms) the optimistic unchoke moves on to another peer */
+#define OPTIMISTIC_INTERVAL_MS 30000
+
+/**
+ * choke_tick(bt_args_t *bt_args) -> void
+ *
+ * called once per turn of the event loop. Every CHOKE_INTERVAL_MS the
+ * UPLOAD_SLOTS interested peers with the best rate are unchoked: the rate
+ * they send to us at while we download, the rate we send to them at once
+ * we seed (so the fastest takers get the data). Every
+ * OPTIMISTIC_INTERVAL_MS one other interested peer, picked at random, is
+ * unchoked as well, to find peers better than the current ones and to let
+ * new peers in. Everybody else is choked. Peers whose sockets fail are
+ * dropped.
+ **/
+void choke_tick(bt_args_t *bt_args);
+
+/**
+ * choke_interested(bt_args_t *bt_args, peer_t *peer) -> int
+ *
+ * the peer has become interested: unchoke it right away if a slot is
+ * free, else it waits for the next round
+ *
+ * Return: 0 on success, -1 if the peer should be dropped
+ **/
+int choke_interested(bt_args_t *bt_args, peer_t *peer);
+
+/**
+ * choke_forget(bt_args_t *bt_args, peer_t *peer) -> void
+ *
+ * the peer is being dropped; if it held a slot (optimistic or not), the
+ * slots are handed out again at the next turn of the event loop
+ **/
+void choke_forget(bt_args_t *bt_args, peer_t *peer);
+
+#endif
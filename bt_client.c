@@ -14,18 +14,55 @@
 #include <sys/socket.h>				// for socket operations
 #include <sys/types.h>
 #include <signal.h>
+#include <time.h>
 
 #include "bt_lib.h"
 #include "bt_setup.h"
+#include "bt_sock.h"
+#include "bt_peer.h"
+#include "bt_io.h"
+#include "bt_bitfield.h"
+#include "bt_picker.h"
+#include "bt_request.h"
+#include "bt_wire.h"
+#include "bt_resume.h"
+#include "bt_verify.h"
+#include "bt_cache.h"
+#include "bt_disk.h"
+#include "bt_resolve.h"
+#include "bt_choke.h"
+#include "bt_limit.h"
+
+/* set by SIGINT/SIGTERM: leave the main loop and shut down cleanly */
+static volatile sig_atomic_t stop_requested = 0;
+
+/**
+ * request_stop() is the handler of SIGINT and SIGTERM; the main loop notices once epoll_wait() returns
+ **/
+static void request_stop(int sig) {
+    (void) sig;
+    stop_requested = 1;
+}
 
 int main (int argc, char * argv[]) {
 
     bt_args_t bt_args; // structure to capture command-line arguments
-    int i;	// loop iterator
-    int leecher_sock;   // leecher's connection socket
+    unsigned long long cache_hits, cache_misses;    // read cache lookups, reported on the way out
 
     parse_args(&bt_args, argc, argv);
 
+    // a peer hanging up mid-write must only cost us that peer, not the whole client
+    signal(SIGPIPE, SIG_IGN);
+
+    // ^C or kill lets the loop finish its turn, so the fast-resume sidecar gets saved on the way out
+    signal(SIGINT, request_stop);
+    signal(SIGTERM, request_stop);
+
+    // set up the event loop that will own the listen socket and every peer socket
+    if ( reactor_init(&bt_args) < 0 ) {
+        exit(1);
+    }
+
     if (bt_args.verbose) {	// if verbose mode is requested
         printf("Args information from command line:\n");
         printf("\tverbose: %d\n", bt_args.verbose);
@@ -34,11 +71,8 @@ int main (int argc, char * argv[]) {
         printf("\ttorrent_file: %s\n", bt_args.torrent_file);	// metainfo or torrent file being used by bt client
 
         // print information of all peers
-        /*for (i = 0; i < MAX_CONNECTIONS; i++) {
-            if(bt_args.peers[i] != NULL)
-                print_peer(bt_args.peers[i]);
-            else
-                break;
+        /*for (i = 0; i < bt_args.peers.n_peers; i++) {
+            print_peer(bt_args.peers.peer[i]);
         }*/
     }
 
@@ -47,6 +81,22 @@ int main (int argc, char * argv[]) {
 
     // parse the torrent file to fill up contents of the bt_info structure with required information from the 'info' dictionary in .torrent file
     parse_torrent_file(&bt_args, bt_info);
+    bt_args.bt_info = bt_info;
+
+    /* map the payload: a seeder serves blocks straight out of it, a leecher writes received blocks into it
+     * (created and sized to the torrent if it does not exist yet) */
+    if ( store_open(&bt_args.store, payload_path(&bt_args), bt_info, !bt_args.bind) < 0 ) {
+        fprintf(stderr, "ERROR: Could not open target torrent file: %s\n", payload_path(&bt_args));
+        exit(1);
+    }
+
+    // disk I/O of the event loop goes through a backend of its own; without one it is done in place
+    if ( disk_init(&bt_args) < 0 ) {
+        fprintf(stderr, "ERROR: No asynchronous disk I/O; reading and writing the payload in the event loop.\n");
+    } else if (bt_args.store.writable) {
+        // reserve the payload's blocks up front, so writes later never wait on allocation (best effort)
+        disk_submit(&bt_args, DISK_FALLOCATE, bt_args.store.fd, NULL, bt_args.store.length, 0, NULL, NULL);
+    }
 
     if (bt_args.bind == 1) {    // bt client runs in seeder mode
 
@@ -55,49 +105,74 @@ int main (int argc, char * argv[]) {
          * make seeder listen for incoming leecher connections */
         init_seeder(&bt_args);
         create_bitfield(&bt_args, bt_info);
-        printf("BITFIELD at SEEDER: '%s'\n", bt_args.bitfield->bits);
-        // printf("testing, bt_args.bitfield->bits: '%s'\n", bt_args.bitfield->bits);
+        printf("BITFIELD at SEEDER: '");
+        print_bitfield(stdout, bt_args.bitfield);
+        printf("'\n");
         // printf("testing, inside main, bt_args.bitfield->size: %ld\n", bt_args.bitfield->size);
 
     } else {    // bt client runs in leecher mode
-        for (i = 0; i < MAX_CONNECTIONS; i++) {
-            if (bt_args.peers[i] != NULL) {
-                // write all client (leecher) code here
-
-                if (bt_args.verbose) {
-                    printf("Creating a leecher socket...\n");
-                }
-                leecher_sock = init_leecher(bt_args.peers[i]); // run a leecher instance for each peer recorded in bt_args->peers[]
-                unsigned char *handshake = malloc(100);   // handshake information to be exchanged between peers
-                init_handshake(bt_args.peers[i], handshake, bt_info);
-                
-                // send handshake over to seeder
-                ssize_t bytes_written;
-                if ( (bytes_written = write(leecher_sock, handshake, 100)) < 0 ) {
-                    fprintf(stderr, "ERROR: Could not write to leecher socket.\n");
-                    exit(1);
-                }
-
-            } else
-                break;
+
+        // find out which pieces an earlier (interrupted) download already saved
+        create_bitfield(&bt_args, bt_info);
+        if (bt_args.verbose) {
+            printf("BITFIELD at LEECHER: '");
+            print_bitfield(stdout, bt_args.bitfield);
+            printf("'\n");
         }
 
+        // every peer is dialed in parallel by connect_peers() once the main loop runs
+    }
+
+    /* count piece availability across peers, so downloads go for the rarest pieces first; every client
+     * breaks ties differently */
+    srand(time(NULL) ^ getpid());
+    if ( picker_init(&bt_args.picker, bt_info->num_pieces, bt_args.bitfield) < 0 ) {
+        fprintf(stderr, "ERROR: Could not allocate the piece picker.\n");
+        exit(1);
     }
+    bt_args.download.last_tick_ms = now_ms();
 
     // main client loop
-    // printf("Starting Main Loop\n");
-    /*
-	while(1){
-
-        // try to accept incoming connection from new peer
-             
-        // poll current peers for incoming traffic
-        // write pieces to files
-        // update peers' choke or unchoke status
+    if (bt_args.verbose) {
+        printf("Starting Main Loop\n");
+    }
+
+    // a seeder serves until killed; a leecher runs as long as it has peers to talk to
+    while ( !stop_requested && (bt_args.bind || bt_args.peers.n_peers > 0) ) {
+
+        // dial the peers we are not connected to yet, retry those that failed, time out slow connects
+        connect_peers(&bt_args);
+
+        // a new turn of the rate limiter: refill the buckets and let held-back peers move again
+        limit_turn(&bt_args);
+
+        // send what the last turn queued, one gathered write per peer, before waiting for more
+        flush_peers(&bt_args);
+
+        // disk operations queued since the last wait (reads for those sends included) go out together
+        disk_flush(&bt_args);
+
+        // accept incoming connections from new peers & poll current peers for incoming traffic
+        if ( poll_peers(&bt_args) < 0 ) {
+            break;
+        }
+
+        // keep every unchoked peer's request pipeline full; re-request blocks that stalled
+        request_tick(&bt_args);
+
+        // give the upload slots to the peers that give us the most (or, seeding, take the most)
+        choke_tick(&bt_args);
+
+        // checkpoint the verified pieces now and then, so a crash costs a short recheck instead of a full one
+        resume_tick(&bt_args);
+
+        // a leecher is done once every piece is in and verified
+        if ( !bt_args.bind && bitfield_count(bt_args.bitfield) == (size_t) bt_info->num_pieces ) {
+            printf("DOWNLOAD COMPLETE: '%s'\n", payload_path(&bt_args));
+            break;
+        }
+
         // responses to have/havenots/interested etc.
-        
-        // for peers that are not choked
-        //     request pieces from outcoming traffic
 
         // check livelness of peers and replace dead (or useless) peers
         // with new potentially useful peers
@@ -105,7 +180,41 @@ int main (int argc, char * argv[]) {
         // update peers, 
 
     }
-	*/
-	
+
+    // peers still connected let go of their requests, uploads and buffers before those are torn down
+    while (bt_args.peers.n_peers > 0) {
+        drop_peer(bt_args.peers.peer[bt_args.peers.n_peers - 1], &bt_args);
+    }
+
+    verify_free(&bt_args);
+    resolver_free(&bt_args);
+    disk_free(&bt_args);    // pieces still being written are set in the bitfield before it is saved
+    if ( resume_save(&bt_args) < 0 ) {
+        fprintf(stderr, "ERROR: The next start will recheck '%s' in full.\n", payload_path(&bt_args));
+    }
+
+    cache_stats(&bt_args, &cache_hits, &cache_misses);
+    if (cache_hits + cache_misses > 0) {
+        printf("READ CACHE: %llu hits, %llu misses\n", cache_hits, cache_misses);
+    }
+    cache_free(&bt_args);
+
+    if (bt_args.download.wasted_bytes > 0) {
+        printf("WASTED: %lld bytes of blocks received twice or not needed\n", bt_args.download.wasted_bytes);
+    }
+
+    download_free(&bt_args.download);
+    picker_free(&bt_args.picker);
+    bitfield_free(bt_args.bitfield);
+    free(bt_args.bitfield);
+    store_close(&bt_args.store);
+
+    // the pools go back whole; no peer, frame or piece hash is freed one by one
+    wire_spares_free(&bt_args);
+    slab_set_destroy(&bt_args.bufs);
+    slab_destroy(&bt_args.peer_slab);
+    peer_table_free(&bt_args.peers);
+    arena_free(&bt_info->arena);
+    free(bt_info);
     return 0;
 }
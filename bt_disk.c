@@ -0,0 +1,508 @@
+#define _GNU_SOURCE // for fallocate()
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#undef BLOCK_SIZE    // <linux/fs.h> has one too; bt_lib.h's is the block of a piece
+
+#include "bt_lib.h"
+#include "bt_disk.h"
+#include "bt_sock.h"
+
+/* glibc has no wrappers for the io_uring system calls */
+static int uring_setup(unsigned entries, struct io_uring_params *params) {
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int ring_fd, unsigned opcode, void *arg, unsigned n_args) {
+    return syscall(__NR_io_uring_register, ring_fd, opcode, arg, n_args);
+}
+
+/* io_uring opcode of each DISK_* operation */
+static const unsigned char ring_opcodes[] = { IORING_OP_READ, IORING_OP_WRITE, IORING_OP_FSYNC, IORING_OP_FALLOCATE };
+
+/**
+ * ring_probe() asks the kernel whether the ring takes every opcode we submit. A kernel that has io_uring but not
+ * these (before 5.6) would fail each operation with -EINVAL; one too old to answer the probe lacks them too
+ *
+ * Return: 0 if all are supported, -1 if not
+ **/
+static int ring_probe(int ring_fd) {
+    struct io_uring_probe *probe;
+    size_t i, size = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+    int ret = 0;
+
+    if ( (probe = calloc(1, size)) == NULL ) {
+        return -1;
+    }
+    if ( uring_register(ring_fd, IORING_REGISTER_PROBE, probe, 256) < 0 ) {
+        free(probe);
+        return -1;
+    }
+    for (i = 0; i < sizeof(ring_opcodes); i++) {
+        if ( ring_opcodes[i] > probe->last_op || !(probe->ops[ring_opcodes[i]].flags & IO_URING_OP_SUPPORTED) ) {
+            ret = -1;
+        }
+    }
+    free(probe);
+    return ret;
+}
+
+/**
+ * ring_init() sets up an io_uring whose completions bump event_fd, and maps its rings; a kernel whose ring lacks
+ * an opcode we need gets the thread pool instead
+ **/
+static int ring_init(disk_t *disk) {
+    struct io_uring_params params;
+    unsigned char *sq, *cq;
+
+    memset(&params, 0x00, sizeof(params));
+    if ( (disk->ring_fd = uring_setup(DISK_RING_ENTRIES, &params)) < 0 ) {
+        return -1;
+    }
+    if ( ring_probe(disk->ring_fd) < 0 ) {
+        close(disk->ring_fd);
+        return -1;
+    }
+
+    disk->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    disk->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (disk->cq_ring_size > disk->sq_ring_size) {
+            disk->sq_ring_size = disk->cq_ring_size;
+        }
+        disk->cq_ring_size = disk->sq_ring_size;
+    }
+
+    disk->sq_ring = mmap(NULL, disk->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, disk->ring_fd,
+            IORING_OFF_SQ_RING);
+    if (disk->sq_ring == MAP_FAILED) {
+        disk->sq_ring = NULL;
+        goto FAIL;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        disk->cq_ring = disk->sq_ring;
+    } else if ( (disk->cq_ring = mmap(NULL, disk->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            disk->ring_fd, IORING_OFF_CQ_RING)) == MAP_FAILED ) {
+        disk->cq_ring = NULL;
+        goto FAIL;
+    }
+    disk->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    disk->sqes = mmap(NULL, disk->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, disk->ring_fd,
+            IORING_OFF_SQES);
+    if (disk->sqes == MAP_FAILED) {
+        disk->sqes = NULL;
+        goto FAIL;
+    }
+
+    sq = disk->sq_ring;
+    disk->sq_head = (unsigned *) (sq + params.sq_off.head);
+    disk->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    disk->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    disk->sq_array = (unsigned *) (sq + params.sq_off.array);
+    disk->sq_entries = params.sq_entries;
+    cq = disk->cq_ring;
+    disk->cq_head = (unsigned *) (cq + params.cq_off.head);
+    disk->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    disk->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    disk->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    disk->cq_entries = params.cq_entries;
+
+    if ( uring_register(disk->ring_fd, IORING_REGISTER_EVENTFD, &disk->event_fd, 1) < 0 ) {
+        goto FAIL;
+    }
+    return 0;
+
+    FAIL:
+        if (disk->sqes) {
+            munmap(disk->sqes, disk->sqes_size);
+        }
+        if (disk->cq_ring && disk->cq_ring != disk->sq_ring) {
+            munmap(disk->cq_ring, disk->cq_ring_size);
+        }
+        if (disk->sq_ring) {
+            munmap(disk->sq_ring, disk->sq_ring_size);
+        }
+        close(disk->ring_fd);
+        return -1;
+}
+
+static void ring_free(disk_t *disk) {
+    munmap(disk->sqes, disk->sqes_size);
+    if (disk->cq_ring != disk->sq_ring) {
+        munmap(disk->cq_ring, disk->cq_ring_size);
+    }
+    munmap(disk->sq_ring, disk->sq_ring_size);
+    close(disk->ring_fd);
+}
+
+/**
+ * run_op() is what a pool thread does for an operation: the same system calls io_uring would make, looped over
+ * short reads and writes
+ **/
+static long run_op(disk_op_t *op) {
+    ssize_t n;
+
+    switch (op->type) {
+        case DISK_READ:
+        case DISK_WRITE:
+            while (op->done < op->length) {
+                n = (op->type == DISK_READ)
+                        ? pread(op->fd, op->buf + op->done, op->length - op->done, op->offset + op->done)
+                        : pwrite(op->fd, op->buf + op->done, op->length - op->done, op->offset + op->done);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    return (n < 0) ? -errno : -EIO;  // nothing more to read: the file is short
+                }
+                op->done += n;
+            }
+            return op->length;
+        case DISK_FSYNC:
+            return (fsync(op->fd) < 0) ? -errno : 0;
+        case DISK_FALLOCATE:
+            return (fallocate(op->fd, 0, op->offset, op->length) < 0) ? -errno : 0;
+    }
+    return -EINVAL;
+}
+
+/**
+ * pool_worker() runs operations in the order they were handed over, and posts each one for disk_collect()
+ **/
+static void * pool_worker(void *arg) {
+    disk_t *disk = arg;
+    disk_op_t *op;
+
+    while (1) {
+        pthread_mutex_lock(&disk->lock);
+        while (disk->work == NULL && !disk->stop) {
+            pthread_cond_wait(&disk->wake, &disk->lock);
+        }
+        if ( (op = disk->work) == NULL ) {
+            pthread_mutex_unlock(&disk->lock);
+            return NULL;    // stopped, and nothing left to do
+        }
+        if ( (disk->work = op->next) == NULL ) {
+            disk->work_tail = &disk->work;
+        }
+        pthread_mutex_unlock(&disk->lock);
+
+        op->result = run_op(op);
+
+        pthread_mutex_lock(&disk->lock);
+        op->next = disk->finished;
+        disk->finished = op;
+        pthread_mutex_unlock(&disk->lock);
+        wake_loop(disk->event_fd);
+    }
+}
+
+static int pool_init(disk_t *disk) {
+    pthread_mutex_init(&disk->lock, NULL);
+    pthread_cond_init(&disk->wake, NULL);
+    disk->work_tail = &disk->work;
+
+    disk->n_threads = spawn_helpers(disk->threads, DISK_POOL_THREADS, pool_worker, disk);
+
+    if (disk->n_threads == 0) {
+        pthread_cond_destroy(&disk->wake);
+        pthread_mutex_destroy(&disk->lock);
+        return -1;
+    }
+    return 0;
+}
+
+static void pool_free(disk_t *disk) {
+    int i;
+
+    pthread_mutex_lock(&disk->lock);
+    disk->stop = 1;
+    pthread_cond_broadcast(&disk->wake);
+    pthread_mutex_unlock(&disk->lock);
+    for (i = 0; i < disk->n_threads; i++) {
+        pthread_join(disk->threads[i], NULL);
+    }
+    pthread_cond_destroy(&disk->wake);
+    pthread_mutex_destroy(&disk->lock);
+}
+
+/**
+ * disk_init() prefers io_uring; the pool is there for kernels that lack it or forbid it
+ **/
+int disk_init(bt_args_t *bt_args) {
+    char *choice = getenv("BT_DISK");
+    disk_t *disk;
+
+    if ( (disk = calloc(1, sizeof(disk_t))) == NULL ) {
+        return -1;
+    }
+    disk->queued_tail = &disk->queued;
+    if ( (disk->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ) {
+        free(disk);
+        return -1;
+    }
+
+    if ( (choice == NULL || strcmp(choice, "threads") != 0) && ring_init(disk) == 0 ) {
+        disk->backend = DISK_IO_URING;
+    } else if ( pool_init(disk) == 0 ) {
+        disk->backend = DISK_THREADS;
+    } else {
+        close(disk->event_fd);
+        free(disk);
+        return -1;
+    }
+
+    if ( reactor_add(bt_args, disk->event_fd) < 0 ) {
+        if (disk->backend == DISK_IO_URING) {
+            ring_free(disk);
+        } else {
+            pool_free(disk);
+        }
+        close(disk->event_fd);
+        free(disk);
+        return -1;
+    }
+
+    bt_args->disk = disk;
+    if (bt_args->verbose) {
+        printf("Disk I/O: %s\n", (disk->backend == DISK_IO_URING) ? "io_uring" : "thread pool");
+    }
+    return 0;
+}
+
+int disk_submit(bt_args_t *bt_args, int type, int fd, unsigned char *buf, size_t length, off_t offset,
+        disk_done_t on_done, void *arg) {
+    disk_t *disk = bt_args->disk;
+    disk_op_t *op;
+
+    if ( disk == NULL || (op = calloc(1, sizeof(disk_op_t))) == NULL ) {
+        return -1;
+    }
+    op->type = type;
+    op->fd = fd;
+    op->buf = buf;
+    op->length = length;
+    op->offset = offset;
+    op->on_done = on_done;
+    op->arg = arg;
+
+    *disk->queued_tail = op;
+    disk->queued_tail = &op->next;
+    return 0;
+}
+
+/**
+ * fill_sqe() turns an operation (the part of it not done yet) into a submission queue entry
+ **/
+static void fill_sqe(struct io_uring_sqe *sqe, disk_op_t *op) {
+    memset(sqe, 0x00, sizeof(*sqe));
+    sqe->opcode = ring_opcodes[op->type];
+    sqe->fd = op->fd;
+    sqe->user_data = (uintptr_t) op;
+    if (op->type == DISK_FALLOCATE) {
+        sqe->off = op->offset;
+        sqe->addr = op->length; // fallocate() takes its length where reads take their buffer
+        return;
+    }
+    if (op->type != DISK_FSYNC) {
+        sqe->addr = (uintptr_t) (op->buf + op->done);
+        sqe->len = op->length - op->done;
+        sqe->off = op->offset + op->done;
+    }
+}
+
+/**
+ * complete() resubmits the rest of a short read or write; otherwise the operation is over
+ **/
+static void complete(bt_args_t *bt_args, disk_op_t *op, long res) {
+    disk_t *disk = bt_args->disk;
+
+    disk->in_flight--;
+    if ( (op->type == DISK_READ || op->type == DISK_WRITE) && res > 0 && op->done + res < op->length ) {
+        op->done += res;
+        op->next = NULL;
+        *disk->queued_tail = op;
+        disk->queued_tail = &op->next;
+        return;
+    }
+    if ( (op->type == DISK_READ || op->type == DISK_WRITE) && res >= 0 ) {
+        res = (res == 0) ? -EIO : (long) op->length;    // a read at the end of a short file gets 0
+    }
+
+    op->result = res;
+    if (op->on_done) {
+        op->on_done(bt_args, op);
+    }
+    free(op);
+}
+
+/**
+ * ring_unsubmitted() counts the entries filled in the submission queue that the kernel has not taken yet
+ **/
+static unsigned ring_unsubmitted(disk_t *disk) {
+    return *disk->sq_tail - __atomic_load_n(disk->sq_head, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * ring_fail() takes back the entries the kernel has not taken and fails their operations with error (-errno);
+ * the kernel only reads entries up to the tail, so moving it back to the head withdraws them
+ **/
+static void ring_fail(bt_args_t *bt_args, long error) {
+    disk_t *disk = bt_args->disk;
+    unsigned head = __atomic_load_n(disk->sq_head, __ATOMIC_ACQUIRE), tail = *disk->sq_tail;
+    disk_op_t *op;
+
+    __atomic_store_n(disk->sq_tail, head, __ATOMIC_RELEASE);
+    for (; head != tail; head++) {
+        op = (disk_op_t *) (uintptr_t) disk->sqes[disk->sq_array[head & *disk->sq_mask]].user_data;
+        complete(bt_args, op, error);
+    }
+}
+
+/**
+ * disk_flush() fills the submission queue, staying within what the completion queue can hold, and enters the
+ * kernel for the whole batch. The kernel may take only part of it: entering again hands it the rest, and what it
+ * has no room for now (EAGAIN, EBUSY) stays in the ring for the next turn. Any other failure fails the
+ * operations still in the ring, so none is left counted in in_flight
+ **/
+void disk_flush(bt_args_t *bt_args) {
+    disk_t *disk = bt_args->disk;
+    disk_op_t *op;
+    unsigned tail, pending;
+    int ret;
+
+    if ( disk == NULL || (disk->queued == NULL && (disk->backend == DISK_THREADS || ring_unsubmitted(disk) == 0)) ) {
+        return;
+    }
+
+    if (disk->backend == DISK_THREADS) {
+        pthread_mutex_lock(&disk->lock);
+        *disk->work_tail = disk->queued;
+        disk->work_tail = disk->queued_tail;
+        for (op = disk->queued; op; op = op->next) {
+            disk->in_flight++;
+        }
+        pthread_cond_broadcast(&disk->wake);
+        pthread_mutex_unlock(&disk->lock);
+        disk->queued = NULL;
+        disk->queued_tail = &disk->queued;
+        return;
+    }
+
+    tail = *disk->sq_tail;
+    while ( (op = disk->queued) && tail - __atomic_load_n(disk->sq_head, __ATOMIC_ACQUIRE) < disk->sq_entries
+            && (unsigned) disk->in_flight < disk->cq_entries ) {
+        if ( (disk->queued = op->next) == NULL ) {
+            disk->queued_tail = &disk->queued;
+        }
+        fill_sqe(&disk->sqes[tail & *disk->sq_mask], op);
+        disk->sq_array[tail & *disk->sq_mask] = tail & *disk->sq_mask;
+        tail++;
+        disk->in_flight++;
+    }
+    __atomic_store_n(disk->sq_tail, tail, __ATOMIC_RELEASE);
+
+    while ( (pending = ring_unsubmitted(disk)) > 0 ) {
+        if ( (ret = uring_enter(disk->ring_fd, pending, 0, 0)) > 0 ) {
+            continue;   // taken in part or in full; the rest goes in the next round
+        }
+        if ( ret == 0 || errno == EAGAIN || errno == EBUSY ) {
+            break;  // no room in the kernel now; disk_free() and the next turn try again
+        }
+        if (errno != EINTR) {
+            fprintf(stderr, "ERROR: io_uring_enter failed: %s\n", strerror(errno));
+            ring_fail(bt_args, -errno);
+            break;
+        }
+    }
+}
+
+/**
+ * disk_collect() resets event_fd before looking at the completions, so one that lands meanwhile wakes the loop
+ * again
+ **/
+void disk_collect(bt_args_t *bt_args) {
+    disk_t *disk = bt_args->disk;
+    disk_op_t *op, *finished, *next;
+    struct io_uring_cqe *cqe;
+    uint64_t count;
+    unsigned head;
+
+    if ( read(disk->event_fd, &count, sizeof(count)) < 0 ) {
+        ;   // nothing signalled; look anyway
+    }
+
+    if (disk->backend == DISK_THREADS) {
+        pthread_mutex_lock(&disk->lock);
+        finished = disk->finished;
+        disk->finished = NULL;
+        pthread_mutex_unlock(&disk->lock);
+        for (op = finished; op; op = next) {    // ops that were over before run_op() returned carry their result
+            next = op->next;
+            disk->in_flight--;
+            if (op->on_done) {
+                op->on_done(bt_args, op);
+            }
+            free(op);
+        }
+        return;
+    }
+
+    head = *disk->cq_head;
+    while ( head != __atomic_load_n(disk->cq_tail, __ATOMIC_ACQUIRE) ) {
+        cqe = &disk->cqes[head & *disk->cq_mask];
+        op = (disk_op_t *) (uintptr_t) cqe->user_data;
+        head++;
+        __atomic_store_n(disk->cq_head, head, __ATOMIC_RELEASE);
+        complete(bt_args, op, cqe->res);
+    }
+}
+
+void disk_free(bt_args_t *bt_args) {
+    disk_t *disk = bt_args->disk;
+    struct pollfd pfd;
+
+    if (disk == NULL) {
+        return;
+    }
+
+    // callbacks may queue more (a checkpoint's next step); wait until everything is over
+    pfd.fd = disk->event_fd;
+    pfd.events = POLLIN;
+    while (disk->in_flight > 0 || disk->queued) {
+        disk_flush(bt_args);
+        if (disk->in_flight == 0 && disk->queued == NULL) {
+            break;  // the last ones failed to submit
+        }
+        // entries the kernel had no room for are retried soon rather than waiting for a completion
+        if ( poll(&pfd, 1, (disk->backend == DISK_IO_URING && ring_unsubmitted(disk) > 0) ? DISK_RETRY_MS : -1) < 0
+                && errno != EINTR ) {
+            break;
+        }
+        disk_collect(bt_args);
+    }
+
+    if (disk->backend == DISK_IO_URING) {
+        ring_free(disk);
+    } else {
+        pool_free(disk);
+    }
+    reactor_del(bt_args, disk->event_fd);
+    close(disk->event_fd);
+    free(disk);
+    bt_args->disk = NULL;
+}
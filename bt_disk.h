@@ -0,0 +1,125 @@
+#ifndef _BT_DISK_H
+#define _BT_DISK_H
+
+#include <pthread.h>
+
+#include "bt_lib.h"
+
+/* kinds of disk operation, disk_op_t.type */
+#define DISK_READ 0
+#define DISK_WRITE 1
+#define DISK_FSYNC 2
+#define DISK_FALLOCATE 3
+
+/* disk backends, disk_t.backend */
+#define DISK_IO_URING 0    // one submission ring shared with the kernel, one system call per batch
+#define DISK_THREADS 1 // a pool of threads running pread()/pwrite(), for kernels without io_uring or its file opcodes
+
+/* entries of the io_uring submission queue: the most operations handed to the kernel in one batch */
+#define DISK_RING_ENTRIES 64
+
+/* how long (ms) disk_free() waits before handing the kernel entries it had no room for again */
+#define DISK_RETRY_MS 10
+
+/* threads of the fallback pool */
+#define DISK_POOL_THREADS 4
+
+typedef struct disk_op disk_op_t;
+
+/* called on the event loop once an operation is over; op->result tells how it went and op is freed after */
+typedef void (*disk_done_t)(bt_args_t *bt_args, disk_op_t *op);
+
+/* one disk operation, queued by disk_submit() */
+struct disk_op {
+    int type;   // DISK_*
+    int fd; // file operated on
+    unsigned char *buf; // data to write or room to read into (DISK_READ, DISK_WRITE)
+    size_t length;  // bytes to move, or to allocate (DISK_FALLOCATE)
+    off_t offset;   // where in the file
+    size_t done;    // bytes moved so far; a short read or write is resubmitted for the rest
+    long result;    // once over: length on success (0 for DISK_FSYNC), -errno on failure
+    disk_done_t on_done;    // NULL if nobody waits for the outcome
+    void *arg;  // for on_done
+    disk_op_t *next;    // link in whichever queue holds the op
+};
+
+/* asynchronous disk I/O. Operations queue up during a turn of the event loop and go out together at its end
+ * (disk_flush()); completions are signalled on event_fd, which is in the epoll set, and handled by
+ * disk_collect() on the event loop, so nothing the peers wait for sits behind a slow disk */
+typedef struct disk {
+    int backend;    // DISK_IO_URING or DISK_THREADS
+    int event_fd;   // readable once operations are over
+    disk_op_t *queued;  // submitted, not handed to the backend yet, oldest first
+    disk_op_t **queued_tail;
+    int in_flight;  // handed to the backend and not collected yet
+
+    // DISK_IO_URING
+    int ring_fd;
+    void *sq_ring, *cq_ring;    // the rings, mapped from the kernel (the same mapping if it allows)
+    size_t sq_ring_size, cq_ring_size;
+    struct io_uring_sqe *sqes;  // submission queue entries, indexed through sq_array
+    size_t sqes_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array, sq_entries;
+    unsigned *cq_head, *cq_tail, *cq_mask, cq_entries;
+    struct io_uring_cqe *cqes;
+
+    // DISK_THREADS
+    pthread_mutex_t lock;   // guards work, finished and stop
+    pthread_cond_t wake;    // work was added, or stop set
+    disk_op_t *work;    // for the workers, oldest first
+    disk_op_t **work_tail;
+    disk_op_t *finished;    // done by the workers, for disk_collect()
+    int stop;
+    pthread_t threads[DISK_POOL_THREADS];
+    int n_threads;
+} disk_t;
+
+/**
+ * disk_init(bt_args_t *bt_args) -> int
+ *
+ * start the disk backend: io_uring if the kernel has it along with the
+ * read, write, fsync and fallocate opcodes (Linux 5.6), else the thread
+ * pool. The environment variable BT_DISK=threads forces the pool.
+ *
+ * Return: 0 on success (bt_args->disk set), -1 if neither could be
+ * started; callers then do their I/O synchronously
+ **/
+int disk_init(bt_args_t *bt_args);
+
+/**
+ * disk_submit(bt_args_t *bt_args, int type, int fd, unsigned char *buf, size_t length, off_t offset,
+ *             disk_done_t on_done, void *arg) -> int
+ *
+ * queue an operation for the end of this turn of the event loop. buf must
+ * stay valid until on_done is called.
+ *
+ * Return: 0 if queued, -1 if there is no disk backend or no memory
+ **/
+int disk_submit(bt_args_t *bt_args, int type, int fd, unsigned char *buf, size_t length, off_t offset,
+        disk_done_t on_done, void *arg);
+
+/**
+ * disk_flush(bt_args_t *bt_args) -> void
+ *
+ * hand the queued operations to the backend in one batch; called once
+ * per turn of the event loop
+ **/
+void disk_flush(bt_args_t *bt_args);
+
+/**
+ * disk_collect(bt_args_t *bt_args) -> void
+ *
+ * called by the event loop when event_fd is readable: run the on_done of
+ * every operation that is over
+ **/
+void disk_collect(bt_args_t *bt_args);
+
+/**
+ * disk_free(bt_args_t *bt_args) -> void
+ *
+ * wait for every operation (including those their on_done submit) and
+ * stop the backend
+ **/
+void disk_free(bt_args_t *bt_args);
+
+#endif
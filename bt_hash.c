@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "bt_lib.h"
+#include "bt_hash.h"
+#include "bt_io.h"
+#include "bt_bitfield.h"
+#include "bt_sha1.h"
+#include "bt_sock.h"
+
+/**
+ * hash_threads() sizes the worker pool to the machine
+ **/
+int hash_threads(int num_pieces) {
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (n_cpus < 1) {
+        n_cpus = 1;
+    }
+    if (n_cpus > MAX_HASH_THREADS) {
+        n_cpus = MAX_HASH_THREADS;
+    }
+    if (n_cpus > num_pieces) {
+        n_cpus = num_pieces > 0 ? num_pieces : 1;
+    }
+    return (int) n_cpus;
+}
+
+/**
+ * digest_matches() compares raw digests; hex is for display only
+ **/
+int digest_matches(bt_info_t *bt_info, int index, const unsigned char *digest) {
+    return memcmp(digest, bt_info->piece_hashes + (size_t) index * ID_SIZE, ID_SIZE) == 0;
+}
+
+/**
+ * check_pieces() hashes the n (at most SHA1_LANES) pieces from first on in place in the payload mapping, side by
+ * side if the SHA1 backend can, and compares them with the torrent's hashes; digest k goes to digests + k * ID_SIZE
+ *
+ * Return: number of valid pieces, valid[k] set for each
+ **/
+static int check_pieces(piece_store_t *store, bt_info_t *bt_info, int first, int n, unsigned char *digests, int *valid) {
+    const unsigned char *data[SHA1_LANES];  // the pieces, hashed in place in the payload mapping
+    size_t len[SHA1_LANES];
+    int lane_piece[SHA1_LANES];  // which of the n pieces each lane hashes
+    unsigned char lane_digests[SHA1_LANES * ID_SIZE];
+    int k, n_lanes = 0, n_valid = 0;
+
+    for (k = 0; k < n; k++) {
+        len[n_lanes] = piece_size(bt_info, first + k);
+        valid[k] = 0;
+        if ( (data[n_lanes] = store_view(store, bt_info, first + k, 0, len[n_lanes])) == NULL ) {
+            memset(digests + k * ID_SIZE, 0x00, ID_SIZE);   // file is short here, the piece cannot be valid
+            continue;
+        }
+        lane_piece[n_lanes++] = k;
+    }
+
+    sha1_many(data, len, n_lanes, lane_digests);
+
+    for (k = 0; k < n_lanes; k++) {
+        memcpy(digests + lane_piece[k] * ID_SIZE, lane_digests + k * ID_SIZE, ID_SIZE);
+        if ( digest_matches(bt_info, first + lane_piece[k], lane_digests + k * ID_SIZE) ) {
+            valid[lane_piece[k]] = 1;
+            n_valid++;
+        }
+    }
+    return n_valid;
+}
+
+/**
+ * hash_worker() claims SHA1_LANES pieces at a time until none are left, hashing them together and checking each
+ * against the torrent
+ **/
+static void * hash_worker(void *arg) {
+    hash_job_t *job = arg;
+    bt_info_t *bt_info = job->bt_info;
+    unsigned char digests[SHA1_LANES * ID_SIZE];
+    int valid[SHA1_LANES];
+    int first, n, k;
+
+    while ( (first = __atomic_fetch_add(&job->next_piece, SHA1_LANES, __ATOMIC_RELAXED)) < bt_info->num_pieces ) {
+        n = (bt_info->num_pieces - first < SHA1_LANES) ? bt_info->num_pieces - first : SHA1_LANES;
+
+        __atomic_fetch_add(&job->n_valid, check_pieces(job->store, bt_info, first, n, digests, valid), __ATOMIC_RELAXED);
+        for (k = 0; k < n; k++) {
+            if (valid[k]) {
+                bitfield_set_atomic(job->bitfield, first + k);  // neighbouring pieces share a byte with other workers
+            }
+        }
+
+        if (job->digests) {
+            memcpy(job->digests + first * ID_SIZE, digests, n * ID_SIZE);
+        }
+        __atomic_fetch_add(&job->n_done, n, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_lock(&job->lock);
+    if (--job->n_running == 0) {
+        pthread_cond_signal(&job->done);
+    }
+    pthread_mutex_unlock(&job->lock);
+
+    return NULL;
+}
+
+/**
+ * hash_pieces() runs a parallel recheck of the payload and waits for it, reporting progress on the way
+ **/
+int hash_pieces(piece_store_t *store, bt_info_t *bt_info, bt_bitfield_t *bitfield, unsigned char *digests) {
+    hash_job_t job;
+    pthread_t threads[MAX_HASH_THREADS];
+    int n_threads = hash_threads(bt_info->num_pieces);
+    int n_started;
+    struct timespec deadline;
+    int i;  // loop iterator variable
+
+    memset(&job, 0x00, sizeof(job));
+    job.store = store;
+    job.bt_info = bt_info;
+    job.bitfield = bitfield;
+    job.digests = digests;
+
+    store_advise(store, STORE_SEQUENTIAL);  // every byte is read once, front to back
+
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.done, NULL);
+
+    pthread_mutex_lock(&job.lock);
+    job.n_running = n_threads;
+    n_started = spawn_helpers(threads, n_threads, hash_worker, &job);
+    job.n_running = n_started;
+    pthread_mutex_unlock(&job.lock);
+
+    if (n_started == 0) {   // no threads to be had; hash on this one
+        job.n_running = 1;
+        hash_worker(&job);
+    }
+
+    // wait for the workers, printing progress every HASH_PROGRESS_MS
+    pthread_mutex_lock(&job.lock);
+    while (job.n_running > 0) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += HASH_PROGRESS_MS / 1000;
+        deadline.tv_nsec += (HASH_PROGRESS_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        if ( pthread_cond_timedwait(&job.done, &job.lock, &deadline) == ETIMEDOUT && job.n_running > 0 ) {
+            printf("HASHING: %d/%d pieces checked on %d threads (%d%%)\n",
+                    __atomic_load_n(&job.n_done, __ATOMIC_RELAXED), bt_info->num_pieces, n_started ? n_started : 1,
+                    (int) (100L * __atomic_load_n(&job.n_done, __ATOMIC_RELAXED) / bt_info->num_pieces));
+            fflush(stdout);
+        }
+    }
+    pthread_mutex_unlock(&job.lock);
+
+    for (i = 0; i < n_started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&job.done);
+    pthread_mutex_destroy(&job.lock);
+
+    return job.n_valid;
+}
+
+/**
+ * verify_piece() checks one piece on the calling thread
+ **/
+int verify_piece(piece_store_t *store, bt_info_t *bt_info, int index) {
+    unsigned char digest[ID_SIZE];
+    int valid;
+
+    return check_pieces(store, bt_info, index, 1, digest, &valid);
+}
@@ -0,0 +1,67 @@
+#ifndef _BT_HASH_H
+#define _BT_HASH_H
+
+#include <pthread.h>
+
+#include "bt_lib.h"
+
+/* upper bound on hashing worker threads, whatever the core count */
+#define MAX_HASH_THREADS 64
+
+/* how often (in ms) a running recheck reports its progress */
+#define HASH_PROGRESS_MS 1000
+
+/* shared state of one recheck; workers claim pieces from next_piece until it runs past num_pieces */
+typedef struct {
+    bt_info_t *bt_info; // torrent being checked (piece length, file length, expected hashes)
+    piece_store_t *store;   // payload mapping; workers hash straight out of it
+    bt_bitfield_t *bitfield;    // result, piece i set if it matched its hash
+    unsigned char *digests; // result, num_pieces * ID_SIZE computed SHA1 digests (may be NULL)
+
+    int next_piece; // next piece to be claimed by a worker (atomic)
+    int n_done; // pieces hashed so far (atomic)
+    int n_valid;    // pieces that matched their hash (atomic)
+
+    pthread_mutex_t lock;   // guards n_running, together with done
+    pthread_cond_t done;    // signalled when the last worker exits
+    int n_running;  // workers still hashing
+} hash_job_t;
+
+/**
+ * hash_threads(int num_pieces) -> int
+ *
+ * number of worker threads worth starting for num_pieces pieces: one per
+ * online core, capped at MAX_HASH_THREADS and num_pieces
+ **/
+int hash_threads(int num_pieces);
+
+/**
+ * hash_pieces(piece_store_t *store, bt_info_t *bt_info, bt_bitfield_t *bitfield, unsigned char *digests) -> int
+ *
+ * hash every piece of the mapped payload on a pool of worker threads and
+ * compare each digest with bt_info->piece_hashes; piece i is set in the
+ * (zeroed) bitfield if it matches. If digests is not NULL, the computed digest of piece i
+ * is stored at digests + i * ID_SIZE. Progress is printed every
+ * HASH_PROGRESS_MS while the check runs.
+ *
+ * Return: number of valid pieces
+ **/
+int hash_pieces(piece_store_t *store, bt_info_t *bt_info, bt_bitfield_t *bitfield, unsigned char *digests);
+
+/**
+ * digest_matches(bt_info_t *bt_info, int index, const unsigned char *digest) -> int
+ *
+ * Return: 1 if digest is the SHA1 the torrent lists for piece index, 0 otherwise
+ **/
+int digest_matches(bt_info_t *bt_info, int index, const unsigned char *digest);
+
+/**
+ * verify_piece(piece_store_t *store, bt_info_t *bt_info, int index) -> int
+ *
+ * hash piece index of the mapped payload in one go, e.g. when rechecking it
+ *
+ * Return: 1 if it matches the torrent's hash of piece index, 0 otherwise
+ **/
+int verify_piece(piece_store_t *store, bt_info_t *bt_info, int index);
+
+#endif
@@ -0,0 +1,503 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <arpa/inet.h>  // for htonl()
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+
+#include "bt_lib.h"
+#include "bt_io.h"
+#include "bt_wire.h"
+#include "bt_cache.h"
+#include "bt_limit.h"
+#include "bt_bitfield.h"
+#include "bt_verify.h"
+
+/**
+ * store_open() maps the payload; a downloading store is grown to the full torrent length first
+ **/
+int store_open(piece_store_t *store, char *path, bt_info_t *bt_info, int writable) {
+    struct stat st;
+
+    memset(store, 0x00, sizeof(*store));
+    store->fd = -1;
+
+    if ( (store->fd = open(path, writable ? (O_RDWR | O_CREAT) : O_RDONLY, 0644)) < 0 ) {
+        return -1;
+    }
+
+    if ( fstat(store->fd, &st) < 0 ) {
+        goto FAIL;
+    }
+
+    if (writable && st.st_size < bt_info->length) {   // room for every block before any of them arrives
+        if ( ftruncate(store->fd, bt_info->length) < 0 ) {
+            goto FAIL;
+        }
+        st.st_size = bt_info->length;
+    }
+
+    // never map past the torrent: bytes beyond it belong to no piece
+    store->length = (st.st_size < bt_info->length) ? st.st_size : bt_info->length;
+    store->writable = writable;
+
+    if (store->length > 0) {
+        store->map = mmap(NULL, store->length, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, store->fd, 0);
+        if (store->map == MAP_FAILED) {
+            store->map = NULL;
+            goto FAIL;
+        }
+    }
+
+    return 0;
+
+    FAIL:
+        close(store->fd);
+        store->fd = -1;
+        return -1;
+}
+
+/**
+ * store_close() unmaps the payload
+ **/
+void store_close(piece_store_t *store) {
+
+    if (store->map) {
+        if (store->writable) {
+            msync(store->map, store->length, MS_SYNC);
+        }
+        munmap(store->map, store->length);
+    }
+    if (store->fd >= 0) {
+        close(store->fd);
+    }
+
+    store->map = NULL;
+    store->fd = -1;
+    store->length = 0;
+}
+
+/**
+ * store_sync() writes back the dirty pages of a downloading store; a seeder's has none
+ **/
+int store_sync(piece_store_t *store) {
+    if (store->map == NULL || !store->writable) {
+        return 0;
+    }
+    return msync(store->map, store->length, MS_SYNC);
+}
+
+/**
+ * store_view() bounds-checks a (piece, begin, length) range and points into the mapping
+ **/
+unsigned char * store_view(piece_store_t *store, bt_info_t *bt_info, int index, int begin, int length) {
+    size_t offset;
+
+    if (store->map == NULL || index < 0 || index >= bt_info->num_pieces || begin < 0 || length < 0) {
+        return NULL;
+    }
+    if (begin + length > piece_size(bt_info, index)) {
+        return NULL;
+    }
+
+    offset = (size_t) index * bt_info->piece_length + begin;
+    if (offset + length > store->length) {  // a short file on disk does not hold this block
+        return NULL;
+    }
+
+    return store->map + offset;
+}
+
+/**
+ * store_write() writes through the file descriptor rather than the mapping: one system call for a whole piece,
+ * and no page faults. Both go through the same page cache, so the mapping sees the data at once
+ **/
+int store_write(piece_store_t *store, bt_info_t *bt_info, int index, int begin, const unsigned char *data, int length) {
+    off_t offset = (off_t) index * bt_info->piece_length + begin;
+    ssize_t n;
+
+    if ( !store->writable || store_view(store, bt_info, index, begin, length) == NULL ) {
+        return -1;
+    }
+
+    while (length > 0) {
+        if ( (n = pwrite(store->fd, data, length, offset)) < 0 ) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "ERROR: Could not write piece %d to the payload: %s\n", index, strerror(errno));
+            return -1;
+        }
+        data += n;
+        offset += n;
+        length -= n;
+    }
+    return 0;
+}
+
+/**
+ * store_advise() forwards the expected access pattern to madvise()
+ **/
+void store_advise(piece_store_t *store, int pattern) {
+
+    if (store->map == NULL) {
+        return;
+    }
+
+    madvise(store->map, store->length, (pattern == STORE_SEQUENTIAL) ? MADV_SEQUENTIAL : MADV_RANDOM);
+}
+
+/**
+ * payload_path() picks the file name the payload is read from / saved to
+ **/
+char * payload_path(bt_args_t *bt_args) {
+    return (bt_args->save_file[0] != '\0') ? bt_args->save_file : bt_args->bt_info->name;
+}
+
+/**
+ * save_piece() copies a received block from the receive buffer into its place in the payload
+ **/
+int save_piece(bt_args_t *bt_args, bt_request_t *block, unsigned char *data) {
+    unsigned char *view;
+
+    if ( !bt_args->store.writable ||
+            (view = store_view(&bt_args->store, bt_args->bt_info, block->index, block->begin, block->length)) == NULL ) {
+        return -1;
+    }
+
+    memcpy(view, data, block->length);
+    return 0;
+}
+
+/**
+ * load_piece() serves a request straight out of the payload mapping
+ **/
+unsigned char * load_piece(bt_args_t *bt_args, bt_request_t *request) {
+    return store_view(&bt_args->store, bt_args->bt_info, request->index, request->begin, request->length);
+}
+
+/**
+ * start_upload() pops the oldest queued request into peer->upload and builds its BT_PIECE header. The block is
+ * sent from the read cache when the piece can be had there, so hot pieces stay off the disk however hard the
+ * page cache is pressed
+ **/
+static void start_upload(bt_args_t *bt_args, peer_t *peer) {
+    bt_request_t *request = &peer->up_queue[peer->up_head];
+    bt_upload_t *upload = &peer->upload;
+    uint32_t field;
+
+    field = htonl(9 + request->length);  // id + index + begin + block
+    memcpy(upload->header, &field, 4);
+    upload->header[4] = BT_PIECE;
+    field = htonl(request->index);
+    memcpy(upload->header + 5, &field, 4);
+    field = htonl(request->begin);
+    memcpy(upload->header + 9, &field, 4);
+
+    upload->hdr_sent = 0;
+    upload->offset = (off_t) request->index * bt_args->bt_info->piece_length + request->begin;
+    upload->remaining = request->length;
+    upload->cached = cache_get(bt_args, request->index);
+
+    peer->up_head = (peer->up_head + 1) % MAX_UPLOAD_QUEUE;
+    peer->up_count--;
+}
+
+/**
+ * serve_request() validates a request and appends it to the peer's upload queue
+ **/
+int serve_request(bt_args_t *bt_args, peer_t *peer, bt_request_t *request) {
+
+    if ( load_piece(bt_args, request) == NULL ) {
+        return -1;  // we do not have these bytes
+    }
+    if (peer->up_count == MAX_UPLOAD_QUEUE) {
+        return -1;
+    }
+
+    peer->up_queue[(peer->up_head + peer->up_count) % MAX_UPLOAD_QUEUE] = *request;
+    peer->up_count++;
+    bt_args->peers.flags[peer->slot] |= PEER_TX_QUEUED;
+    return 0;
+}
+
+/**
+ * cancel_request() drops a queued request from the ring, closing the gap it leaves
+ **/
+int cancel_request(peer_t *peer, bt_request_t *request) {
+    bt_request_t *queued;
+    int i, j;
+
+    for (i = 0; i < peer->up_count; i++) {
+        queued = &peer->up_queue[(peer->up_head + i) % MAX_UPLOAD_QUEUE];
+        if (queued->index == request->index && queued->begin == request->begin && queued->length == request->length) {
+            for (j = i; j < peer->up_count - 1; j++) {
+                peer->up_queue[(peer->up_head + j) % MAX_UPLOAD_QUEUE] =
+                        peer->up_queue[(peer->up_head + j + 1) % MAX_UPLOAD_QUEUE];
+            }
+            peer->up_count--;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * upload_parked() is true while the oldest queued request is for a piece the background recheck has not passed
+ * yet; requests for pieces that failed it are dropped off the head of the queue on the way
+ **/
+static int upload_parked(bt_args_t *bt_args, peer_t *peer) {
+    bt_request_t *request;
+    int valid;
+
+    while (peer->up_count > 0) {
+        request = &peer->up_queue[peer->up_head];
+        if ( bitfield_test(bt_args->bitfield, request->index) ||
+                (valid = verify_demand(bt_args, request->index)) > 0 ) {
+            return 0;
+        }
+        if (valid < 0) {
+            return 1;   // flushed again every turn until verify_collect() has the result
+        }
+        peer->up_head = (peer->up_head + 1) % MAX_UPLOAD_QUEUE;
+        peer->up_count--;
+    }
+    return 0;
+}
+
+/**
+ * consume_sent() advances the send state by the n bytes one sendmsg() took: queued control messages first,
+ * then the BT_PIECE header, then (on the copying path) the block. A cached piece is released once its block is out
+ **/
+static void consume_sent(bt_args_t *bt_args, peer_t *peer, size_t n, int with_tx) {
+    bt_upload_t *upload = &peer->upload;
+    size_t take;
+
+    if (with_tx) {
+        take = peer->tx_len - peer->tx_head;
+        take = (n < take) ? n : take;
+        peer->tx_head += take;
+        n -= take;
+        if (peer->tx_head == peer->tx_len) {
+            peer->tx_head = peer->tx_len = 0;
+        }
+    }
+
+    if (upload->remaining > 0) {
+        take = PIECE_HDR_LEN - upload->hdr_sent;
+        take = (n < take) ? n : take;
+        upload->hdr_sent += take;
+        n -= take;
+
+        upload->offset += n;
+        upload->remaining -= n;
+        peer->up_bytes += n;
+        if (upload->remaining == 0 && upload->cached) {
+            cache_release(bt_args, upload->cached);
+            upload->cached = NULL;
+        }
+    }
+}
+
+/**
+ * clip_iov() shortens the gathered buffers to max bytes in total
+ *
+ * Return: bytes left in them
+ **/
+static size_t clip_iov(struct msghdr *msg, size_t max) {
+    size_t total = 0;
+    size_t i;
+
+    for (i = 0; i < msg->msg_iovlen; i++) {
+        if (total + msg->msg_iov[i].iov_len >= max) {
+            msg->msg_iov[i].iov_len = max - total;
+            msg->msg_iovlen = i + 1;
+            return max;
+        }
+        total += msg->msg_iov[i].iov_len;
+    }
+    return total;
+}
+
+/**
+ * flush_upload() gathers everything that may go next into one sendmsg(): the queued control messages, the header
+ * of the next BT_PIECE and, when it comes from the read cache or the store cannot sendfile(), its block. With
+ * sendfile() the block follows in a second call; MSG_MORE on the first keeps the kernel from pushing the header
+ * out in a segment of its own. Control messages are only gathered between two responses, never in the middle
+ * of one. Every send takes no more than the upload limit grants; a peer held back keeps PEER_TX_QUEUED and is
+ * flushed again next turn, and starts no new response meanwhile, which would pin a cached piece for nothing. So
+ * does a peer whose next request is for a piece still being rechecked (see upload_parked())
+ **/
+int flush_upload(bt_args_t *bt_args, peer_t *peer) {
+    bt_upload_t *upload = &peer->upload;
+    piece_store_t *store = &bt_args->store;
+    unsigned char *flags = &bt_args->peers.flags[peer->slot];
+    int sock = bt_args->peers.fd[peer->slot];
+    struct iovec iov[3];
+    struct msghdr msg;
+    int with_tx, more, waiting, held, parked;
+    size_t granted;
+    ssize_t n;
+
+    while (1) {
+
+        parked = upload->remaining == 0 && upload_parked(bt_args, peer);
+        held = upload->remaining == 0 && peer->up_count > 0 && !parked && limit_grant(bt_args, peer, LIMIT_UP, 1) == 0;
+        if (upload->remaining == 0 && peer->up_count > 0 && !held && !parked) {
+            start_upload(bt_args, peer);
+        }
+        if (upload->cached && upload->cached->ready < 0) {  // could not be read in: send from the payload
+            cache_release(bt_args, upload->cached);
+            upload->cached = NULL;
+        }
+        // the piece is still being read in; control messages may go, the response waits
+        waiting = upload->remaining > 0 && upload->cached && upload->cached->ready == 0;
+
+        memset(&msg, 0x00, sizeof(msg));
+        msg.msg_iov = iov;
+
+        with_tx = peer->tx_head < peer->tx_len && (upload->remaining == 0 || upload->hdr_sent == 0);
+        if (with_tx) {
+            iov[msg.msg_iovlen].iov_base = peer->tx_buf + peer->tx_head;
+            iov[msg.msg_iovlen++].iov_len = peer->tx_len - peer->tx_head;
+        }
+        if (upload->remaining > 0 && !waiting && upload->hdr_sent < PIECE_HDR_LEN) {
+            iov[msg.msg_iovlen].iov_base = upload->header + upload->hdr_sent;
+            iov[msg.msg_iovlen++].iov_len = PIECE_HDR_LEN - upload->hdr_sent;
+        }
+        if (upload->remaining > 0 && !waiting && upload->cached) {
+            iov[msg.msg_iovlen].iov_base = upload->cached->data + upload->offset % bt_args->bt_info->piece_length;
+            iov[msg.msg_iovlen++].iov_len = upload->remaining;
+        } else if (upload->remaining > 0 && store->no_sendfile) {
+            iov[msg.msg_iovlen].iov_base = store->map + upload->offset;
+            iov[msg.msg_iovlen++].iov_len = upload->remaining;
+        }
+
+        if (msg.msg_iovlen > 0) {
+            if ( (granted = limit_grant(bt_args, peer, LIMIT_UP, clip_iov(&msg, SIZE_MAX))) == 0 ) {
+                return 0;   // held back; PEER_TX_QUEUED stays set
+            }
+            clip_iov(&msg, granted);
+            more = !waiting && !parked &&
+                    ((upload->remaining > 0 && !upload->cached && !store->no_sendfile) || peer->up_count > 0);
+            if ( (n = sendmsg(sock, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0))) < 0 ) {
+                break;
+            }
+            limit_charge(bt_args, peer, LIMIT_UP, n);
+            consume_sent(bt_args, peer, n, with_tx);
+            continue;
+        }
+
+        // PEER_TX_QUEUED stays set: the read's completion (or the limiter's next turn, or the recheck's result)
+        // flushes again
+        if (waiting || held || parked) {
+            return 0;
+        }
+        if (upload->remaining == 0) {   // all sent
+            *flags &= ~PEER_TX_QUEUED;
+            return 0;
+        }
+
+        // header is out: the block goes from the page cache to the socket without passing through user space
+        if ( (granted = limit_grant(bt_args, peer, LIMIT_UP, upload->remaining)) == 0 ) {
+            return 0;
+        }
+        if ( (n = sendfile(sock, store->fd, &upload->offset, granted)) < 0 ) {
+            if (errno == EINVAL || errno == ENOSYS) {
+                store->no_sendfile = 1; // this file (or kernel) cannot splice; copy from the mapping from now on
+                continue;
+            }
+            break;
+        }
+        if (n == 0) {   // payload shrank under us
+            return -1;
+        }
+        upload->remaining -= n;
+        peer->up_bytes += n;
+        limit_charge(bt_args, peer, LIMIT_UP, n);
+    }
+
+    if (errno == EINTR) {
+        return flush_upload(bt_args, peer);
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        *flags |= PEER_TX_BLOCKED;  // backpressure: the rest waits for EPOLLOUT
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * backlogged() is true while the peer has more responses queued than it is reading; its input is left in the
+ * socket then, so TCP's own flow control slows it down instead of our queues growing
+ **/
+static int backlogged(peer_t *peer) {
+    return peer->up_count >= MAX_UPLOAD_QUEUE || peer->tx_cap - (peer->tx_len - peer->tx_head) < TX_LOW_ROOM;
+}
+
+/**
+ * flush_slot() flushes the peer in slot if it has output and no full socket. A paused peer whose backlog drained
+ * is read again, and what that queues is sent right away
+ *
+ * Return: 1 if the peer was dropped, 0 if not
+ **/
+static int flush_slot(bt_args_t *bt_args, int slot) {
+    peer_table_t *peers = &bt_args->peers;
+    peer_t *peer = peers->peer[slot];
+
+    if ( (peers->flags[slot] & (PEER_TX_QUEUED | PEER_TX_BLOCKED)) != PEER_TX_QUEUED ) {
+        return 0;
+    }
+
+    if ( flush_upload(bt_args, peer) < 0 ) {
+        drop_peer(peer, bt_args);
+        return 1;
+    }
+
+    if ( (peers->flags[slot] & PEER_RX_PAUSED) && !backlogged(peer) ) {
+        peers->flags[slot] &= ~PEER_RX_PAUSED;
+        if ( handle_peer_input(bt_args, peer) < 0 || flush_upload(bt_args, peer) < 0 ) {
+            drop_peer(peer, bt_args);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * flush_peers() starts at a different peer every turn (limit_first_slot()), so under an upload cap the same
+ * peers are not always the ones left waiting. A dropped peer's slot takes the last peer, which is flushed right
+ * away if the walk has not reached it yet
+ **/
+void flush_peers(bt_args_t *bt_args) {
+    peer_table_t *peers = &bt_args->peers;
+    int slot, start = limit_first_slot(bt_args);
+
+    for (slot = start; slot >= 0; slot--) {
+        if ( flush_slot(bt_args, slot) && slot < peers->n_peers && peers->n_peers > start ) {
+            slot++;
+        }
+    }
+    for (slot = peers->n_peers - 1; slot > start; slot--) {
+        flush_slot(bt_args, slot);
+    }
+}
+
+/**
+ * input_paused() pauses the peer's input if it is backlogged
+ **/
+int input_paused(bt_args_t *bt_args, peer_t *peer) {
+    unsigned char *flags = &bt_args->peers.flags[peer->slot];
+
+    if ( !(*flags & PEER_RX_PAUSED) && backlogged(peer) ) {
+        *flags |= PEER_RX_PAUSED;
+    }
+    return (*flags & PEER_RX_PAUSED) != 0;
+}
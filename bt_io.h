@@ -0,0 +1,129 @@
+#ifndef _BT_IO_H
+#define _BT_IO_H
+
+#include "bt_lib.h"
+
+/* access patterns hinted to the kernel through madvise() */
+#define STORE_SEQUENTIAL 0 // recheck: every piece read once, front to back
+#define STORE_RANDOM 1 // seeding: blocks requested in whatever order leechers like
+
+/**
+ * store_open(piece_store_t *store, char *path, bt_info_t *bt_info, int writable) -> int
+ *
+ * map the payload file at path. A writable store is created if missing
+ * and sized to the torrent's length so received blocks can be written in
+ * place; a read-only store maps the file as it is on disk.
+ *
+ * Return: 0 on success, -1 on failure
+ **/
+int store_open(piece_store_t *store, char *path, bt_info_t *bt_info, int writable);
+
+/**
+ * store_close(piece_store_t *store) -> void
+ *
+ * flush dirty pages of a writable store, then unmap and close it
+ **/
+void store_close(piece_store_t *store);
+
+/**
+ * store_sync(piece_store_t *store) -> int
+ *
+ * flush every block saved so far to disk, so that what the bitfield says
+ * is verified survives a crash
+ *
+ * Return: 0 on success, -1 on failure
+ **/
+int store_sync(piece_store_t *store);
+
+/**
+ * store_view(piece_store_t *store, bt_info_t *bt_info, int index, int begin, int length) -> unsigned char *
+ *
+ * zero-copy view of length bytes at offset begin of piece index; the
+ * pointer stays valid until store_close()
+ *
+ * Return: pointer into the mapping, NULL if the range is not inside both
+ * the piece and the mapped file
+ **/
+unsigned char * store_view(piece_store_t *store, bt_info_t *bt_info, int index, int begin, int length);
+
+/**
+ * store_write(piece_store_t *store, bt_info_t *bt_info, int index, int begin, const unsigned char *data, int length) -> int
+ *
+ * write length bytes from data at offset begin of piece index of a
+ * writable store, in one pwrite() unless the kernel takes less
+ *
+ * Return: 0 on success, -1 if the range is outside the store or the write failed
+ **/
+int store_write(piece_store_t *store, bt_info_t *bt_info, int index, int begin, const unsigned char *data, int length);
+
+/**
+ * store_advise(piece_store_t *store, int pattern) -> void
+ *
+ * tell the kernel how the mapping is about to be used (STORE_SEQUENTIAL
+ * or STORE_RANDOM) so readahead fits the access pattern
+ **/
+void store_advise(piece_store_t *store, int pattern);
+
+/**
+ * payload_path(bt_args_t *bt_args) -> char *
+ *
+ * file the payload lives in: save_file if one was given with -s,
+ * otherwise the name suggested by the torrent
+ **/
+char * payload_path(bt_args_t *bt_args);
+
+/**
+ * serve_request(bt_args_t *bt_args, peer_t *peer, bt_request_t *request) -> int
+ *
+ * queue a BT_PIECE response for request; it is sent by the next
+ * flush_peers(). The block goes from the page cache to the socket with
+ * sendfile(); only the 13-byte header passes through user space.
+ *
+ * Return: 0 if queued, -1 if the request is out of range or the peer has
+ * MAX_UPLOAD_QUEUE requests pending already
+ **/
+int serve_request(bt_args_t *bt_args, peer_t *peer, bt_request_t *request);
+
+/**
+ * cancel_request(peer_t *peer, bt_request_t *request) -> int
+ *
+ * withdraw a queued request the peer sent a BT_CANCEL for; a response
+ * already being sent is finished
+ *
+ * Return: 0 if it was dropped, -1 if it was not queued
+ **/
+int cancel_request(peer_t *peer, bt_request_t *request);
+
+/**
+ * flush_upload(bt_args_t *bt_args, peer_t *peer) -> int
+ *
+ * push queued control messages and BT_PIECE responses to the peer until
+ * they are all sent or the socket buffer is full, in which case the peer
+ * is marked PEER_TX_BLOCKED until the socket turns writable. Each gathered
+ * write carries every queued control message plus the next BT_PIECE header.
+ *
+ * Return: 0 on success (including "would block"), -1 if the peer should be dropped
+ **/
+int flush_upload(bt_args_t *bt_args, peer_t *peer);
+
+/**
+ * flush_peers(bt_args_t *bt_args) -> void
+ *
+ * flush_upload() every peer with queued output and room in its socket,
+ * once per turn of the event loop, and resume reading peers whose
+ * backlog drained. Peers whose sockets fail are dropped.
+ **/
+void flush_peers(bt_args_t *bt_args);
+
+/**
+ * input_paused(bt_args_t *bt_args, peer_t *peer) -> int
+ *
+ * backpressure on a peer that sends requests faster than it reads the
+ * answers: once its upload queue or send buffer is full, its input is
+ * paused (PEER_RX_PAUSED) until flush_peers() drains them
+ *
+ * Return: 1 if the peer's input is paused, 0 otherwise
+ **/
+int input_paused(bt_args_t *bt_args, peer_t *peer);
+
+#endif
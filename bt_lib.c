@@ -9,11 +9,28 @@
 
 #include <sys/stat.h>
 #include <arpa/inet.h>
+#include <errno.h>
+#include <time.h>
 
-#include <openssl/sha.h>	// for using SHA1() function for hashing
 
 #include "bt_lib.h"
 #include "bt_setup.h"
+#include "bt_sock.h"
+#include "bt_peer.h"
+#include "bt_hash.h"
+#include "bt_io.h"
+#include "bt_bitfield.h"
+#include "bt_picker.h"
+#include "bt_request.h"
+#include "bt_wire.h"
+#include "bt_resume.h"
+#include "bt_verify.h"
+#include "bt_sha1.h"
+#include "bt_cache.h"
+#include "bt_disk.h"
+#include "bt_resolve.h"
+#include "bt_choke.h"
+#include "bt_limit.h"
 
 #define BUF_LEN 1024
 
@@ -31,10 +48,10 @@ void calc_id(char *ip, unsigned short port, char *id) {
     len = snprintf(data, 256, "%s%u", ip, port);    // example data = localhost7000
 
     /* id is just the SHA1 of the ip and port string
-     * SHA1()'s signature:
-     * unsigned char *SHA1(const unsigned char *dataString, unsigned long dataLength, unsigned char *SHA1digest);
+     * sha1()'s signature:
+     * void sha1(const unsigned char *data, size_t len, unsigned char *digest);
      */
-    SHA1( (unsigned char *) data, len, (unsigned char *) id );
+    sha1( (unsigned char *) data, len, (unsigned char *) id );
 
     return;
 }
@@ -42,40 +59,57 @@ void calc_id(char *ip, unsigned short port, char *id) {
 /**
  * init_peer(peer_t *peer, int id, char *ip, unsigned short port) -> int
  *
- * initialize the peer_t structure peer with an id, ip address, and a
- * port. Further, it will set up the sockaddr such that a socket
- * connection can be more easily established.
+ * initialize the peer_t structure peer with an id, host name (or IP
+ * address), and a port. The host is not looked up here: a dotted-quad
+ * address is used as is, a name is resolved off the event loop before the
+ * first connect (see resolve_lookup()).
  *
- * Return: 0 on success, negative values on failure. Will exit on bad
- * ip address.
+ * Return: 0 on success, -1 if the host name is too long
  *     
  **/
 int init_peer(peer_t *peer, char *id, char *ip, unsigned short port) {
-        
-    struct hostent *hostinfo;	// instantiate hostent struct that contains information like IP address, host name, etc.
-	
+
+    if ( strlen(ip) >= sizeof(peer->host) ) {
+        return -1;
+    }
+
     // set the host id and port for reference
     memcpy(peer->id, id, ID_SIZE);  // SHA1 hash of peer IP & port is stored as peer struct's 'id'
+    strcpy(peer->host, ip);
     peer->port = port;
+
+    // not in the peer table yet, no handshake either way, no buffers until it has a socket, nothing to upload
+    peer->slot = -1;
+    peer->hs_state = 0;
+    memset(&peer->rx, 0x00, sizeof(peer->rx));
+    peer->tx_buf = NULL;
+    peer->tx_cap = peer->tx_head = peer->tx_len = 0;
+    memset(&peer->upload, 0x00, sizeof(peer->upload));
+    peer->up_head = 0;
+    peer->up_count = 0;
+    peer->have.bits = NULL;     // allocated by the first BITFIELD or HAVE the peer sends
+    peer->have.size = 0;
+    peer->queue_depth = INIT_QUEUE_DEPTH;   // nothing measured yet
+    peer->srtt_ms = 0;
+    peer->min_rtt_ms = 0;
+    peer->down_bytes = 0;
+    peer->up_bytes = 0;
+    memset(peer->bucket, 0x00, sizeof(peer->bucket));  // rate 0: set up by the limiter on first use
+    peer->throttled = 0;
+    peer->turn = 0;
+    peer->turn_bytes[LIMIT_UP] = peer->turn_bytes[LIMIT_DOWN] = 0;
+    peer->connect_attempts = 0;
+    peer->connect_at_ms = 0;    // dial right away
         
-    // get the host by name
-    if( (hostinfo = gethostbyname(ip)) == NULL ) {
-        perror("gethostbyname failure, no such host?");
-        herror("gethostbyname");	// prints error message associated with the current host
-        exit(1);
-    }
-    
     // zero out the peer's sock address structure before filling in its details
     bzero(&(peer->sockaddr), sizeof(peer->sockaddr));
             
     // set the family to AF_INET, i.e., Internet Addressing
     peer->sockaddr.sin_family = AF_INET;
 	
-    // copy the address from h_addr field of 'hostinfo' to the peer's socket address
-    bcopy( (char *) (hostinfo->h_addr), 
-                (char *) &(peer->sockaddr.sin_addr.s_addr),
-                hostinfo->h_length );
-        
+    // an address needs no lookup; a name is resolved when the peer is dialed
+    peer->resolved = inet_pton(AF_INET, ip, &peer->sockaddr.sin_addr) == 1;
+
     // encode the port to network-byte order to store in sockaddr_in struct
     peer->sockaddr.sin_port = htons(port);
     
@@ -109,10 +143,10 @@ void print_peer(peer_t *peer) {
  * NOTE: example of how one can return address of a local variable by 
  * changing its scope to "static"
  */
-unsigned char * get_hashhex(unsigned char str[]) {
+unsigned char * get_hashhex(const unsigned char str[]) {
 
     int i;
-    static unsigned char ret_hash_hex[40];
+    static unsigned char ret_hash_hex[2 * ID_SIZE + 1]; // 40 hex digits + null-character
     for (i = 0; i < ID_SIZE; i++) {
             sprintf( (char *) &ret_hash_hex[2 * i], "%02x", str[i]);    // convert to 40-byte hex string
     }
@@ -123,7 +157,7 @@ unsigned char * get_hashhex(unsigned char str[]) {
  * init_seeder() documentation TO DO
  **/
 void init_seeder(bt_args_t *bt_args) {
-    char *parse_bind_str;   // temporary string
+    char parse_bind_str[sizeof(bt_args->bind_info)];    // temporary string
     char *token;
     char delim[] = ":"; // delimiter
     char *ip;   // to store IP addr
@@ -132,9 +166,7 @@ void init_seeder(bt_args_t *bt_args) {
     int i;  // loop iterator variable
 
     // copy bt_args.bind_info to parse_bind_str to avoid losing original bt_args.bind_info
-    parse_bind_str = malloc(strlen(bt_args->bind_info) + 1);
-    memset( parse_bind_str, 0x00, (strlen(bt_args->bind_info) + 1) );   // zero-out parse_bind_str
-    strncpy(parse_bind_str, bt_args->bind_info, strlen(bt_args->bind_info));
+    memcpy(parse_bind_str, bt_args->bind_info, sizeof(parse_bind_str));    // NUL-terminated by snprintf()
     // printf("testing, parse_bind_str: '%s'\n", parse_bind_str);
 
     for ( token = strtok(parse_bind_str, delim), i = 0; token; token = strtok(NULL, delim), i++ ) {
@@ -171,7 +203,8 @@ void init_seeder(bt_args_t *bt_args) {
 }
 
 /**
- * make_seeder_listen() documentation TO DO
+ * make_seeder_listen() binds the seeder's listening socket and hands it to the event loop; it no longer
+ * blocks in accept(), poll_peers() accepts leechers as they arrive
  *
 --------------------------sockaddr structures--------------------------------------------
 struct sockaddr {
@@ -200,34 +233,28 @@ void make_seeder_listen(char *ip, unsigned short port, bt_args_t *bt_args) {
         printf("Instantiating seeder...\n");
     }
 
-    struct hostent *hostinfo;   // store network-related information of host machine
+    struct sockaddr_in seeder_addr; // structure containing all network-related seeder information
 
-    if( !(hostinfo = gethostbyname(ip)) ) { // gethostbyname() returns the 'hostent' structure or NULL on failure
+    // populate seeder_addr structure; the event loop is not running yet, so the lookup may block
+    memset(&seeder_addr, 0x00, sizeof(seeder_addr));
+    seeder_addr.sin_family = AF_INET;
+    seeder_addr.sin_port = htons(port);
+    if ( resolve_blocking(ip, &seeder_addr.sin_addr) < 0 ) {
         fprintf(stderr,"ERROR: Invalid host name '%s' specified\n", ip);
         usage(stderr);
         exit(1);
     }
 
-    struct sockaddr_in seeder_addr; // structure containing all network-related seeder information
-
-    // populate seeder_addr structure
-    seeder_addr.sin_family = hostinfo->h_addrtype;
-    seeder_addr.sin_port = htons(port);
-    memmove( (char *) &(seeder_addr.sin_addr.s_addr), (char *) hostinfo->h_addr, hostinfo->h_length );
-
     int seeder_sock;    // seeder's connection-welcoming socket to its leechers
-    int new_seeder_sock;    // new seeder allocated socket to exchange data with leechers
     int seeder_listen_status;  // check whether seeder is listening on its socket or no
-    unsigned char buffer[BUF_LEN];   // a buffer of size 1024 bytes at max to read or write data
-    ssize_t bytes_read, total_bytes_read = 0;  // bytes read; total number of bytes read by seeder; ssize_t defined in <unistd.h>
-    int i;  // loop iterator variable
-    int drop_conn = 0;  // flag to indicate peer connection needs to be dropped
+    int reuse = 1;  // let a restarted seeder rebind while old connections sit in TIME_WAIT
 
     // create seeder's listening TCP stream socket
     if ( (seeder_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0 ) {
         fprintf(stderr, "ERROR: Seeder was unable to set up a listening socket.\n");
         exit(1);
     }
+    setsockopt(seeder_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 
     // bind the seeder's connection-welcoming socket to the specific port number specified in 'peer'
     if ( bind(seeder_sock, (struct sockaddr *) &seeder_addr, sizeof(seeder_addr))  < 0 ) {    // NOTE: operator '->' has precedence over '->' operator
@@ -236,231 +263,511 @@ void make_seeder_listen(char *ip, unsigned short port, bt_args_t *bt_args) {
     }
 
     // on successful seeder socket binding, seeder should listen to incoming leecher connections
-    if ( (seeder_listen_status = listen(seeder_sock, MAX_CONNECTIONS)) < 0 ) { // set maximum number of incoming leecher connections to 5
+    if ( (seeder_listen_status = listen(seeder_sock, LISTEN_BACKLOG)) < 0 ) {
         fprintf(stderr, "ERROR: Seeder encountered error while trying to listen to incoming leecher connections.\n");
         exit(1);
     }
 
+    // accept() is driven by the event loop, so it must never block
+    if ( set_nonblocking(seeder_sock) < 0 || reactor_add(bt_args, seeder_sock) < 0 ) {
+        fprintf(stderr, "ERROR: Seeder could not hand its listening socket to the event loop.\n");
+        exit(1);
+    }
+    bt_args->listen_sock = seeder_sock;
+
     if (bt_args->verbose) {
         printf("SEEDER successfully allocated a listener socket to listen to incoming connections from leecher/s.\n\n");
     }
 
     printf("SEEDER LISTENING now on peer: '%s:%u'", inet_ntoa(seeder_addr.sin_addr), port);   // print dots-and-numbers version of host & its listening port
     printf("; peer id: %s\n", get_hashhex(bt_args->id));
+}
 
-     // store connecting leecher's information
-    struct sockaddr_in leecher_info;    // to fill in all relevant leecher information
-    unsigned int leecher_length = sizeof(leecher_info);
-    if ( ( new_seeder_sock = accept(seeder_sock, (struct sockaddr *) &leecher_info, &leecher_length) ) < 0 ) {  // seeder sets up new socket to exchange data with leecher
-        fprintf(stderr, "ERROR: Seeder could not set up a new socket to communicate with leecher.\n");
-        exit(1);
+/**
+ * handle_handshake() checks a peer's handshake. Peers we dialed must also present the id we derived from their
+ * address (see calc_id()); peers that dialed us are known by the address they came from
+ **/
+int handle_handshake(bt_args_t *bt_args, peer_t *peer, unsigned char *hs) {
+    unsigned char *peer_id = hs + 1 + 19 + 8 + ID_SIZE;   // after <pstrlen><pstr><reserved><info_hash>
+    unsigned char handshake[HANDSHAKE_LEN];
+    bt_msg_t msg;
+
+    if (bt_args->verbose) {
+        printf("HANDSHAKE INFO received from peer: %s port: %u; info_hash: %s", inet_ntoa(peer->sockaddr.sin_addr),
+                peer->port, get_hashhex(hs + 28));
+        printf("; peer id: %s\n", get_hashhex(peer_id));
     }
 
-    memset(buffer, 0x00, BUF_LEN);  // zero-out buffer before using it
-
-    while ( (bytes_read = read(new_seeder_sock, buffer, BUF_LEN)) != 0 ) {  /* read data from new seeder socker into buffer
-                                                                            * read until amount to be read is 0 i.e. until no more data is available is to read */
-        total_bytes_read += bytes_read;
-        char hs_seeder[100];
-        memset(hs_seeder, 0, 100);
-        memcpy(hs_seeder, buffer, BUF_LEN);
-        printf("HANDSHAKE INFO received from leecher at SEEDER: '%s'\n", hs_seeder);
-
-        // tokenize 'handshake' contents
-        char *token;
-        char delim[] = ":";
-        unsigned char leecher_peer_id[100];
-        memset(leecher_peer_id, 0, 100);
-        for ( token = strtok(hs_seeder, delim), i = 0; 
-            (token && i < 4); token = strtok(NULL, delim), i++ ) {
-            switch (i) {
-                case 0: case 1: case 2:
-                    break;
-                case 3:
-                    memcpy(leecher_peer_id, token, 20);
-                    break;
-            }
+    if ( hs[0] != 19 || memcmp(hs + 1, PROTOCOL_NAME, 19) != 0 ) {
+        printf("\tPeer does not speak the BitTorrent protocol, connection dropped.\n");
+        return -1;
+    }
+    if ( memcmp(hs + 28, bt_args->bt_info->info_hash, ID_SIZE) != 0 ) {
+        printf("\tPeer is sharing a different torrent (info_hash mismatch), connection dropped.\n");
+        return -1;
+    }
+    if ( (peer->hs_state & HS_SENT) && memcmp(peer_id, peer->id, ID_SIZE) != 0 ) {
+        printf("\tPeer id does not match the peer we dialed, connection dropped.\n");
+        return -1;
+    }
+    peer->hs_state |= HS_RECEIVED;
+    printf("HANDSHAKE SUCCESS peer: %s port: %u id: %s\n", inet_ntoa(peer->sockaddr.sin_addr), peer->port,
+            get_hashhex(peer_id));
+
+    // a peer that dialed us gets our handshake in return
+    if ( !(peer->hs_state & HS_SENT) ) {
+        init_handshake(bt_args, handshake);
+        if ( wire_queue(bt_args, peer, handshake, HANDSHAKE_LEN) < 0 ) {
+            return -1;
         }
+        peer->hs_state |= HS_SENT;
+    }
+
+    // the first message after the handshake says which pieces we have; nothing to say if we have none
+    if ( bitfield_count(bt_args->bitfield) > 0 ) {
+        msg.bt_type = BT_BITFILED;
+        msg.payload.bitfield = *bt_args->bitfield;
+        return send_to_peer(bt_args, peer, &msg) > 0 ? 0 : -1;
+    }
+    return 0;
+}
+
+/**
+ * send_control() sends a message that carries nothing but its type
+ **/
+int send_control(bt_args_t *bt_args, peer_t *peer, int bt_type) {
+    bt_msg_t msg;
+
+    msg.bt_type = bt_type;
+    return send_to_peer(bt_args, peer, &msg) > 0 ? 0 : -1;
+}
 
-        if (bt_args->verbose) {
-            printf("\tHASH of CONNECTING LEECHER's peer id: '%s'\n", leecher_peer_id);
+/**
+ * update_interest() tells the peer whether it has anything we still lack, if that changed
+ *
+ * Return: 0 on success, -1 if the peer should be dropped
+ **/
+static int update_interest(bt_args_t *bt_args, peer_t *peer) {
+    unsigned char *flags = &bt_args->peers.flags[peer->slot];
+    int interested;
+
+    // a seeder's payload is mapped read-only: pieces it lacks (or has not verified yet) are not to be downloaded
+    if (bt_args->bind) {
+        return 0;
+    }
+
+    interested = peer->have.bits && bitfield_any_andnot(&peer->have, bt_args->bitfield);
+
+    if ( interested == !!(*flags & PEER_AM_INTERESTED) ) {
+        return 0;
+    }
+    *flags ^= PEER_AM_INTERESTED;
+    return send_control(bt_args, peer, interested ? BT_INTERESTED : BT_NOT_INTERESTED);
+}
+
+/**
+ * peer_has() records that the peer has piece index and counts it with the picker
+ **/
+static int peer_has(bt_args_t *bt_args, peer_t *peer, int index) {
+    if ( peer->have.bits == NULL && bitfield_init(&peer->have, bt_args->bt_info->num_pieces) < 0 ) {
+        return -1;
+    }
+    if ( !bitfield_test(&peer->have, index) ) {
+        bitfield_set(&peer->have, index);
+        picker_inc(&bt_args->picker, index);
+    }
+    return 0;
+}
+
+/**
+ * announce_piece() sends a HAVE for a piece we just verified to every peer that lacks it, and withdraws interest
+ * from peers that have nothing left for us. Failures are left to the event loop, which sees the broken sockets
+ **/
+void announce_piece(bt_args_t *bt_args, int index) {
+    peer_t *peer;
+    bt_msg_t msg;
+    int slot;
+
+    msg.bt_type = BT_HAVE;
+    msg.payload.have = index;
+
+    for (slot = 0; slot < bt_args->peers.n_peers; slot++) {
+        peer = bt_args->peers.peer[slot];
+        if ( !(peer->hs_state & HS_RECEIVED) ) {
+            continue;
         }
-        // printf("testing, inside seeder while, length of leecher_peer_id: %ld\n", strlen( (const char *) leecher_peer_id));
-        unsigned char hex_peer_id[100];
-        memset(hex_peer_id, 0, 100);
-        for (i = 0; i < 20; i++ ) {
-            sprintf( (char *) &hex_peer_id[2 * i], "%02x", leecher_peer_id[i] );
+        if ( peer->have.bits == NULL || !bitfield_test(&peer->have, index) ) {
+            send_to_peer(bt_args, peer, &msg);
         }
-        if (bt_args->verbose) {
-            printf("\tHEX value of CONNECTING LEECHER's peer id: '%s'\n", hex_peer_id);
+        update_interest(bt_args, peer);
+    }
+}
+
+/**
+ * handle_message() dispatches on the message type
+ **/
+int handle_message(bt_args_t *bt_args, peer_t *peer, bt_msg_t *msg) {
+    unsigned char *flags = &bt_args->peers.flags[peer->slot];
+    int num_pieces = bt_args->bt_info->num_pieces;
+    bt_request_t *request = &msg->payload.request;
+    bt_request_t block;
+
+    switch (msg->bt_type) {
+        case BT_KEEP_ALIVE:
+            return 0;
+
+        case BT_CHOKE:  // the peer discards our requests; their blocks go to other peers
+            *flags |= PEER_CHOKING;
+            release_requests(bt_args, peer);
+            return 0;
+
+        case BT_UNCHOKE:
+            *flags &= ~PEER_CHOKING;
+            return request_blocks(bt_args, peer) < 0 ? -1 : 0;
+
+        case BT_INTERESTED: // unchoked now if a slot is free, else the choker decides at its next round
+            *flags |= PEER_INTERESTED;
+            return choke_interested(bt_args, peer);
+
+        case BT_NOT_INTERESTED:
+            *flags &= ~PEER_INTERESTED;
+            return 0;
+
+        case BT_HAVE:
+            if ( msg->payload.have < 0 || msg->payload.have >= num_pieces ||
+                    peer_has(bt_args, peer, msg->payload.have) < 0 ) {
+                return -1;
+            }
+            if ( update_interest(bt_args, peer) < 0 ) {
+                return -1;
+            }
+            return request_blocks(bt_args, peer) < 0 ? -1 : 0;
+
+        case BT_BITFILED:   // only valid as the first message, before any HAVE
+            if ( peer->have.bits || bitfield_init(&peer->have, num_pieces) < 0 ||
+                    bitfield_load(&peer->have, msg->data, msg->length - 1) < 0 ) {
+                return -1;
+            }
+            picker_add_bitfield(&bt_args->picker, &peer->have);
+            return update_interest(bt_args, peer);
+
+        case BT_REQUEST:
+            if ( (*flags & PEER_AM_CHOKING) || request->index < 0 || request->index >= num_pieces ||
+                    request->length <= 0 || request->length > MAX_REQUEST_LEN ) {
+                return 0;   // not ours to serve (or we are choking the peer); ignored
+            }
+            // a piece the background recheck has not reached yet is checked next; the request is queued and
+            // waits for the result
+            if ( !bitfield_test(bt_args->bitfield, request->index) && verify_demand(bt_args, request->index) == 0 ) {
+                return 0;
+            }
+            serve_request(bt_args, peer, request);  // a full queue drops the request; socket errors show up in poll_peers()
+            return 0;
+
+        case BT_CANCEL:
+            cancel_request(peer, &msg->payload.cancel);
+            return 0;
+
+        case BT_PIECE:
+            block.index = msg->payload.piece.index;
+            block.begin = msg->payload.piece.begin;
+            block.length = msg->length - 9;
+            if ( block_received(bt_args, peer, &block, msg->data) == 1 ) {
+                announce_piece(bt_args, block.index);
+            }
+            return request_blocks(bt_args, peer) < 0 ? -1 : 0;
+
+        default:    // extension messages are not supported; skipped
+            return 0;
+    }
+}
+
+/**
+ * handle_peer_input() decodes what is already in the peer's receive ring, then drains its socket until read()
+ * would block (the socket is edge-triggered, so anything left unread would not be reported again). Every read
+ * goes straight into the ring and is followed by decoding all the messages it completed; a partial message waits
+ * in the ring. While the peer is backlogged (see input_paused()) its input is left where it is
+ **/
+int handle_peer_input(bt_args_t *bt_args, peer_t *peer) {
+    unsigned char *hs;  // the peer's handshake, in the ring
+    bt_msg_t msg;
+    int ret;
+
+    while (1) {
+        // the handshake comes first and has no length prefix
+        if ( !(peer->hs_state & HS_RECEIVED) && (hs = wire_take(peer, HANDSHAKE_LEN)) != NULL &&
+                handle_handshake(bt_args, peer, hs) < 0 ) {
+            return -1;
         }
-        unsigned char *hex_btclient_id;
-        hex_btclient_id = get_hashhex(bt_args->id);
-        if (bt_args->verbose) {
-            printf("\tHEX value of BT Client's id: '%s'\n", hex_btclient_id);
+
+        if (peer->hs_state & HS_RECEIVED) {
+            while ( !input_paused(bt_args, peer) && (ret = read_from_peer(bt_args, peer, &msg)) != 0 ) {
+                if (ret < 0) {
+                    fprintf(stderr, "ERROR: Malformed message from peer '%s:%u'.\n", inet_ntoa(peer->sockaddr.sin_addr),
+                            peer->port);
+                    return -1;
+                }
+                if ( handle_message(bt_args, peer, &msg) < 0 ) {
+                    return -1;
+                }
+            }
+            if ( bt_args->peers.flags[peer->slot] & PEER_RX_PAUSED ) {
+                return 0;   // resumed by flush_peers()
+            }
         }
 
-        // compare received peer id from leecher with bt client's id for equality
-        if ( strcmp( (const char *) hex_peer_id, (const char *) hex_btclient_id) == 0) {
-            printf("HANDSHAKE SUCCESS peer: %s port: %u id: %s\n", inet_ntoa(seeder_addr.sin_addr), port, hex_btclient_id);
-        } else
-            drop_conn = 1;
+        if ( (ret = wire_fill(bt_args, peer)) <= 0 ) {
+            return ret;
+        }
+    }
+}
 
-        memset(buffer, 0x00, BUF_LEN);  // flush-out buffer everytime a cycle of reading from socket is completed
+/**
+ * poll_peers() runs one turn of the event loop: waits up to LOOP_TICK_MS (LIMIT_TICK_MS while the rate limiter
+ * holds peers back, so they are let go as soon as tokens are back) for socket activity and dispatches
+ * each ready socket - the listen socket to accept_peers(), readable peer sockets to handle_peer_input(); writable
+ * ones are unblocked for flush_peers()
+ **/
+int poll_peers(bt_args_t *bt_args) {
+    struct epoll_event events[MAX_EVENTS];
+    int n_events;   // number of ready sockets
+    int i;  // loop iterator variable
+    int slot;   // ready peer's slot in the peer table
+    peer_t *peer;
 
+    if ( (n_events = epoll_wait(bt_args->epoll_fd, events, MAX_EVENTS, limit_poll_ms(bt_args))) < 0 ) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        fprintf(stderr, "ERROR: epoll_wait failed: %s\n", strerror(errno));
+        return -1;
     }
 
-    if (bytes_read < 0) {
-        fprintf(stderr, "ERROR: Could not read from seeder socket.\n");
-        exit(1);
-    }
+    for (i = 0; i < n_events; i++) {
+
+        if (events[i].data.fd == bt_args->listen_sock) {    // listen socket: new leechers are knocking
+            accept_peers(bt_args);
+            continue;
+        }
+
+        if ( bt_args->verify && events[i].data.fd == bt_args->verify->event_fd ) {  // pieces passed their check
+            verify_collect(bt_args);
+            continue;
+        }
+
+        if ( bt_args->disk && events[i].data.fd == bt_args->disk->event_fd ) {  // disk operations are over
+            disk_collect(bt_args);
+            continue;
+        }
+
+        if ( bt_args->resolver && events[i].data.fd == bt_args->resolver->event_fd ) {  // host names looked up
+            resolver_collect(bt_args);
+            continue;
+        }
+
+        // slots move as peers are dropped, so events carry the socket and are mapped back here
+        if ( (slot = peer_slot_by_fd(&bt_args->peers, events[i].data.fd)) < 0 ) {
+            continue;   // peer already dropped earlier in this batch
+        }
+        peer = bt_args->peers.peer[slot];
 
-    if (drop_conn == 1) {   // if connecting leecher's peer id & bt client ID do not match, drop connection
-        printf("\tConnecting leecher's peer id & bt client's id do not match, connection dropped.\n");
-        goto END;
+        // a connect we started is over, one way or the other
+        if (bt_args->peers.flags[slot] & PEER_CONNECTING) {
+            connect_ready(bt_args, peer, events[i].events);
+            continue;
+        }
+
+        // read first so that data sent right before a hang-up is not lost
+        if ( (events[i].events & EPOLLIN) && handle_peer_input(bt_args, peer) < 0 ) {
+            drop_peer(peer, bt_args);
+            continue;
+        }
+
+        if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            drop_peer(peer, bt_args);
+            continue;
+        }
+
+        // socket buffer drained: queued output goes again with the next flush_peers()
+        if (events[i].events & EPOLLOUT) {
+            bt_args->peers.flags[slot] &= ~PEER_TX_BLOCKED;
+        }
     }
 
-    // proceed with standard closing seeder sockets
-    printf("CLOSING SEEDER SOCKET as no more data available to read.\n");
-    END:
-        close(new_seeder_sock);
-        close(seeder_sock);
+    return n_events;
 }
 
 /**
- * init_leecher() documentation TO DO
+ * now_ms() reads CLOCK_MONOTONIC, which wall-clock adjustments cannot move backwards
  **/
-int init_leecher(peer_t *peer) {
+long long now_ms(void) {
+    struct timespec ts;
 
-    int leecher_sock;   // to create a leecher socket to communicate with seeder
-    /*char buffer[BUF_LEN];    // read/write buffer
-    ssize_t bytesWritten = 0;    // track number of bytes read or written
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
 
-    memset(buffer, 0x00, BUF_LEN); // zero-out buffer*/
+/**
+ * mem_charge() takes the bytes with a compare-and-swap, so a worker thread may charge alongside the event loop
+ **/
+int mem_charge(bt_args_t *bt_args, size_t bytes) {
+    size_t used = __atomic_load_n(&bt_args->mem_used, __ATOMIC_RELAXED);
 
-    // create the TCP stream socket
-    if ( ( leecher_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP) ) < 0 ) {   // non-negative socket() return value indicates failure in creating the socket
-        fprintf(stderr, "ERROR: TCP leecher socket creation failed.\n");
-        exit(1);
-    }
-    
-    // establish connection with leecher by calling connect on the seeder's TCP socket, sockfd
-    if ( connect( leecher_sock, (struct sockaddr *) &peer->sockaddr, sizeof(peer->sockaddr) ) < 0 ) {
-        fprintf(stderr, "ERROR: Connection could not be established to seeder id: %s\n", get_hashhex(peer->id));
-        exit(1);
+    do {
+        if (used + bytes > MEMORY_BUDGET) {
+            return -1;
+        }
+    } while ( !__atomic_compare_exchange_n(&bt_args->mem_used, &used, used + bytes, 1, __ATOMIC_RELAXED,
+            __ATOMIC_RELAXED) );
+    return 0;
+}
+
+void mem_release(bt_args_t *bt_args, size_t bytes) {
+    __atomic_sub_fetch(&bt_args->mem_used, bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * add_peer() fills in a peer_t for hostname:port and appends it to the peer table
+ *
+ * Return: the peer's slot, -1 if that peer is already in the table
+ **/
+int add_peer(peer_t *peer, bt_args_t *bt_args, char *hostname, unsigned short port) {
+    char id[ID_SIZE];   // SHA1 of hostname & port
+
+    calc_id(hostname, port, id);
+    init_peer(peer, id, hostname, port);
+
+    return peer_table_insert(&bt_args->peers, peer);
+}
+
+/**
+ * drop_peer() unregisters and closes a peer's socket, removes the peer from the peer table and frees it
+ *
+ * Return: 0 on success, -1 if peer is not in the table
+ **/
+int drop_peer(peer_t *peer, bt_args_t *bt_args) {
+    int sock;
+
+    if (peer->slot < 0) {
+        return -1;
     }
 
-    printf("CONNECTION ESTABLISHED to PEER: '%s:%u'; peer id: %s\n", inet_ntoa(peer->sockaddr.sin_addr), peer->port, get_hashhex(peer->id));
+    if ( (sock = bt_args->peers.fd[peer->slot]) >= 0 ) {
+        reactor_del(bt_args, sock);
+        close(sock);
+    }
+    if (bt_args->peers.flags[peer->slot] & PEER_CONNECTING) {
+        bt_args->n_half_open--;
+    }
+    choke_forget(bt_args, peer);
+    printf("CONNECTION CLOSED to PEER: '%s:%u'; peer id: %s\n", inet_ntoa(peer->sockaddr.sin_addr), peer->port, get_hashhex(peer->id));
 
-    return leecher_sock;
+    // blocks we were waiting for from this peer go to the others
+    release_requests(bt_args, peer);
+    if (peer->upload.cached) {
+        cache_release(bt_args, peer->upload.cached);
+    }
+    wire_free(bt_args, peer);
 
-/*    // send all communication from leecher to seeder henceforth
-    while ( ( bytesWritten = write(leecher_sock, buffer, strlen(buffer)) ) ) {
-        printf("testing, you are here!");
+    // the pieces this peer had are that much rarer now
+    if (peer->have.bits) {
+        picker_remove_bitfield(&bt_args->picker, &peer->have);
+        bitfield_free(&peer->have);
     }
 
-    close(leecher_sock);
-    printf("CONNECTION CLOSED to PEER: '%s:%u'; peer id: ", inet_ntoa(peer->sockaddr.sin_addr), peer->port);
-    get_hashhex(peer->id);
-    printf("\n");   // line feed*/
-    
+    peer_table_remove(&bt_args->peers, peer->slot);
+    slab_free(&bt_args->peer_slab, peer);
+    return 0;
 }
 
 /**
- * init_handshake(peer_t *) documentation TO DO
+ * init_handshake() lays out <19>"BitTorrent protocol"<8 zero reserved bytes><info_hash><our peer id>
  **/
-void init_handshake(peer_t *peer, unsigned char *hs, bt_info_t *bt_info) {
-    
-    printf("HANDSHAKE INIT to peer: %s port: %u; peer id: %s\n", inet_ntoa(peer->sockaddr.sin_addr), peer->port, get_hashhex(peer->id));
-
-    // null handshake array initially
-    memset(hs, 0, 100);
-
-    // add 'protocol' information to 'handshake'
-    sprintf( (char *) hs, "%c", 19);  // store decimal '19' as first byte
-    strncat( (char *) hs, "BitTorrent Protocol", 19);
-    strncat( (char *) hs, ":", 1);   // add delimiter
-    strcat( (char *) hs, "00000000:"); // next 8 'reserved' bytes set as string containing 8 zeros
-
-    /* need to calculate hash of bt_info->name that was extracted from .torrent file
-     * fill that hash string into 'handshake' */
-    char info_hash[20]; // to store hash of bt_info->name
-    memset(info_hash, 0, 20); // null hash string initially
-    SHA1( (unsigned char *) bt_info->name, strlen(bt_info->name), (unsigned char *) info_hash );   // copy hash to 'handshake'
-    // printf("testing, inside init_handshake, info_hash: '%s'\n", info_hash);
-    // printf("testing, inside init_handshake, length of info_hash: '%ld'\n", strlen(info_hash));
-    memcpy( (hs + 30), info_hash, 20);
-    strncat( (char *) hs, ":", 1);
-    // printf("testing, inside init_handshake, strlen(info_hash): %ld\n", strlen(info_hash));
-    // printf("testing, inside init_handshake, hs: '%s'\n", hs);
-
-    // store connecting peer's id (hash of 20-bytes) into handshake
-    /*printf("testing, inside init_handshake, peer->id without hex: '%s'\n", peer->id);
-    printf("testing, inside init_handshake, peer->id in hex: ");
-    int i;
-    for (i = 0; i < 20; i++ ) {
-        printf("%02x", peer->id[i]);
-    }
-    printf("\n");*/
-    memcpy( (hs + 51), peer->id, 20);
-    // printf("testing, inside init_handshake, hs: '%s'\n", hs);
+void init_handshake(bt_args_t *bt_args, unsigned char *hs) {
+    hs[0] = 19;
+    memcpy(hs + 1, PROTOCOL_NAME, 19);
+    memset(hs + 20, 0x00, 8);   // no extensions
+    memcpy(hs + 28, bt_args->bt_info->info_hash, ID_SIZE);
+    memcpy(hs + 48, bt_args->id, ID_SIZE);
+}
 
-    /************** handshake structure construction completed *****************/
+/**
+ * piece_size() is the number of bytes in piece index; every piece is piece_length long except the last,
+ * which holds whatever is left of the file
+ **/
+int piece_size(bt_info_t *bt_info, int index) {
+    long long remaining = bt_info->length - (long long) index * bt_info->piece_length;
 
+    return (remaining < bt_info->piece_length) ? (int) remaining : bt_info->piece_length;
 }
 
+/**
+ * create_bitfield() rechecks the payload mapped in bt_args->store against the piece hashes of the torrent, in parallel
+ * on all cores (see hash_pieces()), and records the pieces that match in bt_args->bitfield
+ **/
 void create_bitfield(bt_args_t *bt_args, bt_info_t *bt_info) {
 
     int i;  // loop iterator variable
+    unsigned char *piece_hash;  // computed SHA1 of each piece
+    int n_valid;    // pieces that matched their hash
+    int resumed;    // what resume_load() made of the sidecar
+
+    if (bt_args->bitfield == NULL) {
+        bt_args->bitfield = malloc(sizeof(bt_bitfield_t));
+    } else {
+        bitfield_free(bt_args->bitfield);
+    }
 
-    FILE *fp = fopen(bt_info->name, "rb"); // say open file 'download.mp3'
-    if (!fp) {
-        fprintf(stderr, "ERROR: Could not open target torrent file: %s\n", bt_info->name);
+    // set bitfield size only as much as the number of pieces the file is divided into
+    if ( bitfield_init(bt_args->bitfield, bt_info->num_pieces) < 0 ) {
+        fprintf(stderr, "ERROR: Could not allocate a bitfield of %d pieces.\n", bt_info->num_pieces);
         exit(1);
     }
 
-    long int file_offset = bt_info->piece_length;
-    fseek(fp, 0, SEEK_END); // move file pointer to the end
-    long int f_end = ftell(fp);
-    rewind(fp); // move file pointer back to start
-    unsigned char *file_buffer = malloc( bt_info->piece_length * sizeof(char) + 1); // 1 extra byte for null-character
-    unsigned char piece_hash[bt_info->num_pieces][20];
-    unsigned char *piece_hex_hash = malloc(40);
-
-    // null all variables initially
-    memset(file_buffer, 0x00, bt_info->piece_length);
-    memset(piece_hex_hash, 0x00, 40);
+    // a sidecar saved since the payload last changed spares us the full recheck; one saved before the last
+    // writes (a crash) narrows it down to the pieces it records
+    resumed = resume_load(bt_args, bt_args->bitfield);
+    if (resumed == 1) {
+        for (i = 0; i < bt_info->num_pieces; i++) {
+            if ( bitfield_test(bt_args->bitfield, i) && !verify_piece(&bt_args->store, bt_info, i) ) {
+                bitfield_clear(bt_args->bitfield, i);
+            }
+        }
+    }
+    if (resumed >= 0) {
+        printf("FAST RESUME: %zu of %d pieces of '%s' verified as of the last save.\n",
+                bitfield_count(bt_args->bitfield), bt_info->num_pieces, payload_path(bt_args));
+        store_advise(&bt_args->store, STORE_RANDOM);
+        bt_args->resume_saved_ms = now_ms();
+        bt_args->resume_saved_pieces = bitfield_count(bt_args->bitfield);
+        return;
+    }
 
-    // set bitfield size only as much as the number of pieces the file is divided into
-    bt_args->bitfield->size = bt_info->num_pieces;
-    // printf("testing, bt_args->bitfield->size: '%ld\n'", bt_args->bitfield->size);
-    bt_args->bitfield->bits = malloc(bt_info->num_pieces * sizeof(char));
+    // a lazy seeder listens already and checks pieces while serving them
+    if ( bt_args->lazy_verify && bt_args->bind && verify_start(bt_args) == 0 ) {
+        bt_args->resume_saved_ms = now_ms();
+        return;
+    }
 
     if (bt_args->verbose) {
-        printf("Comparing hex values of pieces on record from '%s' with those calculated by splitting actual file...\n", bt_args->torrent_file);
-    }
-    for (i = 0; i < (int) bt_args->bitfield->size; i++) { // set each bitfield one by one
-        /* break file into known number of pieces;
-         * read each file piece and create hash of the piece */
-        fread(file_buffer, sizeof(char), file_offset, fp);
-        SHA1( file_buffer, file_offset, piece_hash[i]);
-        piece_hex_hash = get_hashhex(piece_hash[i]);
-
-        if (bt_args->verbose) {
-            printf("Hex of piece_hash[%d]: '%s'\n", i, piece_hex_hash);
-            printf("Hex of bt_info->piece_hashes[%d]: '%s'\n", i, bt_info->piece_hashes[i]);
-        }
+        printf("Comparing hex values of pieces on record from '%s' with those calculated by splitting actual file on %d threads...\n",
+                bt_args->torrent_file, hash_threads(bt_info->num_pieces));
+    }
 
-        if ( memcmp(piece_hex_hash, bt_info->piece_hashes[i], 40) == 0 ) {
-            bt_args->bitfield->bits[i] = '1';
-        } else {
-            bt_args->bitfield->bits[i] = '0';
-        }
+    piece_hash = malloc(bt_info->num_pieces * ID_SIZE);
+    n_valid = hash_pieces(&bt_args->store, bt_info, bt_args->bitfield, piece_hash);
+    bt_args->resume_saved_ms = now_ms();
 
-        if ( i == ((int) bt_args->bitfield->size - 2) ) {
-            file_offset = f_end - ftell(fp);
+    // from now on blocks are read in whatever order peers ask for them
+    store_advise(&bt_args->store, STORE_RANDOM);
+
+    if (bt_args->verbose) {
+        for (i = 0; i < bt_info->num_pieces; i++) {
+            printf("Hex of piece_hash[%d]: '%s'\n", i, get_hashhex(piece_hash + i * ID_SIZE));
+            printf("Hex of bt_info->piece_hashes[%d]: '%s'\n", i, get_hashhex(bt_info->piece_hashes + i * ID_SIZE));
         }
+        printf("%d of %d pieces of '%s' verified.\n", n_valid, bt_info->num_pieces, payload_path(bt_args));
     }
-    bt_args->bitfield->bits[i] = '\0';  // null-termination
-    // printf("testing, bt_args->bitfield->bits: '%s'\n", bt_args->bitfield->bits);
-}
\ No newline at end of file
+
+    free(piece_hash);
+}
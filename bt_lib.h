@@ -16,13 +16,16 @@
 #include <netinet/in.h>
 #include <netdb.h> 
 
+#include "bt_sha1.h"
+#include "bt_slab.h"
+
 #include "bt_lib.h"
 
 /* Maximum file name size, to make things easy */
 #define FILE_NAME_MAX 1024
 
-/* Maximum number of connections */
-#define MAX_CONNECTIONS 5
+/* initial number of slots in the peer table; it doubles whenever it fills up */
+#define INIT_PEER_SLOTS 16
 
 /* initial port to try and open a listen socket on */
 #define INIT_PORT 6667 
@@ -30,6 +33,9 @@
 /* max port to try and open a listen socket on */
 #define MAX_PORT 6699
 
+/* longest host name of a peer, NUL included */
+#define RESOLVE_NAME_MAX 256
+
 /* Different BitTorrent Message Types */
 #define BT_CHOKE 0
 #define BT_UNCHOKE 1
@@ -41,15 +47,41 @@
 #define BT_PIECE 7
 #define BT_CANCEL 8
 
+/* pseudo message type of a zero-length (keep-alive) message; never sent as an id */
+#define BT_KEEP_ALIVE 0xff
+
 /* size (in bytes) of id field for peers (20-byte SHA1 digest denoting peer ID) */
 #define ID_SIZE 20
 
+/* size (in bytes) of the handshake both peers send first: <19>"BitTorrent protocol"<8 reserved><info_hash><peer id> */
+#define HANDSHAKE_LEN 68
+#define PROTOCOL_NAME "BitTorrent protocol"
+
+/* size (in bytes) of a BT_PIECE message header: <length prefix><id><index><begin> */
+#define PIECE_HDR_LEN 13
+
+/* requests a peer may have queued with us before we stop accepting more */
+#define MAX_UPLOAD_QUEUE 128
+
+/* largest block a peer may request from us */
+#define MAX_REQUEST_LEN 131072
+
+/* size (in bytes) of the blocks pieces are requested in; the last block of the last piece may be shorter */
+#define BLOCK_SIZE 16384
+
+/* block requests kept outstanding with each unchoked peer: a new peer starts at INIT_QUEUE_DEPTH, then the
+ * depth follows the peer's rate * round-trip time (in blocks) between MIN_QUEUE_DEPTH and MAX_QUEUE_DEPTH */
+#define INIT_QUEUE_DEPTH 4
+#define MIN_QUEUE_DEPTH 2
+#define MAX_QUEUE_DEPTH 256
+
 /**
  * Message structures
  */
 typedef struct {
-    char *bits; //bitfield where each bit represents a piece that the peer has or doesn't have
-    size_t size; //size of the bitfield
+    unsigned char *bits; //bitfield where each bit represents a piece that the peer has or doesn't have; packed 8 pieces
+                         //to a byte, piece 0 in the high bit of byte 0, exactly as sent in a BT_BITFILED message
+    size_t size; //size of the bitfield, in pieces
 } bt_bitfield_t;
 
 typedef struct{
@@ -78,49 +110,257 @@ typedef struct bt_msg {
         char data[0]; // pointer to start of payload, just incase   
     } payload;
 
+    unsigned char *data;    // variable-length part of a received message (BT_BITFILED bits, BT_PIECE block), in place
+                            // in the peer's receive buffer; valid until the next read from the peer
 } bt_msg_t;
 
-// holds information about a peer
+/* receive buffer of a peer: a ring whose memory is mapped twice, back to back, so every frame in it can be read as
+ * one contiguous run of bytes, even when it wraps past the end */
+typedef struct {
+    unsigned char *buf; // first of the two mappings; buf[i] and buf[i + size] are the same byte
+    size_t size;    // ring capacity, a power of 2 and a multiple of the page size
+    size_t head;    // bytes consumed so far; the oldest unread byte is at buf + head % size
+    size_t tail;    // bytes received so far; tail - head are unread
+} bt_ring_t;
+
+/* a BT_PIECE response being streamed to a peer: header from memory, block from the read cache or straight from
+ * the payload file */
+typedef struct {
+    unsigned char header[PIECE_HDR_LEN];    // <length = 9 + block><7><index><begin>, all big-endian
+    int hdr_sent;   // header bytes already written to the socket
+    off_t offset;   // payload file offset of the next block byte to send
+    int remaining;  // block bytes still to send; 0 when nothing is in flight
+    struct cached_piece *cached;    // read cache copy of the piece the block is sent from, NULL to send from the payload
+} bt_upload_t;
+
+/* download state of a piece, piece_picker_t.state */
+#define PIECE_WANTED 0 // missing and not being downloaded
+#define PIECE_ACTIVE 1 // blocks of it are being requested
+#define PIECE_DONE 2   // downloaded and verified (or seeded)
+
+/* rarest-first piece picker. order[] lists every piece, grouped into buckets: bucket 0 holds the pieces that are
+ * not PIECE_WANTED (done, or being downloaded), bucket a + 1 the wanted pieces exactly a peers have, so a pick only
+ * ever looks at candidates. A piece's availability changing by one only swaps it across the boundary of its
+ * bucket, so HAVE/BITFIELD/disconnect updates are O(1) per piece */
+typedef struct {
+    int num_pieces; // pieces in the torrent
+    int *availability;  // number of connected peers having each piece
+    unsigned char *state;   // PIECE_* of each piece
+    int *order; // pieces, sorted by bucket
+    int *pos;   // pos[piece]: index of piece in order
+    int *bucket_start;  // index in order where each bucket begins; bucket_start[n_buckets] == num_pieces
+    int n_buckets;  // number of buckets in use
+    int n_wanted;   // pieces PIECE_WANTED; none left (and no free block) puts the download in endgame
+} piece_picker_t;
+
+/* download state of a block, active_piece_t.blocks */
+#define BLOCK_FREE 0   // nobody has been asked for it
+#define BLOCK_REQUESTED 1  // requested from a peer, not received yet
+#define BLOCK_RECEIVED 2   // saved to the payload
+
+/* a piece whose blocks are being requested (PIECE_ACTIVE in the picker) */
+typedef struct {
+    int index;  // which piece
+    int n_blocks;   // blocks in the piece
+    int n_free; // blocks still BLOCK_FREE
+    int n_received; // blocks BLOCK_RECEIVED; the piece is checked once this reaches n_blocks
+    unsigned char *blocks;  // BLOCK_* of each block
+    unsigned char *buf; // assembly buffer the blocks are gathered in; NULL once flushed, blocks then go to the payload
+    int n_hashed;   // leading blocks fed to sha; a block past a gap waits in the payload until the gap fills
+    sha1_ctx_t sha; // SHA1 of the piece so far, extended block by block as they come in order
+    int n_writing;  // writes of its blocks to the payload in flight; nothing is read back until they land
+    int write_failed;   // one of those writes failed: the piece is downloaded again
+} active_piece_t;
+
+/* every piece being downloaded; a peer is given blocks of these before the picker starts a new piece */
+typedef struct {
+    active_piece_t *active; // pieces being downloaded
+    int n_active;   // entries used in active
+    int cap_active; // entries allocated in active
+    long long last_tick_ms; // when download rates were last sampled
+    unsigned char **spare_bufs; // assembly buffers not in use (see bt_assembly.h)
+    int n_spare;    // entries used in spare_bufs
+    int n_bufs; // assembly buffers allocated, in use or spare
+    int max_bufs;   // most assembly buffers allocated at once
+    int endgame;    // every missing block is requested: blocks are asked for again from other peers
+    long long wasted_bytes; // block bytes received that we had no use for, duplicates mostly
+} download_t;
+
+/* directions of a bandwidth limit, index of the per-direction arrays below */
+#define LIMIT_UP 0 // bytes we send
+#define LIMIT_DOWN 1   // bytes we read
+
+/* token bucket: tokens accrue at rate bytes per second up to burst bytes, and each byte moved spends one */
+typedef struct {
+    long long rate;     // bytes per second, 0 if unlimited
+    long long burst;    // most bytes that may go at once
+    long long tokens;   // in thousandths of a byte, so that refills of a few ms add up exactly
+    long long last_ms;  // when the bucket was last refilled
+} token_bucket_t;
+
+/* bandwidth limits, global, of this torrent and of each peer (see bt_limit.h) */
+typedef struct {
+    token_bucket_t global[2];   // LIMIT_UP, LIMIT_DOWN
+    token_bucket_t torrent[2];
+    long long peer_rate[2]; // bytes per second each peer may move, 0 if unlimited; peers keep their own buckets
+    long long share[2]; // bytes one peer may move in this turn of the event loop while the shared buckets limit
+    unsigned int turn;  // turns of the event loop so far
+    int throttled;  // some peer was held back in this turn; the event loop wakes up soon to let it go on
+} limiter_t;
+
+/* who gets upload slots (see bt_choke.h) */
+typedef struct {
+    long long next_round_ms;    // when the unchoked peers are chosen again
+    long long next_optimistic_ms;   // when the optimistic unchoke moves on to another peer
+    struct peer *optimistic;    // unchoked whatever its rate, NULL if none
+} choker_t;
+
+/* a block request sent to a peer and not answered yet */
+typedef struct {
+    bt_request_t request;   // what was asked for
+    long long sent_ms;  // when, for round-trip time and timeout
+} bt_pending_t;
+
+/* bits of peer_t.hs_state */
+#define HS_SENT 0x01   // our handshake is queued
+#define HS_RECEIVED 0x02   // the peer's handshake arrived and checked out
+
+/* bits of peer_table_t.flags */
+#define PEER_AM_CHOKING 0x01   // we are choking the peer
+#define PEER_AM_INTERESTED 0x02    // we are interested in the peer
+#define PEER_CHOKING 0x04  // peer is choking us
+#define PEER_INTERESTED 0x08   // peer is interested in us
+#define PEER_TX_QUEUED 0x10    // messages or BT_PIECE responses are waiting to be sent
+#define PEER_TX_BLOCKED 0x20   // the socket buffer is full; nothing is sent until EPOLLOUT
+#define PEER_RX_PAUSED 0x40    // input is left unread until our responses to the peer drain
+#define PEER_CONNECTING 0x80   // our non-blocking connect() to the peer is in progress
+
+// holds information about a peer; hot per-peer state (socket, flags, rates) lives in the peer_table_t instead
 typedef struct peer {
     unsigned char id[ID_SIZE];  // the peer id (SHA1 hash of peer IP & port)
+    char host[RESOLVE_NAME_MAX];    // host name or address the peer was given by
     unsigned short port;    // the port to connect
-    struct sockaddr_in sockaddr;    // sockaddr for peer
-    int peer_sock;  // socket used for connections
-    int choked; // peer choked?
-    int interested; // peer interested?
+    struct sockaddr_in sockaddr;    // sockaddr for peer; the address is only valid while resolved is set
+    int resolved;   // sockaddr holds host's address (looked up for the next connect, see resolve_lookup())
+    int slot;   // index of this peer in the peer table's arrays (-1 until added); changes when other peers are dropped
+    int hs_state;   // HS_* bits: which way the handshake went already
+    bt_ring_t rx;   // bytes received and not decoded yet
+    unsigned char *tx_buf;  // control messages encoded and not sent yet (REQUEST, HAVE, ...), sent before the next BT_PIECE
+    int tx_cap; // bytes allocated in tx_buf
+    int tx_head;    // bytes of tx_buf already sent
+    int tx_len; // bytes of tx_buf in use
+    bt_bitfield_t have; // pieces the peer announced through BITFIELD/HAVE (bits NULL until the first one)
+    bt_upload_t upload; // BT_PIECE currently being sent to the peer
+    bt_request_t up_queue[MAX_UPLOAD_QUEUE];    // requests waiting for upload to finish, a ring
+    int up_head;    // index of the oldest request in up_queue
+    int up_count;   // number of requests in up_queue
+    bt_pending_t pending[MAX_QUEUE_DEPTH];  // our requests to the peer, oldest first; peer_table_t.n_requests of them
+    int queue_depth;    // requests to keep outstanding with the peer
+    int srtt_ms;    // smoothed request round-trip time, queueing behind earlier requests included (0 until the first block)
+    int min_rtt_ms; // lowest recent round-trip time, the link's own latency; drifts up until a new sample confirms it
+    unsigned int down_bytes;    // block bytes received since download rates were last sampled
+    unsigned int up_bytes;  // block bytes sent since upload rates were last sampled
+    token_bucket_t bucket[2];   // the peer's own limit, LIMIT_UP and LIMIT_DOWN
+    int throttled;  // 1 << LIMIT_* of the directions the limiter held the peer back in
+    unsigned int turn;  // turn of the event loop that turn_bytes counts
+    long long turn_bytes[2];    // bytes moved in that turn, against limiter_t.share
+    int connect_attempts;   // connects to the peer that failed in a row, the one in progress included
+    long long connect_at_ms;    // when the connect in progress times out or, without a socket, when to dial again
 } peer_t;
 
+/* growable table of all connected peers, laid out as a struct of arrays.
+ * live peers occupy slots [0, n_peers); dropping a peer moves the last one into its slot,
+ * so loops over the hot arrays never touch holes or cold peer_t data */
+typedef struct {
+    int n_peers;    // number of peers in the table
+    int capacity;   // number of slots allocated in each per-peer array
+
+    // hot per-peer state, indexed by slot
+    int *fd;    // socket used for connections (-1 if not connected)
+    unsigned char *flags;   // PEER_* choke/interest bits
+    unsigned int *down_rate;    // bytes/sec received from the peer
+    unsigned int *up_rate;  // bytes/sec sent to the peer
+    int *n_requests;    // block requests outstanding with the peer
+
+    // cold per-peer state, indexed by slot
+    peer_t **peer;
+
+    // lookup indexes
+    int *fd_slot;   // socket -> slot (-1 if unused), indexed by fd
+    int fd_cap; // number of entries in fd_slot
+    int *id_index;  // open-addressing hash of peer id -> slot + 1 (0 marks an empty bucket)
+    int id_cap; // number of buckets in id_index, a power of 2 kept at least twice capacity
+} peer_table_t;
+
+/* memory-mapped payload file; blocks are read and written in place through views into map */
+typedef struct {
+    int fd; // payload file (-1 if not open)
+    unsigned char *map; // MAP_SHARED mapping of the payload (NULL if empty)
+    size_t length;  // bytes mapped
+    int writable;   // opened for downloading into?
+    int no_sendfile;    // sendfile() refused this file; uploads are copied out of map instead
+} piece_store_t;
+
 /* holds information about a torrent file
  * parse .torrent file to fill contents of bt_info_t structure
  */
 typedef struct {
     char name[FILE_NAME_MAX];   // suggested name for saving the file, grab this from the 'name' field in the 'info' dictionary in .torrent file
     int piece_length;   // number of bytes in each piece
-    int length; // length of the file to be downloaded in bytes
+    long long length;   // length of the file to be downloaded in bytes
     int num_pieces; //number of pieces, computed based on above two values
-    unsigned char **piece_hashes;    // pointer to 20 byte data buffers containing the sha1sum of each of the pieces
+    const unsigned char *piece_hashes;  // SHA1 of each piece, raw, back to back: piece i's at piece_hashes + i * ID_SIZE
+                                        // (a view into the .torrent contents)
+    unsigned char info_hash[ID_SIZE];   // SHA1 of the bencoded 'info' dictionary, exactly as it appears in the .torrent file
+    arena_t arena;  // the .torrent contents, which piece_hashes points into, freed with the torrent
 } bt_info_t;
 
+struct verify_job;  // a background recheck, see bt_verify.h
+struct read_cache;  // pieces kept in memory for uploading, see bt_cache.h
+struct disk;    // asynchronous disk I/O, see bt_disk.h
+struct cached_piece;
+struct resolver;    // host name lookups, see bt_resolve.h
+
+/* memory the client may spend on copies of piece data: assembly buffers (bt_assembly.h) and the read cache
+ * (bt_cache.h) draw on it together, the download first */
+#define MEMORY_BUDGET (128 * 1024 * 1024)
+
+/* receive rings of dropped peers kept mapped for the next connection, bt_args_t.spare_rx */
+#define SPARE_RX_RINGS 16
+
 // holds all the arguments and state information for running the bt client
 typedef struct {
     int verbose; // verbose level
     int bind;   // to indicate whether bt_client needs to bind to seeder
+    int lazy_verify;    // seeder checks its payload in the background instead of before listening (-L)
     char bind_info[256];    // stores "IPaddr:port" string entered after '-b' flag
     char save_file[FILE_NAME_MAX]; // the file that seeder has
     bt_bitfield_t *bitfield;    // to store bitfield for torrent file in swarm
     FILE *f_save;
+    piece_store_t store;    // the payload, mapped; pieces are loaded from and saved to it
+    piece_picker_t picker;  // decides which piece to download next
+    download_t download;    // pieces being downloaded and their blocks
+    choker_t choker;    // upload slots
+    limiter_t limiter;  // bandwidth limits
+    long long resume_saved_ms;  // when the fast-resume sidecar was last saved (or found unchanged)
+    size_t resume_saved_pieces; // verified pieces it recorded then
+    struct verify_job *verify;  // background recheck in progress, NULL if none
+    struct read_cache *cache;   // pieces recently uploaded, NULL until the first upload
+    struct disk *disk;  // disk backend, NULL if there is none (disk I/O is then done in place)
+    int resume_pending; // a checkpoint of the sidecar is on its way through the disk backend
+    size_t mem_used;    // bytes of MEMORY_BUDGET taken (atomic)
+    slab_t peer_slab;   // every peer_t comes from here
+    slab_set_t bufs;    // send buffers and block state arrays, by size class
+    bt_ring_t spare_rx[SPARE_RX_RINGS]; // receive rings of dropped peers, ready for reuse
+    int n_spare_rx;
+    int n_half_open;    // peers with PEER_CONNECTING set
+    struct resolver *resolver;  // looks up host names of peers, NULL until one needs it
     char log_file[FILE_NAME_MAX]; //thise log file
     char torrent_file[FILE_NAME_MAX]; // *.torrent file
-    peer_t *peers[MAX_CONNECTIONS]; // array of peer_t pointers (i.e., array of seeders)
+    peer_table_t peers; // every peer in the swarm; seeders we dial and leechers we accepted
     unsigned char id[ID_SIZE];  // this bt_client's id
-    int sockets[MAX_CONNECTIONS]; // Array of possible sockets
-    struct pollfd poll_sockets[MAX_CONNECTIONS]; /* Array of pollfd for polling for input
-                          * struct pollfd {
-                          * int fd;         // file descriptor
-                          * short events;   // requested events (bitmasks indicating for what events fd must be watched)
-                          * short revents;  // returned events (bitmasks)
-                          * };
-                          */
+    int listen_sock;    // seeder's non-blocking listening socket (-1 in leecher mode)
+    int epoll_fd;   // epoll instance watching listen_sock and every peer socket
     /* set once torrent is parsed */
     bt_info_t *bt_info; // the parsed info for this torrent
 } bt_args_t;
@@ -128,34 +368,69 @@ typedef struct {
 /**
  * get_hashhex() documentation TO DO
  **/
-unsigned char * get_hashhex(unsigned char *);
+unsigned char * get_hashhex(const unsigned char *);
 
 /**
  * init_seeder() documentation TO DO
  **/
 void init_seeder(bt_args_t *);
 
+
 /**
- * init_leecher(peer_t *, bt_args_t) documentation TO DO
+ * make_seeder_listen(char *ip, unsigned short port, bt_args_t *bt_args) -> void
+ *
+ * bind a non-blocking listening socket to ip:port and register it with the
+ * event loop; connections are accepted later by poll_peers()
+ *
+ * ERRORS: Will exit on various errors
  **/
-int init_leecher(peer_t *);
+void make_seeder_listen(char *, unsigned short, bt_args_t *);
 
+/**
+ * handle_handshake(bt_args_t *bt_args, peer_t *peer, unsigned char *hs) -> int
+ *
+ * validate the HANDSHAKE_LEN bytes at hs: protocol name and info_hash
+ * must match ours and, on connections we dialed, the peer id must be the
+ * one we expect. Answers with our own handshake if we have not sent it
+ * yet, then announces our pieces with a BT_BITFILED.
+ *
+ * Return: 0 if the handshake matches, -1 if the connection should be dropped
+ **/
+int handle_handshake(bt_args_t *bt_args, peer_t *peer, unsigned char *hs);
 
 /**
- * make_seeder_listen() documentation TO DO
+ * init_handshake(bt_args_t *bt_args, unsigned char *hs) -> void
+ *
+ * fill HANDSHAKE_LEN bytes at hs with our handshake for this torrent
  **/
-void make_seeder_listen(char *, unsigned short, bt_args_t *);
+void init_handshake(bt_args_t *bt_args, unsigned char *hs);
 
 /**
- * init_handshake() documentation TO DO
+ * send_control(bt_args_t *bt_args, peer_t *peer, int bt_type) -> int
+ *
+ * queue a message that carries nothing but its type: BT_CHOKE,
+ * BT_UNCHOKE, BT_INTERESTED or BT_NOT_INTERESTED
+ *
+ * Return: 0 on success, -1 if the peer should be dropped
  **/
-void init_handshake(peer_t *, unsigned char *, bt_info_t *);
+int send_control(bt_args_t *bt_args, peer_t *peer, int bt_type);
+
+/**
+ * handle_message(bt_args_t *bt_args, peer_t *peer, bt_msg_t *msg) -> int
+ *
+ * act on one decoded message: track choke/interest state and the pieces
+ * the peer has, serve its requests and save the blocks it sends us
+ *
+ * Return: 0 on success, -1 if the peer should be dropped
+ **/
+int handle_message(bt_args_t *bt_args, peer_t *peer, bt_msg_t *msg);
 
 /* choose a random id for this node */
 unsigned int select_id();
 
 /**
  * propogate a peer_t struct and add it to the bt_args structure
+ * returns the peer's slot in bt_args->peers, -1 if the peer is already there
  **/
 int add_peer(peer_t *peer, bt_args_t *bt_args, char *hostname, unsigned short port);
 
@@ -165,6 +440,9 @@ int drop_peer(peer_t *peer, bt_args_t *bt_args);
 /* initialize connection with peers */
 int init_peer(peer_t *peer, char *id, char *ip, unsigned short port);
 
+/* milliseconds on the monotonic clock, for timeouts and rate measurements */
+long long now_ms(void);
+
 /* calc the peer id based on the string representation of the ip and port */
 void calc_id(char *ip, unsigned short port, char *id);
 
@@ -174,30 +452,47 @@ void print_peer(peer_t *peer);
 /* check status on peers, maybe they went offline? */
 int check_peer(peer_t *peer);
 
-/* check if peers want to send me something */
+/* check if peers want to send me something; accepts new peers, reads from ready ones and drops the ones that hung up.
+ * blocks at most LOOP_TICK_MS, returns number of events handled or -1 on error */
 int poll_peers(bt_args_t *bt_args);
 
-/* send a msg to a peer */
-int send_to_peer(peer_t *peer, bt_msg_t *msg);
+/* read everything available on a peer's non-blocking socket; returns -1 if the peer should be dropped */
+int handle_peer_input(bt_args_t *bt_args, peer_t *peer);
+
+
+/* encode a msg (not BT_PIECE, see serve_request()) into the peer's send buffer; it goes out with the next
+ * flush_peers(). returns 1 if queued, 0 if the send buffer is full */
+int send_to_peer(bt_args_t *bt_args, peer_t *peer, bt_msg_t *msg);
 
-/* read a msg from a peer and store it in msg */
-int read_from_peer(peer_t *peer, bt_msg_t *msg);
+/* decode the next complete message in the peer's receive buffer into msg.
+ * returns 1 if msg was filled, 0 if more bytes are needed, -1 on a malformed message */
+int read_from_peer(bt_args_t *bt_args, peer_t *peer, bt_msg_t *msg);
 
-/* save a piece of the file */
-int save_piece(bt_args_t *bt_args, bt_piece_t *piece);
+/* save the block described by block (index, begin, length) from data into the payload.
+ * returns 0 on success, -1 if the block lies outside the torrent */
+int save_piece(bt_args_t *bt_args, bt_request_t *block, unsigned char *data);
 
-/* load a piece of the file into piece */
-int load_piece(bt_args_t *bt_args, bt_piece_t *piece);
+/* view of the block a request asks for, straight from the payload mapping (no copy); NULL if out of range */
+unsigned char * load_piece(bt_args_t *bt_args, bt_request_t *request);
+
+/* take bytes of MEMORY_BUDGET. returns 0 on success, -1 if that would exceed it */
+int mem_charge(bt_args_t *bt_args, size_t bytes);
+
+/* give back bytes taken with mem_charge() */
+void mem_release(bt_args_t *bt_args, size_t bytes);
+
+/* number of bytes in piece index (the last piece may be short) */
+int piece_size(bt_info_t *bt_info, int index);
 
 /* peers know which file pieces others have through a bitfield */
 void create_bitfield(bt_args_t *, bt_info_t *);
 
+/* tell every peer lacking it that piece index is now ours (BT_HAVE), once it is set in bt_args->bitfield */
+void announce_piece(bt_args_t *bt_args, int index);
+
 /* load the bitfield into bitfield */
 int get_bitfield(bt_args_t *bt_args, bt_bitfield_t *bitfield);
 
-/* compute the sha1sum for a piece, store result in hash */
-int sha1_piece(bt_args_t *bt_args, bt_piece_t *piece, unsigned char *hash);
-
 /* Contact the tracker and update bt_args with info learned, such as peer list */
 int contact_tracker(bt_args_t *bt_args);
 
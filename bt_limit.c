@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bt_lib.h"
+#include "bt_limit.h"
+#include "bt_sock.h"
+
+/**
+ * bucket_set() gives the bucket a new rate; the tokens it holds are kept, up to the new burst
+ **/
+static void bucket_set(token_bucket_t *bucket, long long rate) {
+    bucket->rate = rate;
+    bucket->burst = rate / 4 > LIMIT_MIN_BURST ? rate / 4 : LIMIT_MIN_BURST;
+    if (bucket->last_ms == 0) {
+        bucket->tokens = bucket->burst * 1000;  // a new bucket starts full
+        bucket->last_ms = now_ms();
+    }
+    if (bucket->tokens > bucket->burst * 1000) {
+        bucket->tokens = bucket->burst * 1000;
+    }
+}
+
+/**
+ * bucket_refill() adds rate tokens per second since the last refill; rate * ms is in thousandths of a byte
+ **/
+static void bucket_refill(token_bucket_t *bucket, long long now) {
+    if (bucket->rate == 0) {
+        return;
+    }
+    bucket->tokens += bucket->rate * (now - bucket->last_ms);
+    if (bucket->tokens > bucket->burst * 1000) {
+        bucket->tokens = bucket->burst * 1000;
+    }
+    bucket->last_ms = now;
+}
+
+/**
+ * bucket_spend() takes n bytes' worth of tokens from a limiting bucket
+ **/
+static void bucket_spend(token_bucket_t *bucket, size_t n) {
+    if (bucket->rate) {
+        bucket->tokens -= (long long) n * 1000;
+    }
+}
+
+/**
+ * limit_set() changes one bucket, or the rate every peer's bucket is brought to when it is next used
+ **/
+void limit_set(bt_args_t *bt_args, int level, int dir, long long rate) {
+    limiter_t *limiter = &bt_args->limiter;
+
+    switch (level) {
+        case LIMIT_GLOBAL:
+            bucket_set(&limiter->global[dir], rate);
+            break;
+        case LIMIT_TORRENT:
+            bucket_set(&limiter->torrent[dir], rate);
+            break;
+        case LIMIT_PEER:
+            limiter->peer_rate[dir] = rate;
+            break;
+    }
+}
+
+/**
+ * shared_tokens() is what the global and torrent buckets let through together, -1 if neither limits
+ **/
+static long long shared_tokens(limiter_t *limiter, int dir) {
+    long long tokens = -1;
+
+    if (limiter->global[dir].rate) {
+        tokens = limiter->global[dir].tokens / 1000;
+    }
+    if ( limiter->torrent[dir].rate && (tokens < 0 || limiter->torrent[dir].tokens / 1000 < tokens) ) {
+        tokens = limiter->torrent[dir].tokens / 1000;
+    }
+    return tokens;
+}
+
+/**
+ * resume_slot() lets the peer in slot read again if it was held back
+ *
+ * Return: 1 if the peer was dropped, 0 if not
+ **/
+static int resume_slot(bt_args_t *bt_args, int slot) {
+    peer_t *peer = bt_args->peers.peer[slot];
+
+    if ( !(peer->throttled & (1 << LIMIT_DOWN)) ) {
+        peer->throttled = 0;
+        return 0;
+    }
+    // edge-triggered: what is still in the socket is never reported again, so the read resumes here
+    peer->throttled = 0;
+    if ( handle_peer_input(bt_args, peer) < 0 ) {
+        drop_peer(peer, bt_args);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * limit_turn() refills, then shares out the tokens. Held-back readers are resumed starting at
+ * limit_first_slot(), so each turn a different one reads first
+ **/
+void limit_turn(bt_args_t *bt_args) {
+    limiter_t *limiter = &bt_args->limiter;
+    peer_table_t *peers = &bt_args->peers;
+    long long now = now_ms(), tokens;
+    int dir, slot, start;
+
+    limiter->turn++;
+    limiter->throttled = 0;
+
+    for (dir = LIMIT_UP; dir <= LIMIT_DOWN; dir++) {
+        bucket_refill(&limiter->global[dir], now);
+        bucket_refill(&limiter->torrent[dir], now);
+
+        // an even split; what a peer leaves unused is there for everybody next turn
+        if ( (tokens = shared_tokens(limiter, dir)) >= 0 ) {
+            limiter->share[dir] = tokens / (peers->n_peers > 0 ? peers->n_peers : 1);
+            if (limiter->share[dir] < LIMIT_MIN_SHARE) {
+                limiter->share[dir] = LIMIT_MIN_SHARE;
+            }
+        }
+    }
+
+    // a dropped peer's slot takes the last peer; that one is still to come if it sat above start
+    start = limit_first_slot(bt_args);
+    for (slot = start; slot >= 0; slot--) {
+        if ( resume_slot(bt_args, slot) && slot < peers->n_peers && peers->n_peers > start ) {
+            slot++;
+        }
+    }
+    for (slot = peers->n_peers - 1; slot > start; slot--) {
+        resume_slot(bt_args, slot);
+    }
+}
+
+/**
+ * limit_grant() takes the least of every level that limits
+ **/
+size_t limit_grant(bt_args_t *bt_args, peer_t *peer, int dir, size_t want) {
+    limiter_t *limiter = &bt_args->limiter;
+    token_bucket_t *bucket = &peer->bucket[dir];
+    long long avail = (long long) want, tokens;
+
+    if (peer->turn != limiter->turn) {
+        peer->turn = limiter->turn;
+        peer->turn_bytes[LIMIT_UP] = peer->turn_bytes[LIMIT_DOWN] = 0;
+    }
+
+    if ( (tokens = shared_tokens(limiter, dir)) >= 0 ) {
+        if (tokens < avail) {
+            avail = tokens;
+        }
+        if (limiter->share[dir] - peer->turn_bytes[dir] < avail) {
+            avail = limiter->share[dir] - peer->turn_bytes[dir];
+        }
+    }
+
+    if (bucket->rate != limiter->peer_rate[dir]) {
+        bucket_set(bucket, limiter->peer_rate[dir]);
+    }
+    if (bucket->rate) {
+        bucket_refill(bucket, now_ms());
+        if (bucket->tokens / 1000 < avail) {
+            avail = bucket->tokens / 1000;
+        }
+    }
+
+    if (avail <= 0) {
+        peer->throttled |= 1 << dir;
+        limiter->throttled = 1;
+        return 0;
+    }
+    return (size_t) avail;
+}
+
+/**
+ * limit_charge() spends at every level
+ **/
+void limit_charge(bt_args_t *bt_args, peer_t *peer, int dir, size_t n) {
+    limiter_t *limiter = &bt_args->limiter;
+
+    bucket_spend(&limiter->global[dir], n);
+    bucket_spend(&limiter->torrent[dir], n);
+    bucket_spend(&peer->bucket[dir], n);
+    if (peer->turn == limiter->turn) {
+        peer->turn_bytes[dir] += n;
+    }
+}
+
+/**
+ * limit_first_slot() moves on by one slot every turn
+ **/
+int limit_first_slot(bt_args_t *bt_args) {
+    int n_peers = bt_args->peers.n_peers;
+
+    return n_peers > 0 ? (int) (bt_args->limiter.turn % n_peers) : -1;
+}
+
+/**
+ * limit_poll_ms() shortens the wait while somebody is held back
+ **/
+int limit_poll_ms(bt_args_t *bt_args) {
+    return bt_args->limiter.throttled ? LIMIT_TICK_MS : LOOP_TICK_MS;
+}
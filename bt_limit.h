@@ -0,0 +1,84 @@
+#ifndef _BT_LIMIT_H
+#define _BT_LIMIT_H
+
+#include <stddef.h>
+
+#include "bt_lib.h"
+
+/* levels of bandwidth limit, for limit_set() */
+#define LIMIT_GLOBAL 0 // everything this client moves
+#define LIMIT_TORRENT 1    // everything moved for this torrent
+#define LIMIT_PEER 2   // what each peer moves
+
+/* how long (ms) the event loop waits while a peer is held back, instead of LOOP_TICK_MS */
+#define LIMIT_TICK_MS 10
+
+/* least burst of a bucket: a BT_PIECE with its header must fit, or it would never go */
+#define LIMIT_MIN_BURST (2 * BLOCK_SIZE)
+
+/* least a peer may move in one turn when the shared buckets limit, so shares do not shrink to nothing. Under a
+ * low cap the first peers served then take all there is, which is why the walks over the peers start at a
+ * different one every turn (see limit_first_slot()) */
+#define LIMIT_MIN_SHARE 1460
+
+/**
+ * limit_set(bt_args_t *bt_args, int level, int dir, long long rate) -> void
+ *
+ * cap the bytes moved in direction dir (LIMIT_UP or LIMIT_DOWN) at level
+ * (LIMIT_*) to rate bytes per second; 0 lifts the cap. Takes effect at
+ * once, also while peers are transferring. A bucket holds a quarter of a
+ * second's worth of tokens (LIMIT_MIN_BURST at least).
+ **/
+void limit_set(bt_args_t *bt_args, int level, int dir, long long rate);
+
+/**
+ * limit_turn(bt_args_t *bt_args) -> void
+ *
+ * called at the start of every turn of the event loop: refill the
+ * buckets, split what the shared ones hold evenly between the peers, and
+ * let peers whose input was held back read again. Peers whose sockets
+ * fail are dropped.
+ **/
+void limit_turn(bt_args_t *bt_args);
+
+/**
+ * limit_grant(bt_args_t *bt_args, peer_t *peer, int dir, size_t want) -> size_t
+ *
+ * how many of want bytes the peer may move now in direction dir: the
+ * least of what the global, torrent and peer buckets hold and of the
+ * peer's share of this turn. Nothing is spent until limit_charge(). A
+ * peer granted nothing is marked throttled, and the event loop comes back
+ * to it within LIMIT_TICK_MS.
+ *
+ * Return: bytes granted, want if nothing limits
+ **/
+size_t limit_grant(bt_args_t *bt_args, peer_t *peer, int dir, size_t want);
+
+/**
+ * limit_charge(bt_args_t *bt_args, peer_t *peer, int dir, size_t n) -> void
+ *
+ * spend the tokens of n bytes moved
+ **/
+void limit_charge(bt_args_t *bt_args, peer_t *peer, int dir, size_t n);
+
+/**
+ * limit_first_slot(bt_args_t *bt_args) -> int
+ *
+ * where walks over the peer table start in this turn: the walk goes from
+ * this slot down to 0, then from the last slot down to the one above it.
+ * The start moves round the table from turn to turn, so no peer is always
+ * served last when the shared tokens run out.
+ *
+ * Return: the slot, -1 if there are no peers
+ **/
+int limit_first_slot(bt_args_t *bt_args);
+
+/**
+ * limit_poll_ms(bt_args_t *bt_args) -> int
+ *
+ * Return: how long the event loop may wait for sockets: LIMIT_TICK_MS
+ * while a peer is held back, LOOP_TICK_MS otherwise
+ **/
+int limit_poll_ms(bt_args_t *bt_args);
+
+#endif
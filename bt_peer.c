@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "bt_lib.h"
+#include "bt_peer.h"
+
+/**
+ * id_home() picks the home bucket of a peer id; ids are SHA1 digests, so their first bytes are already well mixed
+ **/
+static int id_home(peer_table_t *table, unsigned char *id) {
+    uint32_t h;
+
+    memcpy(&h, id, sizeof(h));
+    return h & (table->id_cap - 1);
+}
+
+/**
+ * id_bucket() finds the bucket of id_index holding slot, -1 if none
+ **/
+static int id_bucket(peer_table_t *table, int slot) {
+    int b;
+
+    for (b = id_home(table, table->peer[slot]->id); table->id_index[b] != 0; b = (b + 1) & (table->id_cap - 1)) {
+        if (table->id_index[b] == slot + 1) {
+            return b;
+        }
+    }
+    return -1;
+}
+
+/**
+ * id_insert() records slot in id_index by linear probing from its home bucket
+ **/
+static void id_insert(peer_table_t *table, int slot) {
+    int b;
+
+    for (b = id_home(table, table->peer[slot]->id); table->id_index[b] != 0; b = (b + 1) & (table->id_cap - 1)) {
+        continue;
+    }
+    table->id_index[b] = slot + 1;
+}
+
+/**
+ * id_delete() empties the bucket holding slot and shifts later entries of its probe run back,
+ * so lookups never need tombstones
+ **/
+static void id_delete(peer_table_t *table, int slot) {
+    int mask = table->id_cap - 1;
+    int hole, b, home;
+
+    if ( (hole = id_bucket(table, slot)) < 0 ) {
+        return;
+    }
+
+    for (b = (hole + 1) & mask; table->id_index[b] != 0; b = (b + 1) & mask) {
+        home = id_home(table, table->peer[table->id_index[b] - 1]->id);
+
+        // the entry in b may fill the hole only if its home bucket does not lie cyclically in (hole, b]
+        if ( (b > hole && (home <= hole || home > b)) || (b < hole && home <= hole && home > b) ) {
+            table->id_index[hole] = table->id_index[b];
+            hole = b;
+        }
+    }
+    table->id_index[hole] = 0;
+}
+
+/**
+ * id_rebuild() resizes id_index to id_cap buckets and re-inserts every peer
+ **/
+static int id_rebuild(peer_table_t *table, int id_cap) {
+    int *id_index;
+    int i;
+
+    if ( (id_index = calloc(id_cap, sizeof(int))) == NULL ) {
+        return -1;
+    }
+
+    free(table->id_index);
+    table->id_index = id_index;
+    table->id_cap = id_cap;
+
+    for (i = 0; i < table->n_peers; i++) {
+        id_insert(table, i);
+    }
+    return 0;
+}
+
+/**
+ * grow_arrays() reallocates every per-peer array to capacity slots
+ **/
+static int grow_arrays(peer_table_t *table, int capacity) {
+    void *p;
+
+#define GROW(field) \
+    if ( (p = realloc(table->field, capacity * sizeof(*table->field))) == NULL ) { \
+        return -1; \
+    } \
+    table->field = p;
+
+    GROW(fd)
+    GROW(flags)
+    GROW(down_rate)
+    GROW(up_rate)
+    GROW(n_requests)
+    GROW(peer)
+
+#undef GROW
+
+    table->capacity = capacity;
+
+    // keep the id index at most half full so probe runs stay short
+    if (table->id_cap < 2 * capacity) {
+        int id_cap = 1;
+        while (id_cap < 2 * capacity) {
+            id_cap <<= 1;
+        }
+        return id_rebuild(table, id_cap);
+    }
+    return 0;
+}
+
+/**
+ * peer_table_init() sets up an empty table
+ **/
+int peer_table_init(peer_table_t *table, int capacity) {
+
+    memset(table, 0x00, sizeof(*table));
+
+    if (capacity < 1) {
+        capacity = INIT_PEER_SLOTS;
+    }
+    return grow_arrays(table, capacity);
+}
+
+/**
+ * peer_table_free() releases the table's arrays
+ **/
+void peer_table_free(peer_table_t *table) {
+    free(table->fd);
+    free(table->flags);
+    free(table->down_rate);
+    free(table->up_rate);
+    free(table->n_requests);
+    free(table->peer);
+    free(table->fd_slot);
+    free(table->id_index);
+    memset(table, 0x00, sizeof(*table));
+}
+
+/**
+ * peer_table_insert() appends a peer, doubling the table when it is full
+ **/
+int peer_table_insert(peer_table_t *table, peer_t *peer) {
+    int slot;
+
+    if ( peer_slot_by_id(table, peer->id) >= 0 ) {
+        return -1;  // already connected to this peer
+    }
+
+    if ( table->n_peers == table->capacity && grow_arrays(table, 2 * table->capacity) < 0 ) {
+        fprintf(stderr, "ERROR: Could not grow the peer table past %d peers.\n", table->capacity);
+        return -1;
+    }
+
+    slot = table->n_peers++;
+    table->fd[slot] = -1;
+    table->flags[slot] = PEER_AM_CHOKING | PEER_CHOKING;
+    table->down_rate[slot] = 0;
+    table->up_rate[slot] = 0;
+    table->n_requests[slot] = 0;
+    table->peer[slot] = peer;
+    peer->slot = slot;
+
+    id_insert(table, slot);
+    return slot;
+}
+
+/**
+ * peer_table_remove() drops a slot and keeps the live slots dense by moving the last peer into it
+ **/
+void peer_table_remove(peer_table_t *table, int slot) {
+    int last = table->n_peers - 1;
+    int b;
+
+    id_delete(table, slot);
+    if (table->fd[slot] >= 0) {
+        table->fd_slot[table->fd[slot]] = -1;
+    }
+    table->peer[slot]->slot = -1;
+
+    if (slot != last) {
+        b = id_bucket(table, last);
+
+        table->fd[slot] = table->fd[last];
+        table->flags[slot] = table->flags[last];
+        table->down_rate[slot] = table->down_rate[last];
+        table->up_rate[slot] = table->up_rate[last];
+        table->n_requests[slot] = table->n_requests[last];
+        table->peer[slot] = table->peer[last];
+        table->peer[slot]->slot = slot;
+
+        // re-point both indexes at the moved peer's new slot
+        if (table->fd[slot] >= 0) {
+            table->fd_slot[table->fd[slot]] = slot;
+        }
+        table->id_index[b] = slot + 1;
+    }
+
+    table->n_peers--;
+}
+
+/**
+ * peer_table_set_fd() records a peer's socket, growing the fd index to cover it; -1 detaches the old one
+ **/
+int peer_table_set_fd(peer_table_t *table, int slot, int fd) {
+    int *fd_slot;
+    int fd_cap, i;
+
+    if (fd >= table->fd_cap) {
+        fd_cap = table->fd_cap ? table->fd_cap : 64;
+        while (fd_cap <= fd) {
+            fd_cap <<= 1;
+        }
+        if ( (fd_slot = realloc(table->fd_slot, fd_cap * sizeof(int))) == NULL ) {
+            return -1;
+        }
+        for (i = table->fd_cap; i < fd_cap; i++) {
+            fd_slot[i] = -1;
+        }
+        table->fd_slot = fd_slot;
+        table->fd_cap = fd_cap;
+    }
+
+    if (table->fd[slot] >= 0) {
+        table->fd_slot[table->fd[slot]] = -1;
+    }
+    table->fd[slot] = fd;
+    if (fd >= 0) {
+        table->fd_slot[fd] = slot;
+    }
+    return 0;
+}
+
+/**
+ * peer_slot_by_fd() looks a socket up in the fd index
+ **/
+int peer_slot_by_fd(peer_table_t *table, int fd) {
+    if (fd < 0 || fd >= table->fd_cap) {
+        return -1;
+    }
+    return table->fd_slot[fd];
+}
+
+/**
+ * peer_slot_by_id() looks a peer id up in the id index
+ **/
+int peer_slot_by_id(peer_table_t *table, unsigned char *id) {
+    int b, slot;
+
+    for (b = id_home(table, id); table->id_index[b] != 0; b = (b + 1) & (table->id_cap - 1)) {
+        slot = table->id_index[b] - 1;
+        if ( memcmp(table->peer[slot]->id, id, ID_SIZE) == 0 ) {
+            return slot;
+        }
+    }
+    return -1;
+}
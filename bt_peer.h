@@ -0,0 +1,65 @@
+#ifndef _BT_PEER_H
+#define _BT_PEER_H
+
+#include "bt_lib.h"
+
+/**
+ * peer_table_init(peer_table_t *table, int capacity) -> int
+ *
+ * allocate the per-peer arrays and lookup indexes of an empty peer table
+ * with room for capacity peers; the table grows on its own afterwards
+ *
+ * Return: 0 on success, -1 on allocation failure
+ **/
+int peer_table_init(peer_table_t *table, int capacity);
+
+/**
+ * peer_table_free(peer_table_t *table) -> void
+ *
+ * release the table's arrays (not the peer_t structures it points to)
+ **/
+void peer_table_free(peer_table_t *table);
+
+/**
+ * peer_table_insert(peer_table_t *table, peer_t *peer) -> int
+ *
+ * append peer to the table, choked and not interested both ways and with
+ * no socket yet; peer->slot is set to its new index
+ *
+ * Return: the peer's slot, -1 if a peer with the same id is already in the
+ * table or the table could not grow
+ **/
+int peer_table_insert(peer_table_t *table, peer_t *peer);
+
+/**
+ * peer_table_remove(peer_table_t *table, int slot) -> void
+ *
+ * remove the peer in slot; the last peer moves into the freed slot
+ **/
+void peer_table_remove(peer_table_t *table, int slot);
+
+/**
+ * peer_table_set_fd(peer_table_t *table, int slot, int fd) -> int
+ *
+ * attach socket fd to the peer in slot so it can be found by peer_slot_by_fd();
+ * an fd of -1 detaches the peer's socket (which the caller closes)
+ *
+ * Return: 0 on success, -1 if the fd index could not grow
+ **/
+int peer_table_set_fd(peer_table_t *table, int slot, int fd);
+
+/**
+ * peer_slot_by_fd(peer_table_t *table, int fd) -> int
+ *
+ * Return: slot of the peer owning socket fd, -1 if none
+ **/
+int peer_slot_by_fd(peer_table_t *table, int fd);
+
+/**
+ * peer_slot_by_id(peer_table_t *table, unsigned char *id) -> int
+ *
+ * Return: slot of the peer whose ID_SIZE-byte id is id, -1 if none
+ **/
+int peer_slot_by_id(peer_table_t *table, unsigned char *id);
+
+#endif
@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bt_lib.h"
+#include "bt_picker.h"
+#include "bt_bitfield.h"
+
+/**
+ * bucket_of() is the bucket piece belongs in: availability + 1 while it is wanted, 0 once it is not
+ **/
+static int bucket_of(piece_picker_t *picker, int piece) {
+    return (picker->state[piece] == PIECE_WANTED) ? picker->availability[piece] + 1 : 0;
+}
+
+/**
+ * swap_order() exchanges two entries of order[] and keeps pos[] in step
+ **/
+static void swap_order(piece_picker_t *picker, int i, int j) {
+    int a = picker->order[i], b = picker->order[j];
+
+    picker->order[i] = b;
+    picker->order[j] = a;
+    picker->pos[b] = i;
+    picker->pos[a] = j;
+}
+
+/**
+ * move_up() moves piece from its bucket b into b + 1: it swaps with the last piece of b, and b shrinks by one
+ * at the end (which is where b + 1 begins)
+ **/
+static void move_up(piece_picker_t *picker, int piece, int b) {
+    int *bucket_start;
+
+    if (b + 1 == picker->n_buckets) {   // availability never got this high before: open an empty bucket
+        if ( (bucket_start = realloc(picker->bucket_start, (picker->n_buckets + 2) * sizeof(int))) == NULL ) {
+            fprintf(stderr, "ERROR: Could not grow the piece picker.\n");
+            exit(1);
+        }
+        picker->bucket_start = bucket_start;
+        picker->bucket_start[picker->n_buckets + 1] = picker->num_pieces;
+        picker->n_buckets++;
+    }
+
+    swap_order(picker, picker->pos[piece], picker->bucket_start[b + 1] - 1);
+    picker->bucket_start[b + 1]--;
+}
+
+/**
+ * move_down() moves piece from its bucket b into b - 1: it swaps with the first piece of b, and b then begins
+ * one entry later
+ **/
+static void move_down(piece_picker_t *picker, int piece, int b) {
+    swap_order(picker, picker->pos[piece], picker->bucket_start[b]);
+    picker->bucket_start[b]++;
+}
+
+/**
+ * shuffle() puts order[from, to) in random order (Fisher-Yates)
+ **/
+static void shuffle(piece_picker_t *picker, int from, int to) {
+    int i;
+
+    for (i = to - 1; i > from; i--) {
+        swap_order(picker, i, from + rand() % (i - from + 1));
+    }
+}
+
+/**
+ * picker_init() lays out bucket 0 (pieces we have) followed by bucket 1 (pieces nobody has yet)
+ **/
+int picker_init(piece_picker_t *picker, int num_pieces, bt_bitfield_t *have) {
+    int i, n_done = 0, k_done = 0, k_wanted = 0;
+
+    memset(picker, 0x00, sizeof(*picker));
+    picker->num_pieces = num_pieces;
+    picker->availability = calloc(num_pieces + 1, sizeof(int));
+    picker->state = calloc(num_pieces + 1, sizeof(unsigned char));
+    picker->order = malloc((num_pieces + 1) * sizeof(int));
+    picker->pos = malloc((num_pieces + 1) * sizeof(int));
+    picker->bucket_start = malloc(3 * sizeof(int));
+    if (!picker->availability || !picker->state || !picker->order || !picker->pos || !picker->bucket_start) {
+        picker_free(picker);
+        return -1;
+    }
+
+    for (i = 0; i < num_pieces; i++) {
+        if ( have && bitfield_test(have, i) ) {
+            picker->state[i] = PIECE_DONE;
+            n_done++;
+        }
+    }
+
+    for (i = 0; i < num_pieces; i++) { // pieces we have first, then the ones we want
+        picker->order[(picker->state[i] == PIECE_DONE) ? k_done++ : n_done + k_wanted++] = i;
+    }
+    for (i = 0; i < num_pieces; i++) {
+        picker->pos[picker->order[i]] = i;
+    }
+
+    picker->n_buckets = 2;
+    picker->bucket_start[0] = 0;
+    picker->bucket_start[1] = n_done;
+    picker->bucket_start[2] = num_pieces;
+    picker->n_wanted = num_pieces - n_done;
+
+    // random tie-breaking: equally available pieces are tried in a different order by every client
+    shuffle(picker, 0, n_done);
+    shuffle(picker, n_done, num_pieces);
+    return 0;
+}
+
+/**
+ * picker_free() releases the picker's arrays
+ **/
+void picker_free(piece_picker_t *picker) {
+    free(picker->availability);
+    free(picker->state);
+    free(picker->order);
+    free(picker->pos);
+    free(picker->bucket_start);
+    memset(picker, 0x00, sizeof(*picker));
+}
+
+/**
+ * picker_inc() bumps a piece's availability and, unless we have it, its bucket
+ **/
+void picker_inc(piece_picker_t *picker, int piece) {
+    if (picker->state[piece] == PIECE_WANTED) {
+        move_up(picker, piece, bucket_of(picker, piece));
+    }
+    picker->availability[piece]++;
+}
+
+/**
+ * picker_dec() lowers a piece's availability and, unless we have it, its bucket
+ **/
+void picker_dec(piece_picker_t *picker, int piece) {
+    if (picker->availability[piece] == 0) {
+        return;
+    }
+    if (picker->state[piece] == PIECE_WANTED) {
+        move_down(picker, piece, bucket_of(picker, piece));
+    }
+    picker->availability[piece]--;
+}
+
+/**
+ * picker_add_bitfield() counts every piece a peer announced
+ **/
+void picker_add_bitfield(piece_picker_t *picker, bt_bitfield_t *have) {
+    long piece = -1;
+
+    while ( (piece = bitfield_find_first(have, piece + 1)) >= 0 ) {
+        picker_inc(picker, piece);
+    }
+}
+
+/**
+ * picker_remove_bitfield() forgets every piece a departed peer had
+ **/
+void picker_remove_bitfield(piece_picker_t *picker, bt_bitfield_t *have) {
+    long piece = -1;
+
+    while ( (piece = bitfield_find_first(have, piece + 1)) >= 0 ) {
+        picker_dec(picker, piece);
+    }
+}
+
+/**
+ * picker_set_state() changes a piece's state, walking it to bucket 0 when it stops being wanted (started or done)
+ * and back up when it is wanted again (a failed hash check or write); each step is one swap
+ **/
+void picker_set_state(piece_picker_t *picker, int piece, int state) {
+    int b;
+
+    if (state != PIECE_WANTED && picker->state[piece] == PIECE_WANTED) {
+        for (b = bucket_of(picker, piece); b > 0; b--) {
+            move_down(picker, piece, b);
+        }
+    } else if (state == PIECE_WANTED && picker->state[piece] != PIECE_WANTED) {
+        for (b = 0; b < picker->availability[piece] + 1; b++) {
+            move_up(picker, piece, b);
+        }
+    }
+    picker->n_wanted += (state == PIECE_WANTED) - (picker->state[piece] == PIECE_WANTED);
+    picker->state[piece] = state;
+}
+
+/**
+ * picker_pick() walks the buckets from the rarest available pieces (bucket 2, one peer has them) upwards and
+ * returns the first piece the peer has; each bucket is entered at a random offset. Every piece in them is wanted,
+ * so only pieces the peer lacks are passed over
+ **/
+int picker_pick(piece_picker_t *picker, bt_bitfield_t *peer_have) {
+    int b, start, len, offset, k, piece;
+
+    for (b = 2; b < picker->n_buckets; b++) {
+        start = picker->bucket_start[b];
+        len = picker->bucket_start[b + 1] - start;
+        if (len == 0) {
+            continue;
+        }
+
+        offset = rand() % len;
+        for (k = 0; k < len; k++) {
+            piece = picker->order[start + (offset + k) % len];
+            if ( bitfield_test(peer_have, piece) ) {
+                return piece;
+            }
+        }
+    }
+    return -1;
+}
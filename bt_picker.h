@@ -0,0 +1,69 @@
+#ifndef _BT_PICKER_H
+#define _BT_PICKER_H
+
+#include "bt_lib.h"
+
+/**
+ * picker_init(piece_picker_t *picker, int num_pieces, bt_bitfield_t *have) -> int
+ *
+ * set up a picker for num_pieces pieces, none of them available yet; the
+ * pieces set in have (may be NULL) start out PIECE_DONE. Pieces of equal
+ * availability are shuffled so peers do not all go for the same one.
+ *
+ * Return: 0 on success, -1 on allocation failure
+ **/
+int picker_init(piece_picker_t *picker, int num_pieces, bt_bitfield_t *have);
+
+/**
+ * picker_free(piece_picker_t *picker) -> void
+ **/
+void picker_free(piece_picker_t *picker);
+
+/**
+ * picker_inc(piece_picker_t *picker, int piece) -> void
+ *
+ * one more peer has piece (a HAVE message, or a bit in a BITFIELD)
+ **/
+void picker_inc(piece_picker_t *picker, int piece);
+
+/**
+ * picker_dec(piece_picker_t *picker, int piece) -> void
+ *
+ * one peer fewer has piece (the peer disconnected)
+ **/
+void picker_dec(piece_picker_t *picker, int piece);
+
+/**
+ * picker_add_bitfield(piece_picker_t *picker, bt_bitfield_t *have) -> void
+ *
+ * a peer announced every piece in have
+ **/
+void picker_add_bitfield(piece_picker_t *picker, bt_bitfield_t *have);
+
+/**
+ * picker_remove_bitfield(piece_picker_t *picker, bt_bitfield_t *have) -> void
+ *
+ * a peer that had every piece in have went away
+ **/
+void picker_remove_bitfield(piece_picker_t *picker, bt_bitfield_t *have);
+
+/**
+ * picker_set_state(piece_picker_t *picker, int piece, int state) -> void
+ *
+ * move piece to PIECE_WANTED, PIECE_ACTIVE or PIECE_DONE; a piece that
+ * fails its hash check goes back to PIECE_WANTED
+ **/
+void picker_set_state(piece_picker_t *picker, int piece, int state);
+
+/**
+ * picker_pick(piece_picker_t *picker, bt_bitfield_t *peer_have) -> int
+ *
+ * choose the rarest PIECE_WANTED piece in peer_have, breaking ties at
+ * random. The piece's state is left alone; the caller marks it
+ * PIECE_ACTIVE once it requests blocks of it.
+ *
+ * Return: the piece, -1 if the peer has nothing we still want
+ **/
+int picker_pick(piece_picker_t *picker, bt_bitfield_t *peer_have);
+
+#endif
@@ -0,0 +1,608 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bt_lib.h"
+#include "bt_request.h"
+#include "bt_picker.h"
+#include "bt_bitfield.h"
+#include "bt_hash.h"
+#include "bt_io.h"
+#include "bt_assembly.h"
+#include "bt_disk.h"
+
+/**
+ * find_active() looks up the download state of piece index
+ *
+ * Return: the active piece, NULL if index is not being downloaded
+ **/
+static active_piece_t * find_active(download_t *download, int index) {
+    int i;
+
+    for (i = 0; i < download->n_active; i++) {
+        if (download->active[i].index == index) {
+            return &download->active[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * start_piece() adds piece index to the active pieces, every block of it free, and tells the picker
+ *
+ * Return: the active piece, NULL on allocation failure
+ **/
+static active_piece_t * start_piece(bt_args_t *bt_args, int index) {
+    download_t *download = &bt_args->download;
+    active_piece_t *active;
+    int n_blocks = (piece_size(bt_args->bt_info, index) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    if (download->n_active == download->cap_active) {
+        int cap = download->cap_active ? 2 * download->cap_active : 8;
+
+        if ( (active = realloc(download->active, cap * sizeof(active_piece_t))) == NULL ) {
+            return NULL;
+        }
+        download->active = active;
+        download->cap_active = cap;
+    }
+
+    active = &download->active[download->n_active];
+    if ( (active->blocks = slab_set_alloc(&bt_args->bufs, n_blocks)) == NULL ) {
+        return NULL;
+    }
+    memset(active->blocks, BLOCK_FREE, n_blocks);
+    sha1_init(&active->sha);
+    assembly_get(bt_args, active);  // without a buffer, blocks are saved to the payload as they come
+    active->index = index;
+    active->n_blocks = n_blocks;
+    active->n_free = n_blocks;
+    active->n_received = 0;
+    active->n_hashed = 0;
+    active->n_writing = 0;
+    active->write_failed = 0;
+    download->n_active++;
+
+    picker_set_state(&bt_args->picker, index, PIECE_ACTIVE);
+    return active;
+}
+
+/**
+ * finish_piece() removes an active piece (the last one moves into its place) and sets its picker state
+ **/
+static void finish_piece(bt_args_t *bt_args, active_piece_t *active, int state) {
+    download_t *download = &bt_args->download;
+
+    picker_set_state(&bt_args->picker, active->index, state);
+    assembly_put(download, active);
+    slab_set_free(&bt_args->bufs, active->blocks, active->n_blocks);
+    *active = download->active[--download->n_active];
+}
+
+/**
+ * is_pending() tells whether the peer has already been asked for the block at offset begin of piece index
+ **/
+static int is_pending(bt_args_t *bt_args, peer_t *peer, int index, int begin) {
+    int i;
+
+    for (i = 0; i < bt_args->peers.n_requests[peer->slot]; i++) {
+        if (peer->pending[i].request.index == index && peer->pending[i].request.begin == begin) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * in_endgame() checks whether every missing block is requested: no piece is left to start and no active piece
+ * has a free block. The download enters endgame the first time it is, and leaves it if a piece comes back
+ * (a failed hash check or write)
+ *
+ * Return: 1 in endgame, 0 if not
+ **/
+static int in_endgame(bt_args_t *bt_args) {
+    download_t *download = &bt_args->download;
+    int i;
+
+    if (bt_args->picker.n_wanted > 0 || download->n_active == 0) {
+        download->endgame = 0;
+        return 0;
+    }
+    for (i = 0; i < download->n_active; i++) {
+        if (download->active[i].n_free > 0) {
+            download->endgame = 0;
+            return 0;
+        }
+    }
+    if (!download->endgame && bt_args->verbose) {
+        printf("Endgame: the last %d pieces are requested from every peer that has them.\n", download->n_active);
+    }
+    download->endgame = 1;
+    return 1;
+}
+
+/**
+ * endgame_block() chooses a requested block the peer has not been asked for, so the last blocks come from
+ * whichever peer is quickest
+ *
+ * Return: 0 with *active and *block set, -1 if the peer has been asked for all it can give
+ **/
+static int endgame_block(bt_args_t *bt_args, peer_t *peer, active_piece_t **active, int *block) {
+    download_t *download = &bt_args->download;
+    int i;
+
+    for (i = 0; i < download->n_active; i++) {
+        *active = &download->active[i];
+        if ( !bitfield_test(&peer->have, (*active)->index) ) {
+            continue;
+        }
+        for (*block = 0; *block < (*active)->n_blocks; (*block)++) {
+            if ( (*active)->blocks[*block] == BLOCK_REQUESTED &&
+                    !is_pending(bt_args, peer, (*active)->index, *block * BLOCK_SIZE) ) {
+                return 0;
+            }
+        }
+    }
+    return -1;
+}
+
+/**
+ * next_block() chooses the block the peer should be asked for next: the first free block of an active piece the
+ * peer has, else the first block of a piece the picker starts for it, else, in endgame, a block already asked
+ * of someone else
+ *
+ * Return: 0 with *active and *block set, -1 if the peer has nothing we want
+ **/
+static int next_block(bt_args_t *bt_args, peer_t *peer, active_piece_t **active, int *block) {
+    download_t *download = &bt_args->download;
+    int i, index;
+
+    for (i = 0; i < download->n_active; i++) {
+        *active = &download->active[i];
+        if ( (*active)->n_free == 0 || !bitfield_test(&peer->have, (*active)->index) ) {
+            continue;
+        }
+        // a block freed by a peer that timed out may still be out with this one, from endgame
+        for (*block = 0; *block < (*active)->n_blocks; (*block)++) {
+            if ( (*active)->blocks[*block] == BLOCK_FREE &&
+                    !is_pending(bt_args, peer, (*active)->index, *block * BLOCK_SIZE) ) {
+                return 0;
+            }
+        }
+    }
+
+    if ( (index = picker_pick(&bt_args->picker, &peer->have)) < 0 ) {
+        return in_endgame(bt_args) ? endgame_block(bt_args, peer, active, block) : -1;
+    }
+    if ( (*active = start_piece(bt_args, index)) == NULL ) {
+        return -1;
+    }
+    *block = 0;
+    return 0;
+}
+
+/**
+ * request_blocks() sends requests until the pipeline is full, the socket is, or the peer has nothing we want
+ **/
+int request_blocks(bt_args_t *bt_args, peer_t *peer) {
+    peer_table_t *peers = &bt_args->peers;
+    active_piece_t *active;
+    bt_pending_t *pending;
+    bt_msg_t msg;
+    int block, n_sent = 0, ret;
+
+    if ( peer->have.bits == NULL || (peers->flags[peer->slot] & PEER_CHOKING) || peers->fd[peer->slot] < 0 ) {
+        return 0;
+    }
+
+    while ( peers->n_requests[peer->slot] < peer->queue_depth ) {
+        if ( next_block(bt_args, peer, &active, &block) < 0 ) {
+            break;
+        }
+
+        pending = &peer->pending[peers->n_requests[peer->slot]];
+        pending->request.index = active->index;
+        pending->request.begin = block * BLOCK_SIZE;
+        pending->request.length = piece_size(bt_args->bt_info, active->index) - pending->request.begin;
+        if (pending->request.length > BLOCK_SIZE) {
+            pending->request.length = BLOCK_SIZE;
+        }
+
+        msg.bt_type = BT_REQUEST;
+        msg.payload.request = pending->request;
+        if ( (ret = send_to_peer(bt_args, peer, &msg)) <= 0 ) {
+            return (ret < 0) ? -1 : n_sent; // send buffer full: the rest waits for the next tick
+        }
+
+        pending->sent_ms = now_ms();
+        if (active->blocks[block] == BLOCK_FREE) {  // in endgame the block may be out with other peers already
+            active->blocks[block] = BLOCK_REQUESTED;
+            active->n_free--;
+        }
+        peers->n_requests[peer->slot]++;
+        n_sent++;
+    }
+
+    return n_sent;
+}
+
+/**
+ * retire_request() removes entry i of the peer's outstanding requests, keeping the rest in the order they were sent
+ **/
+static void retire_request(bt_args_t *bt_args, peer_t *peer, int i) {
+    int *n_requests = &bt_args->peers.n_requests[peer->slot];
+
+    memmove(&peer->pending[i], &peer->pending[i + 1], (*n_requests - i - 1) * sizeof(bt_pending_t));
+    (*n_requests)--;
+}
+
+/**
+ * free_block() hands a block the peer was asked for back so the next peer with room in its pipeline asks for
+ * it; a block still out with another peer (endgame asks several) stays requested
+ **/
+static void free_block(bt_args_t *bt_args, peer_t *peer, bt_request_t *request) {
+    active_piece_t *active = find_active(&bt_args->download, request->index);
+    int block = request->begin / BLOCK_SIZE;
+    int slot;
+
+    if ( active == NULL || active->blocks[block] != BLOCK_REQUESTED ) {
+        return;
+    }
+    for (slot = 0; slot < bt_args->peers.n_peers; slot++) {
+        if ( bt_args->peers.peer[slot] != peer &&
+                is_pending(bt_args, bt_args->peers.peer[slot], request->index, request->begin) ) {
+            return;
+        }
+    }
+    active->blocks[block] = BLOCK_FREE;
+    active->n_free++;
+}
+
+/**
+ * cancel_duplicates() withdraws the requests other peers still have for a block that just came in: each is sent
+ * a BT_CANCEL and the request is retired, so its pipeline slot goes to a block still missing. A copy already on
+ * the wire arrives anyway and counts as wasted
+ **/
+static void cancel_duplicates(bt_args_t *bt_args, peer_t *from, bt_request_t *block) {
+    peer_table_t *peers = &bt_args->peers;
+    peer_t *peer;
+    bt_msg_t msg;
+    int slot, i;
+
+    for (slot = 0; slot < peers->n_peers; slot++) {
+        if ( (peer = peers->peer[slot]) == from ) {
+            continue;
+        }
+        for (i = 0; i < peers->n_requests[slot]; i++) {
+            if ( peer->pending[i].request.index == block->index && peer->pending[i].request.begin == block->begin ) {
+                msg.bt_type = BT_CANCEL;
+                msg.payload.cancel = peer->pending[i].request;
+                send_to_peer(bt_args, peer, &msg); // a full send buffer only means the copy is not stopped
+                retire_request(bt_args, peer, i);
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * hash_blocks() feeds the piece's hash every block from the front that is in, stopping at the first gap. The
+ * blocks are read back from the assembly buffer (or, for a piece without one, from the payload mapping once its
+ * writes have landed) right after they came in, or when the gap before them fills; either way they are still in
+ * cache
+ *
+ * Return: 0 on success, -1 if a block cannot be hashed
+ **/
+static int hash_blocks(bt_args_t *bt_args, active_piece_t *active) {
+    int begin, len, size = piece_size(bt_args->bt_info, active->index);
+    unsigned char *view;
+
+    while ( active->n_hashed < active->n_blocks && active->blocks[active->n_hashed] == BLOCK_RECEIVED ) {
+        begin = active->n_hashed * BLOCK_SIZE;
+        len = (size - begin < BLOCK_SIZE) ? size - begin : BLOCK_SIZE;
+        view = active->buf ? active->buf + begin : store_view(&bt_args->store, bt_args->bt_info, active->index, begin, len);
+        if (view == NULL) {
+            return -1;
+        }
+        sha1_update(&active->sha, view, len);
+        active->n_hashed++;
+    }
+    return 0;
+}
+
+/**
+ * piece_written() is called on the event loop once a verified piece is on disk: only now is it ours to announce.
+ * A piece that could not be written is downloaded again
+ **/
+static void piece_written(bt_args_t *bt_args, disk_op_t *op) {
+    int index = op->offset / bt_args->bt_info->piece_length;
+
+    assembly_return(&bt_args->download, op->buf);
+    if (op->result < 0) {
+        fprintf(stderr, "ERROR: Could not write piece %d: %s; downloading it again.\n", index, strerror(-op->result));
+        picker_set_state(&bt_args->picker, index, PIECE_WANTED);
+        return;
+    }
+
+    bitfield_set(bt_args->bitfield, index);
+    if (bt_args->verbose) {
+        printf("Piece %d downloaded and verified.\n", index);
+    }
+    announce_piece(bt_args, index);
+}
+
+/**
+ * piece_check() hashes what it can of the piece and, once every block is in and hashed, checks the digest and
+ * writes the piece out. A piece with writes in flight is left alone: piece_part_written() comes back to it
+ *
+ * Return: 1 if the piece is valid and now in the bitfield, 0 otherwise
+ **/
+static int piece_check(bt_args_t *bt_args, active_piece_t *active) {
+    unsigned char digest[SHA1_DIGEST_LEN];
+    int hashed;
+
+    if (active->n_writing > 0) {
+        return 0;
+    }
+    if (active->write_failed) {
+        fprintf(stderr, "ERROR: Could not write piece %d, downloading it again.\n", active->index);
+        finish_piece(bt_args, active, PIECE_WANTED);
+        return 0;
+    }
+
+    // the front of the piece extends the hash up to the first gap; blocks past it wait their turn
+    hashed = hash_blocks(bt_args, active);
+    if (hashed == 0 && active->n_received < active->n_blocks) {
+        return 0;
+    }
+
+    // last block in, so every block is hashed: the piece stands or falls by its digest
+    if (hashed == 0) {
+        sha1_final(&active->sha, digest);
+    }
+    if ( hashed < 0 || !digest_matches(bt_args->bt_info, active->index, digest) ) {
+        fprintf(stderr, "ERROR: Piece %d failed its hash check, downloading it again.\n", active->index);
+        finish_piece(bt_args, active, PIECE_WANTED);    // an assembled piece never reached the disk
+        return 0;
+    }
+
+    // a verified piece assembled in memory goes to the payload in one write, in the background if the disk
+    // backend takes it; the buffer is the write's until piece_written(). Only without a backend (or memory for
+    // the operation) is it written in place. A piece without a buffer is on disk already
+    if ( active->buf && disk_submit(bt_args, DISK_WRITE, bt_args->store.fd, active->buf,
+            piece_size(bt_args->bt_info, active->index), (off_t) active->index * bt_args->bt_info->piece_length,
+            piece_written, NULL) == 0 ) {
+        active->buf = NULL;
+        finish_piece(bt_args, active, PIECE_DONE);
+        return 0;
+    }
+    if ( active->buf && store_write(&bt_args->store, bt_args->bt_info, active->index, 0,
+            active->buf, piece_size(bt_args->bt_info, active->index)) < 0 ) {
+        finish_piece(bt_args, active, PIECE_WANTED);
+        return 0;
+    }
+    bitfield_set(bt_args->bitfield, active->index);
+    if (bt_args->verbose) {
+        printf("Piece %d downloaded and verified.\n", active->index);
+    }
+    finish_piece(bt_args, active, PIECE_DONE);
+    return 1;
+}
+
+/**
+ * piece_part_written() settles one write; a piece with writes in flight is never finished, so the active piece
+ * found is the one that was written
+ **/
+void piece_part_written(bt_args_t *bt_args, int index, long result) {
+    active_piece_t *active = find_active(&bt_args->download, index);
+
+    if (active == NULL) {
+        return;
+    }
+    active->n_writing--;
+    if (result < 0) {
+        active->write_failed = 1;
+    }
+    if ( piece_check(bt_args, active) == 1 ) {
+        announce_piece(bt_args, index);
+    }
+}
+
+/**
+ * block_written() gives back the copy a block was written from
+ **/
+static void block_written(bt_args_t *bt_args, disk_op_t *op) {
+    slab_set_free(&bt_args->bufs, op->buf, op->length);
+    piece_part_written(bt_args, op->offset / bt_args->bt_info->piece_length, op->result);
+}
+
+/**
+ * save_block() writes a block of a piece without an assembly buffer to the payload: in the background, from a
+ * copy (the receive buffer is reused as soon as we return), or in place if there is no disk backend
+ *
+ * Return: 0 on success, -1 if the block cannot be saved
+ **/
+static int save_block(bt_args_t *bt_args, active_piece_t *active, bt_request_t *piece, unsigned char *data) {
+    unsigned char *copy;
+
+    if ( bt_args->disk && bt_args->store.writable && (copy = slab_set_alloc(&bt_args->bufs, piece->length)) ) {
+        memcpy(copy, data, piece->length);
+        if ( disk_submit(bt_args, DISK_WRITE, bt_args->store.fd, copy, piece->length,
+                (off_t) piece->index * bt_args->bt_info->piece_length + piece->begin, block_written, NULL) == 0 ) {
+            active->n_writing++;
+            return 0;
+        }
+        slab_set_free(&bt_args->bufs, copy, piece->length);
+    }
+    return save_piece(bt_args, piece, data);
+}
+
+/**
+ * block_received() matches the block with a request, saves it and checks its piece once complete
+ **/
+int block_received(bt_args_t *bt_args, peer_t *peer, bt_request_t *piece, unsigned char *data) {
+    active_piece_t *active;
+    int i, block, sample;
+    int n_requests = bt_args->peers.n_requests[peer->slot];
+
+    // retire the request it answers; usually the oldest, blocks come back in the order they were asked for
+    for (i = 0; i < n_requests; i++) {
+        if ( peer->pending[i].request.index == piece->index && peer->pending[i].request.begin == piece->begin
+                && peer->pending[i].request.length == piece->length ) {
+            sample = (int) (now_ms() - peer->pending[i].sent_ms);
+            peer->srtt_ms = peer->srtt_ms ? peer->srtt_ms + (sample - peer->srtt_ms) / 8 : sample;
+            if (peer->min_rtt_ms == 0 || sample < peer->min_rtt_ms) {
+                peer->min_rtt_ms = sample ? sample : 1;
+            }
+            retire_request(bt_args, peer, i);
+            break;
+        }
+    }
+    peer->down_bytes += piece->length;
+
+    // a block that timed out with this peer is still welcome as long as nobody else delivered it first
+    if ( (active = find_active(&bt_args->download, piece->index)) == NULL || piece->begin < 0 ||
+            piece->begin % BLOCK_SIZE != 0 ) {
+        bt_args->download.wasted_bytes += piece->length;
+        return -1;
+    }
+    block = piece->begin / BLOCK_SIZE;
+    if ( block >= active->n_blocks || active->blocks[block] == BLOCK_RECEIVED ) {
+        bt_args->download.wasted_bytes += piece->length;
+        return -1;
+    }
+    if ( piece->length <= 0 || (long long) piece->begin + piece->length > piece_size(bt_args->bt_info, piece->index) ) {
+        bt_args->download.wasted_bytes += piece->length > 0 ? piece->length : 0;
+        return -1;  // would not fit in the piece
+    }
+    if ( piece->length != BLOCK_SIZE &&
+            (block != active->n_blocks - 1 || piece->begin + piece->length != piece_size(bt_args->bt_info, piece->index)) ) {
+        bt_args->download.wasted_bytes += piece->length;
+        return -1;  // not the block we ask for at that offset
+    }
+    if (active->buf) {
+        memcpy(active->buf + piece->begin, data, piece->length);
+    } else if ( save_block(bt_args, active, piece, data) < 0 ) {
+        return -1;
+    }
+
+    if (active->blocks[block] == BLOCK_FREE) {
+        active->n_free--;
+    }
+    active->blocks[block] = BLOCK_RECEIVED;
+    active->n_received++;
+
+    // in endgame the block may be out with other peers too: stop them sending it
+    if (bt_args->download.endgame) {
+        cancel_duplicates(bt_args, peer, piece);
+    }
+
+    return piece_check(bt_args, active);
+}
+
+/**
+ * release_requests() frees the blocks of every outstanding request
+ **/
+void release_requests(bt_args_t *bt_args, peer_t *peer) {
+    int i, *n_requests = &bt_args->peers.n_requests[peer->slot];
+
+    for (i = 0; i < *n_requests; i++) {
+        free_block(bt_args, peer, &peer->pending[i].request);
+    }
+    *n_requests = 0;
+}
+
+/**
+ * sample_rate() folds the bytes received and sent since the last sample into the peer's rates (moving averages,
+ * each sample weighing a quarter; the choker ranks peers by them) and sizes its
+ * pipeline to the bandwidth-delay product: rate * min_rtt bytes are on the wire at any time, half as much again
+ * covers jitter (and lets a pipeline that is the bottleneck grow by half each sample)
+ **/
+static void sample_rate(bt_args_t *bt_args, peer_t *peer, long long elapsed_ms) {
+    unsigned int *rate = &bt_args->peers.down_rate[peer->slot];
+    unsigned int *up_rate = &bt_args->peers.up_rate[peer->slot];
+    long long bdp;  // blocks in flight on the link
+
+    *rate = (3 * (long long) *rate + peer->down_bytes * 1000LL / elapsed_ms) / 4;
+    peer->down_bytes = 0;
+    *up_rate = (3 * (long long) *up_rate + peer->up_bytes * 1000LL / elapsed_ms) / 4;
+    peer->up_bytes = 0;
+
+    if (peer->min_rtt_ms == 0) {
+        return; // nothing received yet, keep the initial depth
+    }
+    bdp = (long long) *rate * peer->min_rtt_ms / 1000 / BLOCK_SIZE;
+    peer->queue_depth = bdp + bdp / 2 + MIN_QUEUE_DEPTH;
+    if (peer->queue_depth > MAX_QUEUE_DEPTH) {
+        peer->queue_depth = MAX_QUEUE_DEPTH;
+    }
+    peer->min_rtt_ms += peer->min_rtt_ms / 8 + 1;   // forget a floor the link no longer reaches
+}
+
+/**
+ * expire_requests() gives up on the peer's requests that are overdue; they are the oldest, at the front. Each
+ * timeout halves the peer's pipeline, a peer that stalls gets fewer blocks to sit on
+ **/
+static void expire_requests(bt_args_t *bt_args, peer_t *peer, long long now) {
+    long long timeout = (long long) REQUEST_TIMEOUT_RTTS * peer->srtt_ms;
+
+    if (timeout < REQUEST_TIMEOUT_MS) {
+        timeout = REQUEST_TIMEOUT_MS;
+    }
+
+    while ( bt_args->peers.n_requests[peer->slot] > 0 && now - peer->pending[0].sent_ms > timeout ) {
+        if (bt_args->verbose) {
+            printf("Request for piece %d offset %d timed out.\n", peer->pending[0].request.index,
+                    peer->pending[0].request.begin);
+        }
+        free_block(bt_args, peer, &peer->pending[0].request);
+        retire_request(bt_args, peer, 0);
+
+        peer->queue_depth /= 2;
+        if (peer->queue_depth < MIN_QUEUE_DEPTH) {
+            peer->queue_depth = MIN_QUEUE_DEPTH;
+        }
+    }
+}
+
+/**
+ * request_tick() walks the peers from the last slot down, so dropping one (which moves the last peer into its
+ * slot) never skips a peer
+ **/
+void request_tick(bt_args_t *bt_args) {
+    download_t *download = &bt_args->download;
+    long long now = now_ms(), elapsed = now - download->last_tick_ms;
+    int slot, sample = (elapsed >= RATE_SAMPLE_MS);
+    peer_t *peer;
+
+    for (slot = bt_args->peers.n_peers - 1; slot >= 0; slot--) {
+        peer = bt_args->peers.peer[slot];
+
+        if (sample) {
+            sample_rate(bt_args, peer, elapsed);
+        }
+        expire_requests(bt_args, peer, now);
+
+        if ( request_blocks(bt_args, peer) < 0 ) {
+            drop_peer(peer, bt_args);
+        }
+    }
+
+    if (sample) {
+        download->last_tick_ms = now;
+    }
+}
+
+/**
+ * download_free() releases the buffers of every active piece; their block maps go with bt_args->bufs
+ **/
+void download_free(download_t *download) {
+    int i;
+
+    for (i = 0; i < download->n_active; i++) {
+        assembly_put(download, &download->active[i]);
+    }
+    free(download->active);
+    assembly_free(download);
+    memset(download, 0x00, sizeof(*download));
+}
@@ -0,0 +1,86 @@
+#ifndef _BT_REQUEST_H
+#define _BT_REQUEST_H
+
+#include "bt_lib.h"
+
+/* how often (in ms) download rates are sampled and queue depths re-evaluated */
+#define RATE_SAMPLE_MS 1000
+
+/* a request is given up on after REQUEST_TIMEOUT_RTTS smoothed round trips, but never sooner than
+ * REQUEST_TIMEOUT_MS; its block then goes to whichever peer asks next */
+#define REQUEST_TIMEOUT_MS 15000
+#define REQUEST_TIMEOUT_RTTS 4
+
+/**
+ * request_blocks(bt_args_t *bt_args, peer_t *peer) -> int
+ *
+ * top up the peer's request pipeline to peer->queue_depth blocks. Blocks
+ * of pieces already being downloaded go first; after that the picker
+ * starts the rarest piece the peer has. Once every missing block is
+ * requested (endgame), blocks already out with other peers are asked for
+ * again, so the slowest peer does not hold up the end of the download.
+ * Nothing is requested while the peer chokes us.
+ *
+ * Return: number of requests sent, -1 if the peer should be dropped
+ **/
+int request_blocks(bt_args_t *bt_args, peer_t *peer);
+
+/**
+ * block_received(bt_args_t *bt_args, peer_t *peer, bt_request_t *piece, unsigned char *data) -> int
+ *
+ * account for a BT_PIECE carrying the block piece (index, begin, length)
+ * at data, in place in the receive buffer: copy it into the piece's
+ * assembly buffer, retire the matching request and take a round-trip
+ * sample. In endgame, the other peers asked for the block are sent a
+ * BT_CANCEL. Blocks are hashed as they complete the front of their piece,
+ * so the digest is ready when the last one lands; a valid piece is
+ * written to the payload in one go and set in bt_args->bitfield, a
+ * corrupt one is dropped and goes back to the picker. A write handed to
+ * the disk backend sets and announces the piece once it completes.
+ *
+ * Return: 1 if the block completed a valid piece, now in the bitfield;
+ * 0 if it was saved (or completed a piece still being written), -1
+ * if we did not need it (never requested, a duplicate, or out of range);
+ * its bytes are added to download->wasted_bytes
+ **/
+int block_received(bt_args_t *bt_args, peer_t *peer, bt_request_t *piece, unsigned char *data);
+
+/**
+ * piece_part_written(bt_args_t *bt_args, int index, long result) -> void
+ *
+ * called on the event loop once a write of part of an unfinished piece
+ * (a block of a piece without an assembly buffer, or a run flushed from
+ * one) is over, result being the write's. Once the last write of the
+ * piece lands its blocks can be read back, so hashing carries on and a
+ * piece that is complete by now is checked; a piece one of whose writes
+ * failed is downloaded again.
+ **/
+void piece_part_written(bt_args_t *bt_args, int index, long result);
+
+/**
+ * release_requests(bt_args_t *bt_args, peer_t *peer) -> void
+ *
+ * forget every request outstanding with the peer (it choked us or is
+ * going away) and hand their blocks back to the other peers
+ **/
+void release_requests(bt_args_t *bt_args, peer_t *peer);
+
+/**
+ * request_tick(bt_args_t *bt_args) -> void
+ *
+ * periodic pass over all peers, called once per turn of the event loop:
+ * samples transfer rates and resizes queue depths every RATE_SAMPLE_MS,
+ * expires stalled requests and refills every pipeline. Peers whose
+ * sockets fail are dropped.
+ **/
+void request_tick(bt_args_t *bt_args);
+
+/**
+ * download_free(download_t *download) -> void
+ *
+ * free the active pieces and the assembly buffers; the block maps are
+ * slab objects, freed in bulk with bt_args->bufs
+ **/
+void download_free(download_t *download);
+
+#endif
@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+#include "bt_lib.h"
+#include "bt_resolve.h"
+#include "bt_sock.h"
+
+/**
+ * lookup() runs getaddrinfo() for the first IPv4 address of name
+ *
+ * Return: 0 with *addr set, else the getaddrinfo() error
+ **/
+static int lookup(const char *name, struct in_addr *addr) {
+    struct addrinfo hints, *res;
+    int error;
+
+    memset(&hints, 0x00, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if ( (error = getaddrinfo(name, NULL, &hints, &res)) != 0 ) {
+        return error;
+    }
+    *addr = ((struct sockaddr_in *) res->ai_addr)->sin_addr;
+    freeaddrinfo(res);
+    return 0;
+}
+
+/**
+ * resolve_worker() looks names up one at a time until told to stop
+ **/
+static void * resolve_worker(void *arg) {
+    resolver_t *resolver = arg;
+    resolve_job_t *job;
+
+    pthread_mutex_lock(&resolver->lock);
+    while (1) {
+        while ( !resolver->stop && resolver->work == NULL ) {
+            pthread_cond_wait(&resolver->wake, &resolver->lock);
+        }
+        if (resolver->stop) {
+            break;
+        }
+        job = resolver->work;
+        if ( (resolver->work = job->next) == NULL ) {
+            resolver->work_tail = &resolver->work;
+        }
+        pthread_mutex_unlock(&resolver->lock);
+
+        job->error = lookup(job->name, &job->addr);
+
+        pthread_mutex_lock(&resolver->lock);
+        job->next = resolver->done;
+        resolver->done = job;
+        wake_loop(resolver->event_fd);
+    }
+    pthread_mutex_unlock(&resolver->lock);
+    return NULL;
+}
+
+/**
+ * resolver_start() sets up the cache and the helper thread
+ *
+ * Return: the resolver, NULL on failure
+ **/
+static resolver_t * resolver_start(bt_args_t *bt_args) {
+    resolver_t *resolver;
+
+    if ( (resolver = calloc(1, sizeof(resolver_t))) == NULL ) {
+        return NULL;
+    }
+    pthread_mutex_init(&resolver->lock, NULL);
+    pthread_cond_init(&resolver->wake, NULL);
+    resolver->work_tail = &resolver->work;
+
+    if ( (resolver->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ) {
+        goto FAIL;
+    }
+    if ( reactor_add(bt_args, resolver->event_fd) < 0 ) {
+        close(resolver->event_fd);
+        goto FAIL;
+    }
+
+    if ( spawn_helpers(&resolver->thread, 1, resolve_worker, resolver) == 0 ) {
+        reactor_del(bt_args, resolver->event_fd);
+        close(resolver->event_fd);
+        goto FAIL;
+    }
+    bt_args->resolver = resolver;
+    return resolver;
+
+    FAIL:
+        fprintf(stderr, "ERROR: Could not start the name resolver.\n");
+        pthread_cond_destroy(&resolver->wake);
+        pthread_mutex_destroy(&resolver->lock);
+        free(resolver);
+        return NULL;
+}
+
+/**
+ * cache_entry() finds name in the cache
+ *
+ * Return: its entry, NULL if it is not there
+ **/
+static resolve_entry_t * cache_entry(resolver_t *resolver, const char *name) {
+    int i;
+
+    for (i = 0; i < RESOLVE_CACHE_SIZE; i++) {
+        if ( resolver->cache[i].state != RESOLVE_FREE && strcmp(resolver->cache[i].name, name) == 0 ) {
+            return &resolver->cache[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * cache_victim() picks the entry a new name goes into: a free one, else the answered one closest to expiry
+ *
+ * Return: the entry, NULL if every entry is waiting for an answer
+ **/
+static resolve_entry_t * cache_victim(resolver_t *resolver) {
+    resolve_entry_t *victim = NULL;
+    int i;
+
+    for (i = 0; i < RESOLVE_CACHE_SIZE; i++) {
+        resolve_entry_t *entry = &resolver->cache[i];
+
+        if (entry->state == RESOLVE_FREE) {
+            return entry;
+        }
+        if ( entry->state != RESOLVE_PENDING && (victim == NULL || entry->expires_ms < victim->expires_ms) ) {
+            victim = entry;
+        }
+    }
+    return victim;
+}
+
+/**
+ * resolve_lookup() never waits: dotted quads need no lookup, cached answers are used until they expire, and a
+ * miss only queues the name
+ **/
+int resolve_lookup(bt_args_t *bt_args, const char *name, struct in_addr *addr, const char **error) {
+    resolver_t *resolver = bt_args->resolver;
+    resolve_entry_t *entry;
+    resolve_job_t *job;
+
+    if ( inet_pton(AF_INET, name, addr) == 1 ) {
+        return 1;
+    }
+    if ( resolver == NULL && (resolver = resolver_start(bt_args)) == NULL ) {
+        *error = "no resolver";
+        return -1;
+    }
+
+    if ( (entry = cache_entry(resolver, name)) != NULL ) {
+        switch (entry->state) {
+            case RESOLVE_PENDING:
+                return 0;
+            case RESOLVE_OK:
+                if (now_ms() < entry->expires_ms) {
+                    *addr = entry->addr;
+                    return 1;
+                }
+                break;  // stale: look it up again
+            case RESOLVE_FAILED:
+                if (now_ms() < entry->expires_ms) {
+                    *error = gai_strerror(entry->error);
+                    return -1;
+                }
+                break;
+        }
+    } else if ( (entry = cache_victim(resolver)) == NULL ) {
+        return 0;   // every entry is being looked up; try again later
+    }
+
+    if ( (job = malloc(sizeof(resolve_job_t))) == NULL ) {
+        return 0;
+    }
+    snprintf(job->name, sizeof(job->name), "%s", name);
+    job->next = NULL;
+
+    snprintf(entry->name, sizeof(entry->name), "%s", name);
+    entry->state = RESOLVE_PENDING;
+
+    pthread_mutex_lock(&resolver->lock);
+    *resolver->work_tail = job;
+    resolver->work_tail = &job->next;
+    pthread_cond_signal(&resolver->wake);
+    pthread_mutex_unlock(&resolver->lock);
+    return 0;
+}
+
+/**
+ * resolve_blocking() is lookup() with the result cached nowhere
+ **/
+int resolve_blocking(const char *name, struct in_addr *addr) {
+    return lookup(name, addr) == 0 ? 0 : -1;
+}
+
+/**
+ * resolver_collect() caches every answer, then sets connect_at_ms of the peers that wait on the name to now;
+ * connect_peers() takes it from there
+ **/
+void resolver_collect(bt_args_t *bt_args) {
+    resolver_t *resolver = bt_args->resolver;
+    peer_table_t *peers = &bt_args->peers;
+    resolve_job_t *job, *done;
+    resolve_entry_t *entry;
+    uint64_t count;
+    long long now = now_ms();
+    int slot;
+
+    if ( read(resolver->event_fd, &count, sizeof(count)) < 0 ) {
+        ;   // nothing signalled; look anyway
+    }
+    pthread_mutex_lock(&resolver->lock);
+    done = resolver->done;
+    resolver->done = NULL;
+    pthread_mutex_unlock(&resolver->lock);
+
+    while ( (job = done) != NULL ) {
+        done = job->next;
+
+        if ( (entry = cache_entry(resolver, job->name)) != NULL ) {
+            entry->state = job->error ? RESOLVE_FAILED : RESOLVE_OK;
+            entry->addr = job->addr;
+            entry->error = job->error;
+            entry->expires_ms = now + (job->error ? RESOLVE_NEG_TTL_MS : RESOLVE_TTL_MS);
+        }
+        if (bt_args->verbose) {
+            printf("RESOLVED '%s': %s\n", job->name, job->error ? gai_strerror(job->error) : inet_ntoa(job->addr));
+        }
+
+        for (slot = 0; slot < peers->n_peers; slot++) {
+            peer_t *peer = peers->peer[slot];
+
+            if ( peers->fd[slot] < 0 && !peer->resolved && strcmp(peer->host, job->name) == 0 ) {
+                peer->connect_at_ms = now;
+            }
+        }
+        free(job);
+    }
+}
+
+/**
+ * resolver_free() wakes the helper thread to stop and waits for it
+ **/
+void resolver_free(bt_args_t *bt_args) {
+    resolver_t *resolver = bt_args->resolver;
+    resolve_job_t *job;
+
+    if (resolver == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&resolver->lock);
+    resolver->stop = 1;
+    pthread_cond_signal(&resolver->wake);
+    pthread_mutex_unlock(&resolver->lock);
+    pthread_join(resolver->thread, NULL);
+
+    while ( (job = resolver->work) != NULL ) {
+        resolver->work = job->next;
+        free(job);
+    }
+    while ( (job = resolver->done) != NULL ) {
+        resolver->done = job->next;
+        free(job);
+    }
+
+    reactor_del(bt_args, resolver->event_fd);
+    close(resolver->event_fd);
+    pthread_cond_destroy(&resolver->wake);
+    pthread_mutex_destroy(&resolver->lock);
+    free(resolver);
+    bt_args->resolver = NULL;
+}
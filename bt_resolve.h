@@ -0,0 +1,95 @@
+#ifndef _BT_RESOLVE_H
+#define _BT_RESOLVE_H
+
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include "bt_lib.h"
+
+/* what the resolver knows of a name, resolve_entry_t.state */
+#define RESOLVE_FREE 0 // entry unused
+#define RESOLVE_PENDING 1  // queued for, or being looked up by, the helper thread
+#define RESOLVE_OK 2   // resolved, addr holds the address
+#define RESOLVE_FAILED 3   // the lookup failed; remembered so the name is not asked for again right away
+
+/* names remembered at once; the entry closest to expiry makes room for a new one */
+#define RESOLVE_CACHE_SIZE 64
+
+/* how long (ms) an address, and a failed lookup, is trusted. getaddrinfo() does not tell the DNS TTL */
+#define RESOLVE_TTL_MS (5 * 60 * 1000)
+#define RESOLVE_NEG_TTL_MS (30 * 1000)
+
+/* one name in the cache, and in the helper thread's queues while it is looked up */
+typedef struct resolve_entry {
+    char name[RESOLVE_NAME_MAX];
+    int state;  // RESOLVE_*
+    struct in_addr addr;    // RESOLVE_OK
+    int error;  // RESOLVE_FAILED: the getaddrinfo() error, for gai_strerror()
+    long long expires_ms;   // when a RESOLVE_OK or RESOLVE_FAILED entry is looked up again
+} resolve_entry_t;
+
+/* one lookup handed to the helper thread */
+typedef struct resolve_job {
+    char name[RESOLVE_NAME_MAX];
+    struct in_addr addr;    // the result
+    int error;  // 0, or the getaddrinfo() error
+    struct resolve_job *next;
+} resolve_job_t;
+
+/* name resolution off the event loop. getaddrinfo() blocks, so it runs on a helper thread; the event loop only
+ * ever reads the cache, queues names that miss and takes the answers when event_fd says they are in */
+typedef struct resolver {
+    resolve_entry_t cache[RESOLVE_CACHE_SIZE];  // event loop only
+
+    pthread_mutex_t lock;   // guards everything below
+    pthread_cond_t wake;    // work was added, or stop set
+    resolve_job_t *work;    // names to look up, oldest first
+    resolve_job_t **work_tail;
+    resolve_job_t *done;    // answers for resolver_collect()
+    int stop;
+
+    int event_fd;   // in the event loop's epoll set; readable once answers are in
+    pthread_t thread;
+} resolver_t;
+
+/**
+ * resolve_lookup(bt_args_t *bt_args, const char *name, struct in_addr *addr, const char **error) -> int
+ *
+ * find name's IPv4 address without blocking: a dotted-quad is parsed in
+ * place, anything else is answered from the cache or queued for the
+ * helper thread (started on first use). When the answer is in,
+ * resolver_collect() makes the peers waiting for it due for a connect.
+ *
+ * Return: 1 with *addr set; 0 if the lookup is under way (ask again
+ * later); -1 if name is known not to resolve, with *error set to why
+ **/
+int resolve_lookup(bt_args_t *bt_args, const char *name, struct in_addr *addr, const char **error);
+
+/**
+ * resolve_blocking(const char *name, struct in_addr *addr) -> int
+ *
+ * look name up in place with getaddrinfo(), for use before the event loop
+ * runs (e.g. the address the seeder binds to)
+ *
+ * Return: 0 with *addr set, -1 if name does not resolve
+ **/
+int resolve_blocking(const char *name, struct in_addr *addr);
+
+/**
+ * resolver_collect(bt_args_t *bt_args) -> void
+ *
+ * called by the event loop when event_fd is readable: cache the answers
+ * of the helper thread and make every peer waiting on one of those names
+ * due for a connect (see connect_peers())
+ **/
+void resolver_collect(bt_args_t *bt_args);
+
+/**
+ * resolver_free(bt_args_t *bt_args) -> void
+ *
+ * stop the helper thread (after the lookup it is in, if any) and free
+ * the cache
+ **/
+void resolver_free(bt_args_t *bt_args);
+
+#endif
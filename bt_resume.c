@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "bt_lib.h"
+#include "bt_resume.h"
+#include "bt_io.h"
+#include "bt_bencode.h"
+#include "bt_bitfield.h"
+#include "bt_disk.h"
+
+/* largest sidecar read back: the fixed fields plus a bitfield of a few million pieces */
+#define MAX_RESUME_SIZE (1 << 20)
+
+/* which keys of the sidecar were found */
+#define FOUND_INFO_HASH 0x01
+#define FOUND_LENGTH 0x02
+#define FOUND_MTIME 0x04
+#define FOUND_MTIME_NSEC 0x08
+#define FOUND_BITS 0x10
+#define FOUND_ALL 0x1f
+
+/* what the sidecar says, gathered by handle_resume_value() */
+typedef struct {
+    int found;  // FOUND_* bits
+    const unsigned char *info_hash; // ID_SIZE bytes
+    long long length;   // payload size when saved
+    long long mtime;    // payload modification time when saved, seconds
+    long long mtime_nsec;   // and nanoseconds
+    const unsigned char *bits;  // the bitfield, as on the wire
+    size_t bits_len;    // its length in bytes
+} resume_ctx_t;
+
+/**
+ * resume_path() puts the sidecar's path into path
+ **/
+static void resume_path(bt_args_t *bt_args, char *path, size_t size) {
+    snprintf(path, size, "%s%s", payload_path(bt_args), RESUME_SUFFIX);
+}
+
+/**
+ * handle_resume_value() is the bencode callback of resume_load(); it picks the keys of the top-level dictionary
+ **/
+static int handle_resume_value(void *arg, be_parser_t *parser, int depth, be_node_t *value) {
+    resume_ctx_t *ctx = arg;
+    be_node_t *key = &parser->keys[depth];
+
+    if (depth != 1) {
+        return 0;
+    }
+
+    if ( be_str_eq(key, "info_hash") && value->type == BE_STR && value->len == ID_SIZE ) {
+        ctx->info_hash = value->str;
+        ctx->found |= FOUND_INFO_HASH;
+    } else if ( be_str_eq(key, "length") && value->type == BE_INT ) {
+        ctx->length = value->num;
+        ctx->found |= FOUND_LENGTH;
+    } else if ( be_str_eq(key, "mtime") && value->type == BE_INT ) {
+        ctx->mtime = value->num;
+        ctx->found |= FOUND_MTIME;
+    } else if ( be_str_eq(key, "mtime_nsec") && value->type == BE_INT ) {
+        ctx->mtime_nsec = value->num;
+        ctx->found |= FOUND_MTIME_NSEC;
+    } else if ( be_str_eq(key, "pieces") && value->type == BE_STR ) {
+        ctx->bits = value->str;
+        ctx->bits_len = value->len;
+        ctx->found |= FOUND_BITS;
+    }
+    return 0;
+}
+
+/**
+ * resume_load() trusts the sidecar only if nothing about the payload changed since it was written
+ **/
+int resume_load(bt_args_t *bt_args, bt_bitfield_t *bitfield) {
+    char path[FILE_NAME_MAX + sizeof(RESUME_SUFFIX)];
+    unsigned char *buf = NULL;
+    const char *error = "unreadable";
+    resume_ctx_t ctx;
+    struct stat st;
+    ssize_t size;
+    int fd, ret = -1;
+
+    resume_path(bt_args, path, sizeof(path));
+    if ( (fd = open(path, O_RDONLY)) < 0 ) {
+        return -1;  // never saved: nothing to say about it
+    }
+
+    memset(&ctx, 0x00, sizeof(ctx));
+    if ( (buf = malloc(MAX_RESUME_SIZE)) == NULL || (size = read(fd, buf, MAX_RESUME_SIZE)) <= 0 ) {
+        goto DONE;
+    }
+    if ( be_parse(buf, size, handle_resume_value, &ctx, &error) < 0 ) {
+        goto DONE;
+    }
+
+    if (ctx.found != FOUND_ALL) {
+        error = "incomplete";
+    } else if ( memcmp(ctx.info_hash, bt_args->bt_info->info_hash, ID_SIZE) != 0 ) {
+        error = "written for another torrent";
+    } else if ( fstat(bt_args->store.fd, &st) < 0 || st.st_size != ctx.length ) {
+        error = "payload resized since";
+    } else if ( bitfield_load(bitfield, ctx.bits, ctx.bits_len) < 0 ) {
+        error = "bitfield does not fit the torrent";
+    } else if ( st.st_mtim.tv_sec != ctx.mtime || st.st_mtim.tv_nsec != ctx.mtime_nsec ) {
+        // written to since, e.g. by blocks that landed after the last save of a crashed run: the recorded
+        // pieces are only a hint now
+        printf("FAST RESUME: payload written to since '%s', rechecking the %zu pieces it records.\n", path,
+                bitfield_count(bitfield));
+        ret = 1;
+    } else {
+        ret = 0;
+    }
+
+    DONE:
+        if (ret < 0) {
+            printf("FAST RESUME: ignoring '%s' (%s), rechecking the payload.\n", path, error);
+        }
+        free(buf);
+        close(fd);
+        return ret;
+}
+
+/* a checkpoint on its way through the disk backend: the payload is fsync'ed, then the sidecar written to its
+ * temporary file and fsync'ed, then renamed into place. On Linux fsync() also writes back the pages dirtied
+ * through the mapping */
+typedef struct {
+    unsigned char *bits;    // the bitfield when the checkpoint started; pieces verified later wait for the next one
+    size_t n_pieces;    // pieces set in bits
+    unsigned char *buf; // the encoded sidecar
+    int len;    // bytes in buf
+    int fd; // the temporary sidecar (-1 until opened)
+} checkpoint_t;
+
+/**
+ * encode_sidecar() encodes the sidecar as a bencoded dictionary, keys in sorted order, into a new buffer
+ *
+ * Return: the length, -1 if the payload cannot be stat'ed or on allocation failure
+ **/
+static int encode_sidecar(bt_args_t *bt_args, const unsigned char *bits, size_t n_bytes, unsigned char **out) {
+    unsigned char *buf;
+    struct stat st;
+    int len;
+
+    if ( fstat(bt_args->store.fd, &st) < 0 || (buf = malloc(128 + n_bytes)) == NULL ) {
+        return -1;
+    }
+
+    len = sprintf((char *) buf, "d9:info_hash%d:", ID_SIZE);
+    memcpy(buf + len, bt_args->bt_info->info_hash, ID_SIZE);
+    len += ID_SIZE;
+    len += sprintf((char *) buf + len, "6:lengthi%llde5:mtimei%llde10:mtime_nseci%llde6:pieces%zu:",
+            (long long) st.st_size, (long long) st.st_mtim.tv_sec, (long long) st.st_mtim.tv_nsec, n_bytes);
+    memcpy(buf + len, bits, n_bytes);
+    len += n_bytes;
+    buf[len++] = 'e';
+
+    *out = buf;
+    return len;
+}
+
+/**
+ * resume_save() writes the sidecar to a temporary file and renames it over the old one
+ **/
+int resume_save(bt_args_t *bt_args) {
+    char path[FILE_NAME_MAX + sizeof(RESUME_SUFFIX)], tmp_path[FILE_NAME_MAX + sizeof(RESUME_SUFFIX) + 4];
+    unsigned char *buf;
+    int fd, len, ok;
+
+    if (bt_args->verify) {
+        return -1;  // mid-recheck the bitfield is incomplete; recording it would hide the pieces not reached yet
+    }
+
+    // the pages holding verified pieces must be on disk before the sidecar says so; this also settles the mtime
+    store_sync(&bt_args->store);
+    if ( (len = encode_sidecar(bt_args, bt_args->bitfield->bits, bitfield_bytes(bt_args->bitfield), &buf)) < 0 ) {
+        return -1;
+    }
+
+    resume_path(bt_args, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if ( (fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0 ) {
+        fprintf(stderr, "ERROR: Could not write fast-resume file '%s': %s\n", tmp_path, strerror(errno));
+        free(buf);
+        return -1;
+    }
+    ok = write(fd, buf, len) == len && fsync(fd) == 0;
+    close(fd);
+    free(buf);
+
+    if ( !ok || rename(tmp_path, path) < 0 ) {
+        fprintf(stderr, "ERROR: Could not write fast-resume file '%s': %s\n", path, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+
+    bt_args->resume_saved_ms = now_ms();
+    bt_args->resume_saved_pieces = bitfield_count(bt_args->bitfield);
+    return 0;
+}
+
+/**
+ * checkpoint_end() cleans up after a checkpoint; a failed one leaves the old sidecar and is retried after
+ * another RESUME_SAVE_MS
+ **/
+static void checkpoint_end(bt_args_t *bt_args, checkpoint_t *cp, long result) {
+    char path[FILE_NAME_MAX + sizeof(RESUME_SUFFIX)], tmp_path[FILE_NAME_MAX + sizeof(RESUME_SUFFIX) + 4];
+
+    resume_path(bt_args, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if (cp->fd >= 0) {
+        close(cp->fd);
+    }
+
+    if ( result < 0 || rename(tmp_path, path) < 0 ) {
+        fprintf(stderr, "ERROR: Could not write fast-resume file '%s': %s\n", path,
+                strerror(result < 0 ? (int) -result : errno));
+        if (cp->fd >= 0) {
+            unlink(tmp_path);
+        }
+    } else {
+        bt_args->resume_saved_pieces = cp->n_pieces;
+    }
+
+    bt_args->resume_saved_ms = now_ms();
+    bt_args->resume_pending = 0;
+    free(cp->buf);
+    free(cp->bits);
+    free(cp);
+}
+
+static void sidecar_synced(bt_args_t *bt_args, disk_op_t *op) {
+    checkpoint_end(bt_args, op->arg, op->result);
+}
+
+static void sidecar_written(bt_args_t *bt_args, disk_op_t *op) {
+    checkpoint_t *cp = op->arg;
+
+    if ( op->result < 0 || disk_submit(bt_args, DISK_FSYNC, cp->fd, NULL, 0, 0, sidecar_synced, cp) < 0 ) {
+        checkpoint_end(bt_args, cp, (op->result < 0) ? op->result : -ENOMEM);
+    }
+}
+
+/**
+ * payload_synced() encodes the sidecar once the pieces it records are on disk; the mtime is settled by now
+ **/
+static void payload_synced(bt_args_t *bt_args, disk_op_t *op) {
+    char path[FILE_NAME_MAX + sizeof(RESUME_SUFFIX)], tmp_path[FILE_NAME_MAX + sizeof(RESUME_SUFFIX) + 4];
+    checkpoint_t *cp = op->arg;
+
+    if (op->result < 0) {
+        checkpoint_end(bt_args, cp, op->result);
+        return;
+    }
+    if ( (cp->len = encode_sidecar(bt_args, cp->bits, bitfield_bytes(bt_args->bitfield), &cp->buf)) < 0 ) {
+        checkpoint_end(bt_args, cp, -ENOMEM);
+        return;
+    }
+
+    resume_path(bt_args, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if ( (cp->fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0 ) {
+        checkpoint_end(bt_args, cp, -errno);
+        return;
+    }
+    if ( disk_submit(bt_args, DISK_WRITE, cp->fd, cp->buf, cp->len, 0, sidecar_written, cp) < 0 ) {
+        checkpoint_end(bt_args, cp, -ENOMEM);
+    }
+}
+
+/**
+ * resume_tick() saves at most every RESUME_SAVE_MS, and only when the piece count moved. With a disk backend
+ * the save runs as a chain of background operations, so a slow fsync never stalls the peers
+ **/
+void resume_tick(bt_args_t *bt_args) {
+    checkpoint_t *cp;
+    size_t n_bytes = bitfield_bytes(bt_args->bitfield);
+
+    if (bt_args->resume_pending || now_ms() - bt_args->resume_saved_ms < RESUME_SAVE_MS) {
+        return;
+    }
+    if ( bitfield_count(bt_args->bitfield) == bt_args->resume_saved_pieces ) {
+        bt_args->resume_saved_ms = now_ms();    // look again in another RESUME_SAVE_MS
+        return;
+    }
+    if (bt_args->disk == NULL || bt_args->verify) {
+        resume_save(bt_args);
+        return;
+    }
+
+    if ( (cp = calloc(1, sizeof(checkpoint_t))) == NULL || (cp->bits = malloc(n_bytes)) == NULL ) {
+        free(cp);
+        return;
+    }
+    memcpy(cp->bits, bt_args->bitfield->bits, n_bytes);
+    cp->n_pieces = bitfield_count(bt_args->bitfield);
+    cp->fd = -1;
+    if ( disk_submit(bt_args, DISK_FSYNC, bt_args->store.fd, NULL, 0, 0, payload_synced, cp) < 0 ) {
+        free(cp->bits);
+        free(cp);
+        resume_save(bt_args);
+        return;
+    }
+    bt_args->resume_pending = 1;
+}
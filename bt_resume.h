@@ -0,0 +1,48 @@
+#ifndef _BT_RESUME_H
+#define _BT_RESUME_H
+
+#include "bt_lib.h"
+
+/* the fast-resume sidecar of a payload is the payload's path with this appended */
+#define RESUME_SUFFIX ".resume"
+
+/* how often (in ms) a download in progress saves its sidecar, if pieces were verified since the last save */
+#define RESUME_SAVE_MS 60000
+
+/**
+ * resume_load(bt_args_t *bt_args, bt_bitfield_t *bitfield) -> int
+ *
+ * read the payload's fast-resume sidecar and, if it was written for this
+ * torrent (info_hash) and the payload still has the size it had then,
+ * fill bitfield with the pieces it records as verified
+ *
+ * Return: 0 if the payload's mtime is unchanged too and bitfield can be
+ * trusted, 1 if the payload was written to since and only the pieces set
+ * in bitfield are worth rechecking, -1 if there is no sidecar or it does
+ * not fit (the caller rechecks the whole payload then)
+ **/
+int resume_load(bt_args_t *bt_args, bt_bitfield_t *bitfield);
+
+/**
+ * resume_save(bt_args_t *bt_args) -> int
+ *
+ * flush the payload to disk and record bt_args->bitfield along with the
+ * payload's size, mtime and the torrent's info_hash. The sidecar is
+ * written to a temporary file and renamed over the old one, so a crash
+ * leaves either the old or the new sidecar, never half of one.
+ *
+ * Return: 0 on success, -1 on failure
+ **/
+int resume_save(bt_args_t *bt_args);
+
+/**
+ * resume_tick(bt_args_t *bt_args) -> void
+ *
+ * called once per turn of the event loop: saves the sidecar every
+ * RESUME_SAVE_MS if the download made progress since the last save. With
+ * a disk backend (bt_disk.h) the fsyncs and the write happen in the
+ * background and bt_args->resume_pending is set meanwhile.
+ **/
+void resume_tick(bt_args_t *bt_args);
+
+#endif
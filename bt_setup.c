@@ -4,15 +4,32 @@
 #include <stdlib.h>
 #include <unistd.h>			// for getopt(), optarg, optind
 #include <string.h>
-#include <openssl/sha.h>
+#include <limits.h>
 
 #include "bt_setup.h"
 #include "bt_lib.h"
-
-/**
- * a helper variable to the construct_num() function
- */
-static int final_num;
+#include "bt_peer.h"
+#include "bt_bencode.h"
+#include "bt_sha1.h"
+#include "bt_limit.h"
+
+/* largest .torrent file we are willing to load; a million-piece torrent needs about 20 MB of hashes */
+#define MAX_TORRENT_SIZE (64 * 1024 * 1024)
+
+/* bits of torrent_ctx_t.found, one per 'info' key we need */
+#define FOUND_LENGTH 0x01
+#define FOUND_NAME 0x02
+#define FOUND_PIECE_LENGTH 0x04
+#define FOUND_PIECES 0x08
+#define FOUND_ALL 0x0f
+
+/* what parse_torrent_file() learns while the bencode parser walks the .torrent file */
+typedef struct {
+    bt_info_t *bt_info; // filled in as 'info' keys go by
+    int found;  // FOUND_* bits of the 'info' keys seen so far
+    int has_info;   // 'info' dictionary seen?
+    const unsigned char *pieces;    // the 'pieces' string, inside the file buffer
+} torrent_ctx_t;
 
 /**
  * usage(FILE *file) -> void
@@ -35,6 +52,10 @@ void usage(FILE *file) {
                     "                           \t use this peer instead, ip:port (ip or hostname)\n"
                     "                           \t (include multiple -p for more than 1 peer)\n"
                     "    -I id 		\t Set the node identifier to id (dflt: random)\n"
+                    "    -L                     \t With -b, seed at once and verify the file in the background\n"
+                    "    -G up:down             \t Cap this client's upload/download at up/down KiB/s (0: no cap)\n"
+                    "    -T up:down             \t Cap the torrent's upload/download at up/down KiB/s (0: no cap)\n"
+                    "    -R up:down             \t Cap each peer's upload/download at up/down KiB/s (0: no cap)\n"
                     "    -v                     \t verbose, print additional verbose info\n");
 }
 
@@ -46,7 +67,7 @@ void usage(FILE *file) {
  * ERRORS: Will exit on various errors
  **/
 void __parse_peer(peer_t *peer, char *peer_st) {
-    char *parse_str;    // string in the form of (IPaddr:port) written as command-line argument after -p
+    char parse_str[FILE_NAME_MAX];  // string in the form of (IPaddr:port) written as command-line argument after -p
     char *word;     // token grabber variable used with string tokenizer: strtok()
     unsigned short port;    // connection port of peer
     char *ip;   // IP address or hostname of peer
@@ -55,8 +76,12 @@ void __parse_peer(peer_t *peer, char *peer_st) {
     int i;  // loop iterator variable
 
     //need to copy because strtok mangels things
-    parse_str = malloc(strlen(peer_st) + 1);
-    strncpy( parse_str, peer_st, (strlen(peer_st) + 1) );
+    if ( strlen(peer_st) >= sizeof(parse_str) ) {
+        fprintf(stderr, "ERROR: Parsing Peer: '%s' is too long\n", peer_st);
+        usage(stderr);
+        exit(1);
+    }
+    strcpy(parse_str, peer_st);
 
     // can only have 2 tokens max, but may have less
     for(word = strtok(parse_str, sep), i = 0; 
@@ -92,14 +117,37 @@ void __parse_peer(peer_t *peer, char *peer_st) {
     calc_id(ip, port, id);
 
     // build the peer object
-    init_peer(peer, id, ip, port);
-    
-    // free extra memory
-    free(parse_str);
+    if ( init_peer(peer, id, ip, port) < 0 ) {
+        fprintf(stderr, "ERROR: Parsing Peer: Host name too long in '%s'\n", peer_st);
+        usage(stderr);
+        exit(1);
+    }
 
     return;
 }
 
+/**
+ * __parse_limit(bt_args_t *bt_args, int level, char *limit_st) -> void
+ *
+ * parse a rate limit string "up:down" (KiB/s, 0 for no limit) and set
+ * the limits at level (LIMIT_GLOBAL, LIMIT_TORRENT or LIMIT_PEER)
+ *
+ * ERRORS: Will exit on various errors
+ **/
+void __parse_limit(bt_args_t *bt_args, int level, char *limit_st) {
+    long long up, down;   // KiB/s
+    char rest;  // catches anything after the two numbers
+
+    if ( sscanf(limit_st, "%lld:%lld%c", &up, &down, &rest) != 2 || up < 0 || down < 0 ) {
+        fprintf(stderr, "ERROR: Parsing Limit: '%s' is not up:down in KiB/s\n", limit_st);
+        usage(stderr);
+        exit(1);
+    }
+
+    limit_set(bt_args, level, LIMIT_UP, up * 1024);
+    limit_set(bt_args, level, LIMIT_DOWN, down * 1024);
+}
+
 /**
  * parse_args(bt_args_t *bt_args, int argc, char *argv[]) -> void
  *
@@ -112,11 +160,12 @@ void __parse_peer(peer_t *peer, char *peer_st) {
 void parse_args(bt_args_t *bt_args, int argc, char *argv[]) {
     int ch;	// ch for each flag
     int n_peers = 0;	// track number of seeders in torrent swarm; peers is synonymous to seeders
-    int i;	// loop iterator variable
+    peer_t *peer;	// seeder parsed from a '-p' flag
 
     /* set the default args */
     bt_args->verbose = 0; // no verbosity
     bt_args->bind = 0;	// NOT in seeder bind mode by default
+    bt_args->lazy_verify = 0;   // check the whole payload before serving it
     
     // null bt_args members: bind_info, save_file, log_file, torrent_file
     memset( bt_args->bind_info, 0x00, sizeof(bt_args->bind_info) );
@@ -130,16 +179,44 @@ void parse_args(bt_args_t *bt_args, int argc, char *argv[]) {
     // null bt_info pointer; should be set once torrent file is read
     bt_args->bt_info = NULL;
 
+    // null bitfield pointer; allocated by create_bitfield()
+    bt_args->bitfield = NULL;
+
+    // no sockets yet; set up by reactor_init() and make_seeder_listen()
+    bt_args->listen_sock = -1;
+    bt_args->epoll_fd = -1;
+
+    // nothing being downloaded yet
+    memset(&bt_args->download, 0x00, sizeof(bt_args->download));
+    memset(&bt_args->choker, 0x00, sizeof(bt_args->choker));
+    memset(&bt_args->limiter, 0x00, sizeof(bt_args->limiter));  // no limits unless asked for
+    bt_args->resume_saved_ms = 0;
+    bt_args->resume_saved_pieces = 0;
+    bt_args->verify = NULL;
+    bt_args->cache = NULL;
+    bt_args->disk = NULL;
+    bt_args->resume_pending = 0;
+    bt_args->mem_used = 0;
+
+    // peers and their buffers come and go through pools, so connection churn does not fragment the heap
+    slab_init(&bt_args->peer_slab, sizeof(peer_t));
+    slab_set_init(&bt_args->bufs);
+    bt_args->n_spare_rx = 0;
+    bt_args->n_half_open = 0;
+    bt_args->resolver = NULL;
+
     //default log file
     strncpy( bt_args->log_file, "bt_client.log", FILE_NAME_MAX );
 
-    for(i = 0; i < MAX_CONNECTIONS; i++) {
-        bt_args->peers[i] = NULL; // set all peers NULL initially
+    // start with an empty peer table; it grows as peers are added
+    if ( peer_table_init(&bt_args->peers, INIT_PEER_SLOTS) < 0 ) {
+        fprintf(stderr, "ERROR: Could not allocate the peer table.\n");
+        exit(1);
     }
 
     memset(bt_args->id, 0x00, ID_SIZE);	// set bt_client's id to 0
     
-    while ((ch = getopt(argc, argv, "hb:p:s:l:vI:")) != -1) {	// getopt() returns -1 after all command line arguments are parsed
+    while ((ch = getopt(argc, argv, "hb:p:s:l:vI:LG:T:R:")) != -1) {	// getopt() returns -1 after all command line arguments are parsed
         switch (ch) {
 			case 'h':	// help 
 				usage(stdout);
@@ -148,6 +225,9 @@ void parse_args(bt_args_t *bt_args, int argc, char *argv[]) {
 			case 'v':	// verbose
 				bt_args->verbose = 1;
 				break;
+			case 'L':	// lazy verification
+				bt_args->lazy_verify = 1;
+				break;
 			case 's':	// the file that seeder has
 				strncpy( bt_args->save_file, optarg, FILE_NAME_MAX );
 				break;
@@ -164,19 +244,30 @@ void parse_args(bt_args_t *bt_args, int argc, char *argv[]) {
 			case 'p':	// bt client is in leecher mode
 				n_peers++;	// increment number of peers in torrent swarm
 
-				if ( n_peers > MAX_CONNECTIONS ) {	// cannot have more than MAX_CONNECTIONS number of peers
-					fprintf(stderr, "ERROR: Can only support %d seeders.\n", MAX_CONNECTIONS);
+				/* construct peer; add peer to the torrent swarm */
+				if ( (peer = slab_alloc(&bt_args->peer_slab)) == NULL ) {
+					fprintf(stderr, "ERROR: Could not allocate peer '%s'.\n", optarg);
+					exit(1);
+				}
+				__parse_peer( peer, optarg );	// parse seeder information
+				if ( peer_table_insert(&bt_args->peers, peer) < 0 ) {
+					fprintf(stderr, "ERROR: Peer '%s' given more than once.\n", optarg);
 					usage(stderr);
 					exit(1);
 				}
-
-				/* construct peer; add peer to the torrent swarm */
-				bt_args->peers[n_peers - 1] = malloc(sizeof(peer_t));
-				__parse_peer( bt_args->peers[n_peers - 1], optarg );	// parse seeder information
 				if (bt_args->verbose) {
 					printf("Peer #%d added to swarm.\n", n_peers);
 				}
 				break;
+			case 'G':	// limit over everything this client moves
+				__parse_limit(bt_args, LIMIT_GLOBAL, optarg);
+				break;
+			case 'T':	// limit over this torrent
+				__parse_limit(bt_args, LIMIT_TORRENT, optarg);
+				break;
+			case 'R':	// limit on each peer
+				__parse_limit(bt_args, LIMIT_PEER, optarg);
+				break;
 			/*case 'I':
 				strcpy(bt_args->id, optarg);
 				break;*/
@@ -205,359 +296,157 @@ void parse_args(bt_args_t *bt_args, int argc, char *argv[]) {
     return;
 }
 
+/**
+ * handle_info_value() is the bencode callback of parse_torrent_file(). It checks the 'info' dictionary and each
+ * of its keys that are of relevance to us, and populates the bt_info structure. Values anywhere else in the file
+ * are of no interest and just go by.
+ *
+ * @return int "0 to keep parsing, -1 on a bad .torrent file"
+ */
+static int handle_info_value(void *arg, be_parser_t *parser, int depth, be_node_t *value) {
+    torrent_ctx_t *ctx = arg;
+    bt_info_t *bt_info = ctx->bt_info;
+    be_node_t *key = &parser->keys[depth];
+    long long number;
+
+    if (depth == 1 && be_str_eq(key, "info")) {	// the 'info' dictionary itself, now that all of it has been read
+        if (value->type != BE_DICT) {
+            parser->error = "'info' key does not hold a dictionary";
+            return -1;
+        }
+        // the info_hash identifies the torrent; it covers the dictionary byte for byte as encoded in the file
+        sha1(value->start, value->end - value->start, bt_info->info_hash);
+        ctx->has_info = 1;
+        return 0;
+    }
+
+    if (depth != 2 || !be_str_eq(&parser->keys[1], "info")) {
+        return 0;	// not directly inside 'info'
+    }
+
+    if ( be_str_eq(key, "length") ) {	// look to store length of file in bt_info structure
+        if (value->type != BE_INT || value->num < 0) {
+            parser->error = "unexpected value for 'length' of file";
+            return -1;
+        }
+        bt_info->length = value->num;
+        ctx->found |= FOUND_LENGTH;
+        printf("\tSize or length of file to be downloaded: %lld bytes\n", bt_info->length);
+
+    } else if ( be_str_eq(key, "name") ) {	// look to store suggested name for storing the torrent file
+        if (value->type != BE_STR || value->len == 0 || value->len >= FILE_NAME_MAX || memchr(value->str, '/', value->len)) {
+            parser->error = "unexpected value for 'name' of file";
+            return -1;
+        }
+        memset(bt_info->name, 0x00, FILE_NAME_MAX);	// null 'name' char array initially
+        memcpy(bt_info->name, value->str, value->len);
+        ctx->found |= FOUND_NAME;
+        printf("\tSuggested filename to save torrent as: '%s'\n", bt_info->name);
+
+    } else if ( be_str_eq(key, "piece length") ) {	// look to store size (in bytes) of a piece of the torrent file
+        number = value->num;
+        // 'piece length' needs to be an integer and a power of 2
+        if (value->type != BE_INT || number <= 0 || number > INT_MAX || (number & (number - 1)) != 0) {
+            parser->error = "'piece length' should be a power of 2";
+            return -1;
+        }
+        bt_info->piece_length = (int) number;
+        ctx->found |= FOUND_PIECE_LENGTH;
+        printf("\tSize of a piece of the file: %d bytes\n", bt_info->piece_length);
+
+    } else if ( be_str_eq(key, "pieces") ) {	// look to store the hash strings corresponding to each piece of file
+        if (value->type != BE_STR || (value->len % ID_SIZE) != 0) {	// check whether hash length (bytes) is a multiple of 20
+            parser->error = "SHA1 hash length is not a multiple of 20";
+            return -1;
+        }
+        bt_info->num_pieces = value->len / ID_SIZE;	// total number of 'pieces' of file
+        ctx->pieces = value->str;
+        ctx->found |= FOUND_PIECES;
+        printf("\tNumber of pieces the file is to be divided into: %d\n", bt_info->num_pieces);
+    }
+
+    return 0;	// other 'info' keys (e.g. 'private') are of no concern
+}
+
 /**
  * parse_torrent_file(bt_args_t *bt_args) -> void
  * 
- * parse *.torrent file to populate values related to the 'info' part of of the torrent file
+ * parse *.torrent file to populate values related to the 'info' part of of the torrent file. The whole file is read
+ * into one buffer and walked once by the bencode parser; the info_hash is computed on the way.
  *
  * @param bt_args_t* "the structure that stores all command line arguments passed by user"
  * 
  * @return void
  */
 void parse_torrent_file(bt_args_t *bt_args, bt_info_t *bt_info) {
-	/*
-	 * bt_args->torrent_file	// .torrent file to read from
-	 * bt_args->save_file	// the filename to save to ('name' in .torrent file)
-	 * bt_args->bt_info->piece_length	// size of a piece for the file in bytes (power of 2); ('piece length' in .torrent file)
-	 * bt_args->bt_info->length	// length of file to be downloaded ('length' in .torrent file)
-	 * bt_args->bt_info->num_pieces	// number of pieces file is divided into ()
-	 * bt_args->bt_info->piece_hashes	// array of char arrays (20 bytes each) representing each SHA1 hashed piece of file 
-						// ('pieces' in torrent file) */
-	
+	torrent_ctx_t ctx;
+	const char *error = NULL;
+	unsigned char *buf;	// the whole .torrent file
+	long size;
+	int i;	// loop iterator variable
+
 	if (bt_args->verbose) {
 		printf("PARSING metainfo file: '%s' ...\n", bt_args->torrent_file);
 	}
-	FILE *fp = fopen( bt_args->torrent_file, "r" );	// open .torrent file specified by user in read only mode
+	FILE *fp = fopen( bt_args->torrent_file, "rb" );	// open .torrent file specified by user in read only mode
 	if (fp == NULL) {
 		fprintf(stderr, "ERROR: Could not read file: '%s'\n", bt_args->torrent_file);
 		exit(1);
 	}
-	
-	char ch;
-	while ( (ch = fgetc(fp)) != EOF ) {	// read file up to the end
-	
-	    if (ch == 'd') {	/* if 'd' is found in the file, we need to check each 'key' from then on to look for the key: 'info' coz it 
-				 * is the 'info' dictionary that contains all data relevant to us.
-				 * every dictionary has an 'e' as ending indicator corresponding to its character "begin" indicator 'd' */
-	    
-		// a fair assumption made here is that a 'dictionary' can have no other but only a 'string' in its 'key' places
-	    
-			// look for 'key': "info"
-			while ( (ch = fgetc(fp)) != 'e') {	// as long as the dictionary does not end
-
-		    	if (ch == 'i') {	// integer value found
-		    		while ( (ch = fgetc(fp)) != 'e' )
-		    			continue;
-					ch = fgetc(fp);	// store character next to where integer ends so as to pass a 'number' value to next store_forward() call
-				}
 
-				store_forward(&ch, fp, bt_info);
-
-			}
-
-	    }
-	    
-	    /* the file could begin with a string (e.g. 4:spam), integer (e.g. i3e) or a list (e.g. l8:pleasant5:smilee i.e. 
-	    * ["pleasant", "smile"]) whatever it is, and it will not matter to us coz we should only be alarmed at the sight of another 
-	    * 'dictionary' hoping that it is the 'info' dictionary.
-	    */
-	
-	    // CASE: if file finds an "integer"not inside a dictionary, just get past the integer coz it is insignificant to us
-	    if (ch == 'i') {
-	    // the next 'e' will indicate the end of the integer
-		while ( (ch = fgetc(fp)) != 'e') {
-		    continue;	// traverse through integer's digits
-		}
-	    }
-		    
-	    // CASE: if file finds a "list", just get past that list too (list begins with character 'l')
-	    if (ch == 'l') {
-	    
-		while ( (ch = fgetc(fp)) != 'e') {	// while the list does not end,
-		    fast_forward(&ch, fp);		
-		}
-	    
-	    }
-	
-	    // CASE: if file starts with "string", just get past that string too (string begins with a 'number')
-	    fast_forward(&ch, fp);	/* move on in the file
-					 * NOTE: will not fast-forward in file if a "number" is not found; 
-					 * 'offset' is set to 0 in fast_forward() for such a case
-					 */
-		}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+	if (size <= 0 || size > MAX_TORRENT_SIZE) {
+		fprintf(stderr, "ERROR: Bad .torrent file size: %ld bytes\n", size);
+		exit(1);
+	}
 
-	rewind(fp);	// set file pointer to beginning of file
-	if (bt_args->verbose) {
-		printf("\nPARSING of '%s' file complete.\n", bt_args->torrent_file);
+	// the contents stay with the torrent: piece_hashes is a view into them
+	memset(bt_info, 0x00, sizeof(*bt_info));
+	arena_init(&bt_info->arena);
+	buf = arena_alloc(&bt_info->arena, size);
+	if ( buf == NULL || fread(buf, 1, size, fp) != (size_t) size ) {
+		fprintf(stderr, "ERROR: Could not read file: '%s'\n", bt_args->torrent_file);
+		exit(1);
 	}
 	fclose(fp);	// close file after reading from it
-}
 
-/**
- * fast_forward(char *, FILE *)
- * 	Used to simply get past the bytes following a ':'. Getting past the bytes or characters means that we do not 
- * 	need to store any information from the file and therefore, are just moving ahead in the file.
- * 
- * @param char* "the character in the file that was last read"
- * @param FILE* "pointer to the file being read"
- * 
- * @return void
- */
-void fast_forward(char *c, FILE *fptr) {
-    int num = 0;	/* temporary integer holder; 
-			 * num = 0 is also useful when offset needs to be 0 (does not fast-forward) */
-    
-    final_num = 0;	// reset static variable
-    
-    num = handle_numbers(c, fptr);
-    
-    fseek(fptr, num, SEEK_CUR);	// move file pointer ahead by length of string (num) after ':'
-    
-}
+	if (buf[0] != 'd') {	// .torrent file must be a dictionary, not an integer, list or string
+		fprintf(stderr, "ERROR: Bad .torrent file. It does not start with a dictionary.\n");
+		exit(1);
+	}
 
-/**
- * This function checks exactly which digits appear in a bencoded string before a ':' and 
- * accordingly keeps passing each digit to the construct_num() function.
- * @param char* "the character that has the digit"
- * @param FILE* "pointer to the file being read"
- * 
- * @return int "the fully constructed natural number"
- */
-int handle_numbers(char *chr, FILE *fpr) {
-    int num = 0;
-    switch (*chr) {
-	case '0': case '1': case '2': case '3': case '4':
-	case '5': case '6': case '7': case '8': case '9':
-	    num = atoi(chr);	// store first digit
-	    num = construct_num(num);	// construct a natural number
-	    while ((*chr = fgetc(fpr)) != ':') {
-			num = atoi(chr);	// more than one digit found
-			num = construct_num(num);
-	    }
-	default:
-	    break;
-    }
-    
-    return num;
-}
+	memset(&ctx, 0x00, sizeof(ctx));
+	ctx.bt_info = bt_info;
 
-/**
- * store_forward(char *, FILE *)
- * 	This function is just like fast_forward() except that instead of moving the file pointer ahead without storing any 
- * file contents, store_forward() stores strings found in the 'info' dictionary into a temporary buffer.
- * 
- * @param char* "the character last read in file"
- * @param FILE* "pointer to the file being read"
- * 
- * @return void
- */
-void store_forward(char *c, FILE *fptr, bt_info_t *bt_info) {
-    
-    int num = 0;
-    final_num = 0;	// reset static variable
-    char buffer[1024];	// temporary string holder
-    switch(*c) {
-	case '4':	// if we get a '4', we hope to see an "info" string
-	    num = atoi(c);
-	    num = construct_num(num);
-	    while ((*c = fgetc(fptr)) != ':') {
-			num = atoi(c);	// more than one digit found; no chance of "info" being in there
-			num = construct_num(num);	// still need to construct that number to fast-forward without storing anythingd
-	    }
-	    
-	    if (num == 4) {	/* if number is indeed the single-digit '4' and not something like '472', then
-				 * check if 'key' is equal to "info" */
-	    	int i;
-			memset(buffer, 0, sizeof(buffer));	// zero-out buffer before anything is read into it
-			for (i = 0; i < num; i++) {	// store string of length 4, into a buffer
-				*c = fgetc(fptr);
-				buffer[i] = *c;
-			}
-		
-			if (strcmp(buffer, "info") == 0) {	// 'buffer' contents equal to "info"?
-
-		    	if ( (*c = fgetc(fptr)) != 'd') {	// but if 'info' is not followed by a dictionary ('d')
-					// may be what follows is an integer, a list or a string; handle all such cases
-		    		switch(*c) {
-			    		case 'l':	// list encountered
-			    			while ( (*c = fgetc(fptr) != 'e') )
-			    				continue;
-			    			break;
-			    		case 'i':	// integer encountered
-			    			while ( (*c = fgetc(fptr) != 'e') )
-			    				continue;
-			    			break;
-			    		default:
-							num = handle_numbers(c, fptr);	// string encountered
-							break;
-					}
-				} else {	// case where a dictionary follows after 'info'
-
-					while ( (*c = fgetc(fptr)) != 'e' ) {	// read through the whole 'info' dictionary until it ends
-
-						final_num = 0;
-						num = handle_numbers(c, fptr);
-			    		memset(buffer, 0, sizeof(buffer));	// flush buffer
-			    
-			    		for (i = 0; i < num; i++) {	// store each dictionary 'key'
-			    			*c = fgetc(fptr);
-			    			buffer[i] = *c;
-						}
-
-			    		handle_info_contents(buffer, c, fptr, bt_info);	// check value of each dictionary 'key' to set values in bt_info structure accordingly
-					}
-			
-					num = 0;	// set num to 0, as we do not need a file offset in this case
-				}
-			}
-	    }
-	    break;
-	case '0': case '1': case '2': case '3': 
-	case '5': case '6': case '7': case '8': case '9':	// handle other irrelevant cases
-	    num = handle_numbers(c, fptr);
-	    break;
-	default:
-	    break;
-    }
-    
-    fseek(fptr, num, SEEK_CUR);	// offset file pointer ahead
-}
+	if ( be_parse(buf, size, handle_info_value, &ctx, &error) < 0 ) {
+		fprintf(stderr, "ERROR: Bad .torrent file: %s.\n", error);
+		exit(1);
+	}
 
-/**
- * This function takes a string buffer as argument and checks whether buffer might have data that is of relevance to us as per the 'info' dictionary.
- * It grabs all relevant data and populates the bt_info structure.
- *
- * @param char* buf "the temporary buffer that holds the relevant 'info' keys
- * @param char* chr "last character read from file"
- * @param FILE* fpr "pointer to file"
- *
- * @return void
- */
-void handle_info_contents(char *buf, char *chr, FILE *fpr, bt_info_t *bt_info) {
-
-    char holder[1024];	// another temporary string-holder
-    int number = 0;
-    final_num = 0;	// reset static 'final_num'
-    int i;	// loop iterator variable
-
-    if ( strcmp(buf, "length") == 0 ) {	// look to store length of file in bt_args's bt_info structure
-	
-    	if ( (*chr = fgetc(fpr)) == 'i' ) {	// look for integer value only
-
-    		while ( (*chr = fgetc(fpr)) != 'e' ) {
-    			number = atoi(chr);
-    			number = construct_num(number);
-    		}
-    		bt_info->length = number;
-    		printf("\tSize or length of file to be downloaded: %d bytes\n", bt_info->length);
-
-    	} else  {
-    		fprintf(stderr, "Unexpected value for 'length' of file found in .torrent file");
-    		exit(1);
-    	}
-
-    } else if ( strcmp(buf, "name") == 0 ) {	// look to store suggested name for storing the torrent file
-
-		*chr = fgetc(fpr);	// push to next character after buffer read
-		number = handle_numbers(chr, fpr);
-
-		memset(holder, 0x00, 1024);	// zero-out string-holder
-		for (i = 0; i < number; i++) {
-			*chr = fgetc(fpr);
-			holder[i] = *chr;
-		}
-		// holder[number] = '\0';	// null-terminate the string; NO NEED TO DO THIS
-
-		memset(bt_info->name, 0x00, FILE_NAME_MAX);	// null 'name' char array initially
-		memcpy( bt_info->name, holder, number );	// use memcpy() instead of strncpy() so as to include 'null-terminators'in strings as well
-		printf("\tSuggested filename to save torrent as: '%s'\n", bt_info->name);
-
-    } else if ( strcmp(buf, "piece length") == 0 ) {	// look to store size (in bytes) of a piece of the torrent file
-	
-    	if ( (*chr = fgetc(fpr)) == 'i' ) {	// look for integer only
-    		while ( (*chr = fgetc(fpr)) != 'e' ) {
-    			number = atoi(chr);
-    			number = construct_num(number);
-    		}
-
-		    // need to check if 'number' is indeed a power of 2
-    		int tempNumber = number;
-    		while ( (tempNumber % 2) == 0 ) {
-    			tempNumber = tempNumber / 2;
-    		}
-    		if (tempNumber != 1) {
-    			fprintf(stderr, "ERROR: 'Piece length' in .torrent file should be a power of 2");
-    			exit(1);
-    		}
-
-    		bt_info->piece_length = number;
-    		printf("\tSize of a piece of the file: %d bytes\n", bt_info->piece_length);
-
-    	} else  {
-    		fprintf(stderr, "Unexpected value for 'piece length' found in .torrent file");
-    		exit(1);
-    	}
-	
-    } else if ( strcmp(buf, "pieces") == 0 ) {	// look to store the hash strings corresponding to each piece of file
-	
-		*chr = fgetc(fpr);	// push to next character after buffer read
-		number = handle_numbers(chr, fpr);	// total SHA1 bytes for all pieces together
-	
-		if ((number % 20) != 0 ) {	// check whether hash length (bytes) is a multiple of 20
-			fprintf(stderr, "ERROR: SHA1 hash length is not a multiple of 20.");
-			exit(1);
-		}
-		
-		// printf("testing, number: %d\n", number);
-
-		bt_info->num_pieces = (number / 20);	// total number of 'pieces' of file
-		printf("\tNumber of pieces the file is to be divided into: %d\n", bt_info->num_pieces);
-	
-		memset(holder, 0x00, 1024);	// zero-out string-holder
-		
-		fread(holder, sizeof(char), number, fpr);	// read a chunk of 'number' bytes from .torrent file
-		// holder[number] = '\0';	// explicitly null-terminate temporary string holder again
-
-		bt_info->piece_hashes = malloc( bt_info->num_pieces * sizeof(char *) );	// allocate memory to 'pointer to pointer' (array of char arrays)
-
-		unsigned char tempString[20];
-		int j;
-		printf("\n");	// line-feed
-		for (i = 0; i < bt_info->num_pieces; i++) {
-			bt_info->piece_hashes[i] = malloc(41);	// 40 + 1 extra byte for null-character
-			memset(bt_info->piece_hashes[i], 0x00, 41);	// null each hash piece initially
-
-			memset(tempString, 0x00, 20);
-			j = 0;
-			while (j < 20) {
-				tempString[j] = (unsigned char) holder[j + 20 * i];
-				j++;
-			}
-
-			j = 0;
-			while (j < 20) {
-				snprintf( (char *) &(bt_info->piece_hashes[i][j * 2]), 41, "%02x", tempString[j]);
-				j++;
-			}
-
-			printf("\t40-byte hex for piece #%d, hash_piece[%d]: %s\n", (i + 1), i, bt_info->piece_hashes[i]);
-		}
-	
-    } else {
-		fprintf(stderr, "ERROR: Bad .torrent file. Please check it.");
+	if (!ctx.has_info) {
+		fprintf(stderr, "ERROR: Bad .torrent file. No 'info' dictionary found.\n");
 		exit(1);
-    }
-}
+	}
+	if (ctx.found != FOUND_ALL) {
+		fprintf(stderr, "ERROR: Bad .torrent file. 'info' dictionary lacks one of 'length', 'name', 'piece length', 'pieces'.\n");
+		exit(1);
+	}
+	if ( bt_info->num_pieces != (bt_info->length + bt_info->piece_length - 1) / bt_info->piece_length ) {
+		fprintf(stderr, "ERROR: Bad .torrent file. %d piece hashes do not cover %lld bytes.\n", bt_info->num_pieces, bt_info->length);
+		exit(1);
+	}
 
-/**
- * construct_num(int)
- * 	Constructs a natural number by successively appending each digit to the previous one on successive calls and
- * 	forms a non-single digit natural number. When called only once, will return a single-digit natural number.
- * 
- * @param int "each single digit parsed in file that can be appended to the previous one"
- * 
- * @return int "the entire non-single digit or single digit natural number"
- */
-int construct_num(int n) {
-    return ( final_num = (final_num * 10 + n) );
-}
\ No newline at end of file
+	// piece hashes stay raw, as the .torrent lists them: num_pieces * ID_SIZE bytes back to back
+	bt_info->piece_hashes = ctx.pieces;
+	printf("\n");	// line-feed
+	for (i = 0; i < bt_info->num_pieces; i++) {
+		printf("\t40-byte hex for piece #%d, hash_piece[%d]: %s\n", (i + 1), i, get_hashhex(bt_info->piece_hashes + i * ID_SIZE));
+	}
+
+	if (bt_args->verbose) {
+		printf("\tinfo_hash: %s\n", get_hashhex(bt_info->info_hash));
+		printf("\nPARSING of '%s' file complete.\n", bt_args->torrent_file);
+	}
+}
@@ -0,0 +1,466 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA1_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#include "bt_sha1.h"
+
+/* round constants, one per group of 20 rounds */
+#define K0 0x5a827999
+#define K1 0x6ed9eba1
+#define K2 0x8f1bbcdc
+#define K3 0xca62c1d6
+
+static const uint32_t sha1_iv[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+
+static const char *backend_names[SHA1_N_BACKENDS] = { "shani", "avx2", "scalar" };
+
+/* compresses n_blocks consecutive blocks into the state h; set by sha1_select() */
+typedef void (*sha1_compress_t)(uint32_t h[5], const unsigned char *data, size_t n_blocks);
+
+static void compress_scalar(uint32_t h[5], const unsigned char *data, size_t n_blocks);
+
+static sha1_compress_t compress = compress_scalar;
+static int backend = SHA1_SCALAR;
+
+static inline uint32_t rotl32(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+static inline uint32_t get_be32(const unsigned char *p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static inline void put_be32(unsigned char *p, uint32_t x) {
+    p[0] = x >> 24;
+    p[1] = x >> 16;
+    p[2] = x >> 8;
+    p[3] = x;
+}
+
+/**
+ * compress_scalar() is the reference implementation of FIPS 180-4, with a rolling 16-word message schedule
+ **/
+static void compress_scalar(uint32_t h[5], const unsigned char *data, size_t n_blocks) {
+    uint32_t w[16], a, b, c, d, e, f, k, t;
+    int i;
+
+    for (; n_blocks > 0; n_blocks--, data += SHA1_BLOCK_LEN) {
+        a = h[0];
+        b = h[1];
+        c = h[2];
+        d = h[3];
+        e = h[4];
+
+        for (i = 0; i < 80; i++) {
+            if (i < 16) {
+                w[i] = get_be32(data + 4 * i);
+            } else {
+                w[i & 15] = rotl32(w[(i - 3) & 15] ^ w[(i - 8) & 15] ^ w[(i - 14) & 15] ^ w[i & 15], 1);
+            }
+
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = K0;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = K1;
+            } else if (i < 60) {
+                f = (b & c) | (d & (b | c));
+                k = K2;
+            } else {
+                f = b ^ c ^ d;
+                k = K3;
+            }
+
+            t = rotl32(a, 5) + f + e + k + w[i & 15];
+            e = d;
+            d = c;
+            c = rotl32(b, 30);
+            b = a;
+            a = t;
+        }
+
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+}
+
+#ifdef SHA1_X86
+
+/* four rounds of SHA-NI, group g (rounds 4g..4g+3) using round function f. msg[g % 4] holds the schedule words
+ * of group g; the words of groups g+1..g+3 are built from it along the way */
+#define SHANI_GROUP(g, f) do { \
+        e_cur = ((g) == 0) ? _mm_add_epi32(e0, msg[0]) : _mm_sha1nexte_epu32(e_prev, msg[(g) % 4]); \
+        e_prev = abcd; \
+        if ((g) >= 3 && (g) <= 18) { \
+            msg[((g) + 1) % 4] = _mm_sha1msg2_epu32(msg[((g) + 1) % 4], msg[(g) % 4]); \
+        } \
+        abcd = _mm_sha1rnds4_epu32(abcd, e_cur, f); \
+        if ((g) >= 1 && (g) <= 16) { \
+            msg[((g) + 3) % 4] = _mm_sha1msg1_epu32(msg[((g) + 3) % 4], msg[(g) % 4]); \
+        } \
+        if ((g) >= 2 && (g) <= 17) { \
+            msg[((g) + 2) % 4] = _mm_xor_si128(msg[((g) + 2) % 4], msg[(g) % 4]); \
+        } \
+    } while (0)
+
+/**
+ * compress_shani() runs the 80 rounds on the SHA extensions, four per instruction; abcd holds a..d with a in the
+ * top lane, e rides in the top lane of its own register
+ **/
+__attribute__((target("sha,sse4.1,ssse3")))
+static void compress_shani(uint32_t h[5], const unsigned char *data, size_t n_blocks) {
+    const __m128i bswap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd, abcd_save, e0, e0_save, e_cur, e_prev, msg[4];
+    int i;
+
+    abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) h), 0x1b);
+    e0 = _mm_set_epi32(h[4], 0, 0, 0);
+
+    for (; n_blocks > 0; n_blocks--, data += SHA1_BLOCK_LEN) {
+        abcd_save = abcd;
+        e0_save = e0;
+
+        for (i = 0; i < 4; i++) {
+            msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16 * i)), bswap);
+        }
+
+        SHANI_GROUP(0, 0);
+        SHANI_GROUP(1, 0);
+        SHANI_GROUP(2, 0);
+        SHANI_GROUP(3, 0);
+        SHANI_GROUP(4, 0);
+        SHANI_GROUP(5, 1);
+        SHANI_GROUP(6, 1);
+        SHANI_GROUP(7, 1);
+        SHANI_GROUP(8, 1);
+        SHANI_GROUP(9, 1);
+        SHANI_GROUP(10, 2);
+        SHANI_GROUP(11, 2);
+        SHANI_GROUP(12, 2);
+        SHANI_GROUP(13, 2);
+        SHANI_GROUP(14, 2);
+        SHANI_GROUP(15, 3);
+        SHANI_GROUP(16, 3);
+        SHANI_GROUP(17, 3);
+        SHANI_GROUP(18, 3);
+        SHANI_GROUP(19, 3);
+
+        e0 = _mm_sha1nexte_epu32(e_prev, e0_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    _mm_storeu_si128((__m128i *) h, _mm_shuffle_epi32(abcd, 0x1b));
+    h[4] = _mm_extract_epi32(e0, 3);
+}
+
+/* one round of the 8-lane SHA1, every lane on its own message */
+#define AVX2_ROUND(i, f, k) do { \
+        if ((i) >= 16) { \
+            t = _mm256_xor_si256(_mm256_xor_si256(w[((i) - 3) & 15], w[((i) - 8) & 15]), \
+                    _mm256_xor_si256(w[((i) - 14) & 15], w[(i) & 15])); \
+            w[(i) & 15] = _mm256_or_si256(_mm256_slli_epi32(t, 1), _mm256_srli_epi32(t, 31)); \
+        } \
+        t = _mm256_add_epi32(_mm256_add_epi32(_mm256_or_si256(_mm256_slli_epi32(a, 5), _mm256_srli_epi32(a, 27)), f), \
+                _mm256_add_epi32(_mm256_add_epi32(e, k), w[(i) & 15])); \
+        e = d; \
+        d = c; \
+        c = _mm256_or_si256(_mm256_slli_epi32(b, 30), _mm256_srli_epi32(b, 2)); \
+        b = a; \
+        a = t; \
+    } while (0)
+
+#define AVX2_CH _mm256_xor_si256(_mm256_and_si256(b, c), _mm256_andnot_si256(b, d))
+#define AVX2_PARITY _mm256_xor_si256(_mm256_xor_si256(b, c), d)
+#define AVX2_MAJ _mm256_or_si256(_mm256_and_si256(b, c), _mm256_and_si256(d, _mm256_or_si256(b, c)))
+
+/**
+ * load_words_avx2() loads 8 schedule words of each lane, starting at byte offset of its message, and transposes
+ * them so that w[i] holds word i of every lane
+ **/
+__attribute__((target("avx2")))
+static inline void load_words_avx2(__m256i *w, const unsigned char *const *data, size_t offset) {
+    const __m256i bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    __m256i r[8], t[8], u[8];
+    int j;
+
+    for (j = 0; j < 8; j++) {
+        r[j] = _mm256_loadu_si256((const __m256i *) (data[j] + offset));
+    }
+    for (j = 0; j < 8; j += 2) {
+        t[j] = _mm256_unpacklo_epi32(r[j], r[j + 1]);
+        t[j + 1] = _mm256_unpackhi_epi32(r[j], r[j + 1]);
+    }
+    for (j = 0; j < 8; j += 4) {
+        u[j] = _mm256_unpacklo_epi64(t[j], t[j + 2]);
+        u[j + 1] = _mm256_unpackhi_epi64(t[j], t[j + 2]);
+        u[j + 2] = _mm256_unpacklo_epi64(t[j + 1], t[j + 3]);
+        u[j + 3] = _mm256_unpackhi_epi64(t[j + 1], t[j + 3]);
+    }
+    for (j = 0; j < 4; j++) {
+        w[j] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u[j], u[j + 4], 0x20), bswap);
+        w[j + 4] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u[j], u[j + 4], 0x31), bswap);
+    }
+}
+
+/**
+ * compress_avx2() advances SHA1_LANES independent hashes by n_blocks blocks each; state[k][j] is word k of the
+ * state of lane j
+ **/
+__attribute__((target("avx2")))
+static void compress_avx2(uint32_t state[5][SHA1_LANES], const unsigned char *const *data, size_t n_blocks) {
+    const __m256i k0 = _mm256_set1_epi32(K0), k1 = _mm256_set1_epi32(K1);
+    const __m256i k2 = _mm256_set1_epi32(K2), k3 = _mm256_set1_epi32(K3);
+    __m256i a, b, c, d, e, t, w[16];
+    __m256i h[5];
+    size_t block;
+    int i;
+
+    for (i = 0; i < 5; i++) {
+        h[i] = _mm256_loadu_si256((const __m256i *) state[i]);
+    }
+
+    for (block = 0; block < n_blocks; block++) {
+        load_words_avx2(w, data, block * SHA1_BLOCK_LEN);
+        load_words_avx2(w + 8, data, block * SHA1_BLOCK_LEN + 32);
+        a = h[0];
+        b = h[1];
+        c = h[2];
+        d = h[3];
+        e = h[4];
+
+        for (i = 0; i < 20; i++) {
+            AVX2_ROUND(i, AVX2_CH, k0);
+        }
+        for (; i < 40; i++) {
+            AVX2_ROUND(i, AVX2_PARITY, k1);
+        }
+        for (; i < 60; i++) {
+            AVX2_ROUND(i, AVX2_MAJ, k2);
+        }
+        for (; i < 80; i++) {
+            AVX2_ROUND(i, AVX2_PARITY, k3);
+        }
+
+        h[0] = _mm256_add_epi32(h[0], a);
+        h[1] = _mm256_add_epi32(h[1], b);
+        h[2] = _mm256_add_epi32(h[2], c);
+        h[3] = _mm256_add_epi32(h[3], d);
+        h[4] = _mm256_add_epi32(h[4], e);
+    }
+
+    for (i = 0; i < 5; i++) {
+        _mm256_storeu_si256((__m256i *) state[i], h[i]);
+    }
+}
+
+/**
+ * many_avx2() runs the blocks every message has in lockstep, then finishes each message (its tail and padding)
+ * on its own; lanes left over when n < SHA1_LANES hash the first message again and are discarded
+ **/
+static void many_avx2(const unsigned char *const *data, const size_t *len, int n, unsigned char *digests) {
+    uint32_t state[5][SHA1_LANES];
+    const unsigned char *lanes[SHA1_LANES];
+    size_t n_blocks = len[0] / SHA1_BLOCK_LEN, done;
+    sha1_ctx_t ctx;
+    int i, k;
+
+    for (i = 0; i < SHA1_LANES; i++) {
+        lanes[i] = data[(i < n) ? i : 0];
+        if (i < n && len[i] / SHA1_BLOCK_LEN < n_blocks) {
+            n_blocks = len[i] / SHA1_BLOCK_LEN;
+        }
+        for (k = 0; k < 5; k++) {
+            state[k][i] = sha1_iv[k];
+        }
+    }
+    compress_avx2(state, lanes, n_blocks);
+
+    done = n_blocks * SHA1_BLOCK_LEN;
+    for (i = 0; i < n; i++) {
+        for (k = 0; k < 5; k++) {
+            ctx.h[k] = state[k][i];
+        }
+        ctx.length = done;
+        sha1_update(&ctx, data[i] + done, len[i] - done);
+        sha1_final(&ctx, digests + i * SHA1_DIGEST_LEN);
+    }
+}
+
+#endif
+
+/**
+ * cpu_supports() asks CPUID for the instructions a backend needs (and, for AVX2, whether the OS saves the
+ * registers they use)
+ **/
+static int cpu_supports(int which) {
+#ifdef SHA1_X86
+    unsigned int eax, ebx, ecx, edx, ebx7 = 0, ecx7, edx7, xcr0_lo, xcr0_hi;
+
+    if ( !__get_cpuid(1, &eax, &ebx, &ecx, &edx) ) {
+        return which == SHA1_SCALAR;
+    }
+    if ( __get_cpuid_max(0, NULL) >= 7 ) {
+        __cpuid_count(7, 0, eax, ebx7, ecx7, edx7);
+    }
+
+    switch (which) {
+        case SHA1_SHANI:
+            return (ebx7 & bit_SHA) && (ecx & bit_SSE4_1) && (ecx & bit_SSSE3);
+
+        case SHA1_AVX2:
+            if ( !(ecx & bit_OSXSAVE) || !(ebx7 & bit_AVX2) ) {
+                return 0;
+            }
+            __asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+            return (xcr0_lo & 0x6) == 0x6;  // XMM and YMM state
+
+        default:
+            return which == SHA1_SCALAR;
+    }
+#else
+    return which == SHA1_SCALAR;
+#endif
+}
+
+/**
+ * sha1_select() switches the single-message compression function; the AVX2 backend does single messages on the
+ * scalar one and only speeds up sha1_many()
+ **/
+int sha1_select(int which) {
+    if ( which < 0 || which >= SHA1_N_BACKENDS || !cpu_supports(which) ) {
+        return -1;
+    }
+
+    backend = which;
+#ifdef SHA1_X86
+    compress = (which == SHA1_SHANI) ? compress_shani : compress_scalar;
+#else
+    compress = compress_scalar;
+#endif
+    return 0;
+}
+
+const char * sha1_backend_name(int which) {
+    if (which < 0 || which >= SHA1_N_BACKENDS) {
+        which = backend;
+    }
+    return backend_names[which];
+}
+
+/**
+ * sha1_setup() runs before main(), so the backend never changes under the hashing threads
+ **/
+__attribute__((constructor))
+static void sha1_setup(void) {
+    const char *name = getenv("BT_SHA1");
+    int i;
+
+    if (name) {
+        for (i = 0; i < SHA1_N_BACKENDS; i++) {
+            if ( strcmp(name, backend_names[i]) == 0 && sha1_select(i) == 0 ) {
+                return;
+            }
+        }
+        fprintf(stderr, "ERROR: SHA1 backend '%s' unknown or not supported by this CPU, choosing one.\n", name);
+    }
+
+    for (i = 0; i < SHA1_N_BACKENDS; i++) {
+        if ( sha1_select(i) == 0 ) {
+            return;
+        }
+    }
+}
+
+void sha1_init(sha1_ctx_t *ctx) {
+    memcpy(ctx->h, sha1_iv, sizeof(sha1_iv));
+    ctx->length = 0;
+}
+
+/**
+ * sha1_update() tops up the partial block first, then compresses whole blocks straight from data
+ **/
+void sha1_update(sha1_ctx_t *ctx, const unsigned char *data, size_t len) {
+    size_t used = ctx->length % SHA1_BLOCK_LEN, n;
+
+    ctx->length += len;
+
+    if (used) {
+        n = (len < SHA1_BLOCK_LEN - used) ? len : SHA1_BLOCK_LEN - used;
+        memcpy(ctx->block + used, data, n);
+        data += n;
+        len -= n;
+        if (used + n < SHA1_BLOCK_LEN) {
+            return;
+        }
+        compress(ctx->h, ctx->block, 1);
+    }
+
+    if (len >= SHA1_BLOCK_LEN) {
+        compress(ctx->h, data, len / SHA1_BLOCK_LEN);
+        data += len - len % SHA1_BLOCK_LEN;
+        len %= SHA1_BLOCK_LEN;
+    }
+    memcpy(ctx->block, data, len);
+}
+
+/**
+ * sha1_final() appends the 0x80 byte, zeros and the message length in bits, big-endian
+ **/
+void sha1_final(sha1_ctx_t *ctx, unsigned char *digest) {
+    size_t used = ctx->length % SHA1_BLOCK_LEN;
+    uint64_t bits = ctx->length * 8;
+    int i;
+
+    ctx->block[used++] = 0x80;
+    if (used > SHA1_BLOCK_LEN - 8) {
+        memset(ctx->block + used, 0x00, SHA1_BLOCK_LEN - used);
+        compress(ctx->h, ctx->block, 1);
+        used = 0;
+    }
+    memset(ctx->block + used, 0x00, SHA1_BLOCK_LEN - 8 - used);
+    put_be32(ctx->block + SHA1_BLOCK_LEN - 8, (uint32_t) (bits >> 32));
+    put_be32(ctx->block + SHA1_BLOCK_LEN - 4, (uint32_t) bits);
+    compress(ctx->h, ctx->block, 1);
+
+    for (i = 0; i < 5; i++) {
+        put_be32(digest + 4 * i, ctx->h[i]);
+    }
+}
+
+void sha1(const unsigned char *data, size_t len, unsigned char *digest) {
+    sha1_ctx_t ctx;
+
+    sha1_init(&ctx);
+    sha1_update(&ctx, data, len);
+    sha1_final(&ctx, digest);
+}
+
+/**
+ * sha1_many() hands the messages to the multi-buffer path when the AVX2 backend is selected
+ **/
+void sha1_many(const unsigned char *const *data, const size_t *len, int n, unsigned char *digests) {
+    int i;
+
+#ifdef SHA1_X86
+    if (backend == SHA1_AVX2 && n > 1) {
+        many_avx2(data, len, n, digests);
+        return;
+    }
+#endif
+
+    for (i = 0; i < n; i++) {
+        sha1(data[i], len[i], digests + i * SHA1_DIGEST_LEN);
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef _BT_SHA1_H
+#define _BT_SHA1_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* size (in bytes) of a SHA1 digest and of the blocks it is computed over */
+#define SHA1_DIGEST_LEN 20
+#define SHA1_BLOCK_LEN 64
+
+/* most messages sha1_many() hashes in lockstep */
+#define SHA1_LANES 8
+
+/* SHA1 implementations, fastest first; sha1_select() picks one, the best the CPU supports by default */
+#define SHA1_SHANI 0   // Intel SHA extensions, one message at a time
+#define SHA1_AVX2 1    // AVX2, SHA1_LANES messages side by side in the lanes of 256-bit registers
+#define SHA1_SCALAR 2  // portable C
+#define SHA1_N_BACKENDS 3
+
+/* a SHA1 being computed piecemeal */
+typedef struct {
+    uint32_t h[5];  // chaining state
+    uint64_t length;    // bytes fed so far
+    unsigned char block[SHA1_BLOCK_LEN];    // the partial block, length % SHA1_BLOCK_LEN bytes of it
+} sha1_ctx_t;
+
+/**
+ * sha1_init(sha1_ctx_t *ctx) -> void
+ **/
+void sha1_init(sha1_ctx_t *ctx);
+
+/**
+ * sha1_update(sha1_ctx_t *ctx, const unsigned char *data, size_t len) -> void
+ *
+ * append len bytes at data to the message being hashed
+ **/
+void sha1_update(sha1_ctx_t *ctx, const unsigned char *data, size_t len);
+
+/**
+ * sha1_final(sha1_ctx_t *ctx, unsigned char *digest) -> void
+ *
+ * pad the message and write its SHA1_DIGEST_LEN-byte digest; ctx must be
+ * initialized again before it is reused
+ **/
+void sha1_final(sha1_ctx_t *ctx, unsigned char *digest);
+
+/**
+ * sha1(const unsigned char *data, size_t len, unsigned char *digest) -> void
+ *
+ * one-shot SHA1 of len bytes at data
+ **/
+void sha1(const unsigned char *data, size_t len, unsigned char *digest);
+
+/**
+ * sha1_many(const unsigned char *const *data, const size_t *len, int n, unsigned char *digests) -> void
+ *
+ * hash n (at most SHA1_LANES) independent messages; digest i goes to
+ * digests + i * SHA1_DIGEST_LEN. With the AVX2 backend the blocks all the
+ * messages have in common are hashed in lockstep, the rest one by one
+ **/
+void sha1_many(const unsigned char *const *data, const size_t *len, int n, unsigned char *digests);
+
+/**
+ * sha1_select(int backend) -> int
+ *
+ * switch every later hash to backend (SHA1_SHANI, SHA1_AVX2 or
+ * SHA1_SCALAR), e.g. to compare them. At startup the fastest one the CPU
+ * supports is selected, unless the environment variable BT_SHA1 names
+ * another ("shani", "avx2" or "scalar").
+ *
+ * Return: 0 on success, -1 if the CPU does not support backend
+ **/
+int sha1_select(int backend);
+
+/**
+ * sha1_backend_name(int backend) -> const char *
+ *
+ * Return: the name of backend, or of the one in use if backend is -1
+ **/
+const char * sha1_backend_name(int backend);
+
+#endif
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bt_slab.h"
+
+/* header of a chunk; the objects (or arena allocations) follow it, SLAB_ALIGN-aligned */
+struct slab_chunk {
+    slab_chunk_t *next;
+};
+
+struct arena_chunk {
+    arena_chunk_t *next;
+};
+
+/* bytes taken by either header, rounded so what follows stays aligned */
+#define CHUNK_HDR ((sizeof(slab_chunk_t) + SLAB_ALIGN - 1) & ~(size_t) (SLAB_ALIGN - 1))
+
+/**
+ * align_up() rounds size up to a multiple of SLAB_ALIGN
+ **/
+static size_t align_up(size_t size) {
+    return (size + SLAB_ALIGN - 1) & ~(size_t) (SLAB_ALIGN - 1);
+}
+
+/**
+ * slab_init() only records the object size; chunks come with the first allocation
+ **/
+void slab_init(slab_t *slab, size_t size) {
+    slab->size = align_up(size < sizeof(void *) ? sizeof(void *) : size);
+    slab->per_chunk = SLAB_CHUNK_BYTES / slab->size;
+    if (slab->per_chunk < 1) {
+        slab->per_chunk = 1;
+    }
+    slab->free_list = NULL;
+    slab->chunks = NULL;
+    slab->in_use = 0;
+}
+
+/**
+ * slab_grow() allocates a chunk and threads all of its objects onto the free list
+ **/
+static int slab_grow(slab_t *slab) {
+    slab_chunk_t *chunk;
+    unsigned char *obj;
+    int i;
+
+    if ( (chunk = malloc(CHUNK_HDR + slab->per_chunk * slab->size)) == NULL ) {
+        return -1;
+    }
+    chunk->next = slab->chunks;
+    slab->chunks = chunk;
+
+    // last object first, so they are handed out in address order
+    obj = (unsigned char *) chunk + CHUNK_HDR + (slab->per_chunk - 1) * slab->size;
+    for (i = 0; i < slab->per_chunk; i++, obj -= slab->size) {
+        *(void **) obj = slab->free_list;
+        slab->free_list = obj;
+    }
+    return 0;
+}
+
+/**
+ * slab_alloc() pops the free list
+ **/
+void * slab_alloc(slab_t *slab) {
+    void *obj;
+
+    if ( slab->free_list == NULL && slab_grow(slab) < 0 ) {
+        return NULL;
+    }
+    obj = slab->free_list;
+    slab->free_list = *(void **) obj;
+    slab->in_use++;
+    return obj;
+}
+
+/**
+ * slab_free() pushes onto the free list
+ **/
+void slab_free(slab_t *slab, void *obj) {
+    if (obj == NULL) {
+        return;
+    }
+    *(void **) obj = slab->free_list;
+    slab->free_list = obj;
+    slab->in_use--;
+}
+
+/**
+ * slab_destroy() frees the chunks
+ **/
+void slab_destroy(slab_t *slab) {
+    slab_chunk_t *chunk;
+
+    while ( (chunk = slab->chunks) != NULL ) {
+        slab->chunks = chunk->next;
+        free(chunk);
+    }
+    slab->free_list = NULL;
+    slab->in_use = 0;
+}
+
+/**
+ * size_class() finds the smallest class holding size bytes
+ *
+ * Return: the class, -1 if size is bigger than every class
+ **/
+static int size_class(size_t size) {
+    int c;
+
+    for (c = 0; c < SLAB_CLASSES; c++) {
+        if ( size <= ((size_t) 1 << (SLAB_MIN_SHIFT + c)) ) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+/**
+ * slab_set_init() gives class c objects of 1 << (SLAB_MIN_SHIFT + c) bytes
+ **/
+void slab_set_init(slab_set_t *set) {
+    int c;
+
+    for (c = 0; c < SLAB_CLASSES; c++) {
+        slab_init(&set->classes[c], (size_t) 1 << (SLAB_MIN_SHIFT + c));
+    }
+}
+
+/**
+ * slab_set_alloc() allocates from the class of size
+ **/
+void * slab_set_alloc(slab_set_t *set, size_t size) {
+    int c = size_class(size);
+
+    return (c < 0) ? malloc(size) : slab_alloc(&set->classes[c]);
+}
+
+/**
+ * slab_set_free() frees to the class of size
+ **/
+void slab_set_free(slab_set_t *set, void *buf, size_t size) {
+    int c = size_class(size);
+
+    if (c < 0) {
+        free(buf);
+    } else {
+        slab_free(&set->classes[c], buf);
+    }
+}
+
+/**
+ * slab_set_destroy() destroys every class
+ **/
+void slab_set_destroy(slab_set_t *set) {
+    int c;
+
+    for (c = 0; c < SLAB_CLASSES; c++) {
+        slab_destroy(&set->classes[c]);
+    }
+}
+
+/**
+ * arena_init() starts without a chunk
+ **/
+void arena_init(arena_t *arena) {
+    arena->chunks = NULL;
+    arena->used = 0;
+    arena->cap = 0;
+}
+
+/**
+ * arena_alloc() bumps through the current chunk. A request too big for a chunk gets one of its own, linked in
+ * behind the current chunk so what is left of that is still used
+ **/
+void * arena_alloc(arena_t *arena, size_t size) {
+    arena_chunk_t *chunk;
+    unsigned char *mem;
+
+    size = align_up(size ? size : 1);
+
+    if (size > ARENA_CHUNK_BYTES - CHUNK_HDR) {
+        if ( (chunk = calloc(1, CHUNK_HDR + size)) == NULL ) {
+            return NULL;
+        }
+        if (arena->chunks) {
+            chunk->next = arena->chunks->next;
+            arena->chunks->next = chunk;
+        } else {
+            chunk->next = NULL;
+            arena->chunks = chunk;
+            arena->used = arena->cap = size;    // full
+        }
+        return (unsigned char *) chunk + CHUNK_HDR;
+    }
+
+    if (arena->used + size > arena->cap) {
+        if ( (chunk = calloc(1, ARENA_CHUNK_BYTES)) == NULL ) {
+            return NULL;
+        }
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->used = 0;
+        arena->cap = ARENA_CHUNK_BYTES - CHUNK_HDR;
+    }
+
+    mem = (unsigned char *) arena->chunks + CHUNK_HDR + arena->used;
+    arena->used += size;
+    return mem;
+}
+
+/**
+ * arena_free() frees the chunks
+ **/
+void arena_free(arena_t *arena) {
+    arena_chunk_t *chunk;
+
+    while ( (chunk = arena->chunks) != NULL ) {
+        arena->chunks = chunk->next;
+        free(chunk);
+    }
+    arena->used = 0;
+    arena->cap = 0;
+}
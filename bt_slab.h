@@ -0,0 +1,132 @@
+#ifndef _BT_SLAB_H
+#define _BT_SLAB_H
+
+#include <stddef.h>
+
+/* objects are aligned like malloc()'s */
+#define SLAB_ALIGN 16
+
+/* bytes a slab allocates at a time, carved into as many objects as fit (one at least) */
+#define SLAB_CHUNK_BYTES 65536
+
+/* size classes of a slab set: powers of two from 1 << SLAB_MIN_SHIFT bytes, SLAB_CLASSES of them (32 B to 64 KiB);
+ * anything bigger comes from malloc() */
+#define SLAB_MIN_SHIFT 5
+#define SLAB_CLASSES 12
+
+/* bytes an arena allocates at a time; bigger requests get a chunk of their own */
+#define ARENA_CHUNK_BYTES 65536
+
+typedef struct slab_chunk slab_chunk_t;
+typedef struct arena_chunk arena_chunk_t;
+
+/* pool of equally sized objects. Freed objects go on a free list and are handed out again, so churning through
+ * them never reaches malloc(); the chunks are only given back all at once, by slab_destroy() */
+typedef struct {
+    size_t size;    // bytes per object, rounded up to SLAB_ALIGN
+    int per_chunk;  // objects carved from each chunk
+    void *free_list;    // free objects, linked through their first word
+    slab_chunk_t *chunks;   // every chunk allocated
+    int in_use; // objects handed out and not freed
+} slab_t;
+
+/* one slab per power-of-two size class, for buffers whose size is known again when they are freed */
+typedef struct {
+    slab_t classes[SLAB_CLASSES];
+} slab_set_t;
+
+/* bump allocator for data that lives as long as the arena does, freed in one go */
+typedef struct {
+    arena_chunk_t *chunks;  // most recent first; allocations come out of the first
+    size_t used;    // bytes of the first chunk handed out
+    size_t cap; // bytes of the first chunk
+} arena_t;
+
+/**
+ * slab_init(slab_t *slab, size_t size) -> void
+ *
+ * set up an empty slab of size-byte objects; nothing is allocated until
+ * the first slab_alloc()
+ **/
+void slab_init(slab_t *slab, size_t size);
+
+/**
+ * slab_alloc(slab_t *slab) -> void *
+ *
+ * take an object off the free list, carving a new chunk if it is empty.
+ * The object is not zeroed.
+ *
+ * Return: the object, NULL if no memory
+ **/
+void * slab_alloc(slab_t *slab);
+
+/**
+ * slab_free(slab_t *slab, void *obj) -> void
+ *
+ * put an object from slab_alloc() back on the free list (NULL is ignored)
+ **/
+void slab_free(slab_t *slab, void *obj);
+
+/**
+ * slab_destroy(slab_t *slab) -> void
+ *
+ * free every chunk, objects still in use included, and leave the slab empty
+ **/
+void slab_destroy(slab_t *slab);
+
+/**
+ * slab_set_init(slab_set_t *set) -> void
+ *
+ * set up a slab for every size class
+ **/
+void slab_set_init(slab_set_t *set);
+
+/**
+ * slab_set_alloc(slab_set_t *set, size_t size) -> void *
+ *
+ * allocate size bytes from the smallest class that holds them, or from
+ * malloc() if none does
+ *
+ * Return: the buffer (not zeroed), NULL if no memory
+ **/
+void * slab_set_alloc(slab_set_t *set, size_t size);
+
+/**
+ * slab_set_free(slab_set_t *set, void *buf, size_t size) -> void
+ *
+ * give back a buffer of slab_set_alloc(); size must be the one it was
+ * allocated with
+ **/
+void slab_set_free(slab_set_t *set, void *buf, size_t size);
+
+/**
+ * slab_set_destroy(slab_set_t *set) -> void
+ *
+ * slab_destroy() every class
+ **/
+void slab_set_destroy(slab_set_t *set);
+
+/**
+ * arena_init(arena_t *arena) -> void
+ *
+ * set up an empty arena
+ **/
+void arena_init(arena_t *arena);
+
+/**
+ * arena_alloc(arena_t *arena, size_t size) -> void *
+ *
+ * allocate size bytes, aligned to SLAB_ALIGN, that stay until arena_free()
+ *
+ * Return: the memory (zeroed), NULL if no memory
+ **/
+void * arena_alloc(arena_t *arena, size_t size);
+
+/**
+ * arena_free(arena_t *arena) -> void
+ *
+ * free everything allocated from the arena
+ **/
+void arena_free(arena_t *arena);
+
+#endif
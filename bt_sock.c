@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <arpa/inet.h>  // for inet_ntoa()
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+
+#include "bt_lib.h"
+#include "bt_sock.h"
+#include "bt_peer.h"
+#include "bt_wire.h"
+#include "bt_resolve.h"
+
+/**
+ * set_nonblocking() switches O_NONBLOCK on for a socket, keeping its other file status flags
+ **/
+int set_nonblocking(int sock) {
+    int flags;
+
+    if ( (flags = fcntl(sock, F_GETFL, 0)) < 0 ) {
+        return -1;
+    }
+
+    return fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+}
+
+/**
+ * reactor_init() creates the epoll instance for this client
+ **/
+int reactor_init(bt_args_t *bt_args) {
+
+    if ( (bt_args->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0 ) {
+        fprintf(stderr, "ERROR: Could not create the epoll event loop.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * reactor_add() registers a socket with the epoll instance, edge-triggered
+ **/
+int reactor_add(bt_args_t *bt_args, int sock) {
+    struct epoll_event ev;
+
+    memset(&ev, 0x00, sizeof(ev));
+    ev.events = BT_EPOLL_EVENTS;
+    ev.data.fd = sock;
+
+    if ( epoll_ctl(bt_args->epoll_fd, EPOLL_CTL_ADD, sock, &ev) < 0 ) {
+        fprintf(stderr, "ERROR: Could not add socket %d to the event loop.\n", sock);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * reactor_del() removes a socket from the epoll instance
+ **/
+int reactor_del(bt_args_t *bt_args, int sock) {
+    struct epoll_event ev;  // ignored by the kernel, but must be non-NULL on old kernels
+
+    return epoll_ctl(bt_args->epoll_fd, EPOLL_CTL_DEL, sock, &ev);
+}
+
+/**
+ * spawn_helpers() blocks every signal while the threads are created, so they inherit the full mask
+ **/
+int spawn_helpers(pthread_t *threads, int n, void *(*run)(void *), void *arg) {
+    sigset_t all, old;
+    int i, n_started = 0;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (i = 0; i < n; i++) {
+        if ( pthread_create(&threads[n_started], NULL, run, arg) == 0 ) {
+            n_started++;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return n_started;
+}
+
+/**
+ * wake_loop() adds one to the eventfd counter
+ **/
+void wake_loop(int event_fd) {
+    uint64_t one = 1;
+
+    if ( write(event_fd, &one, sizeof(one)) < 0 ) {
+        ;   // counter saturated: the event loop is awake already
+    }
+}
+
+/**
+ * accept_peers() accepts all pending connections on the listen socket
+ **/
+int accept_peers(bt_args_t *bt_args) {
+    struct sockaddr_in leecher_info;    // to fill in all relevant leecher information
+    socklen_t leecher_length;
+    int new_sock;   // socket allocated to exchange data with one leecher
+    int n_accepted = 0;
+    int slot;   // new peer's slot in the peer table
+    peer_t *peer;
+
+    while (1) {
+        leecher_length = sizeof(leecher_info);
+        new_sock = accept(bt_args->listen_sock, (struct sockaddr *) &leecher_info, &leecher_length);
+
+        if (new_sock < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;   // try the next pending connection
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                fprintf(stderr, "ERROR: Seeder could not accept a leecher connection: %s\n", strerror(errno));
+            }
+            break;  // backlog drained (or accept failed); wait for the next edge
+        }
+
+        if ( set_nonblocking(new_sock) < 0 ) {
+            fprintf(stderr, "ERROR: Could not make leecher socket non-blocking.\n");
+            close(new_sock);
+            continue;
+        }
+
+        if ( (peer = slab_alloc(&bt_args->peer_slab)) == NULL ) {
+            fprintf(stderr, "ERROR: Could not allocate a peer for leecher '%s:%u'.\n",
+                    inet_ntoa(leecher_info.sin_addr), ntohs(leecher_info.sin_port));
+            close(new_sock);
+            continue;
+        }
+        if ( (slot = add_peer(peer, bt_args, inet_ntoa(leecher_info.sin_addr), ntohs(leecher_info.sin_port))) < 0 ) {
+            fprintf(stderr, "ERROR: Leecher '%s:%u' is already connected, connection refused.\n",
+                    inet_ntoa(leecher_info.sin_addr), ntohs(leecher_info.sin_port));
+            slab_free(&bt_args->peer_slab, peer);
+            close(new_sock);
+            continue;
+        }
+
+        if ( peer_table_set_fd(&bt_args->peers, slot, new_sock) < 0 ) {
+            close(new_sock);
+            drop_peer(peer, bt_args);
+            continue;
+        }
+        if ( wire_init(bt_args, peer) < 0 || reactor_add(bt_args, new_sock) < 0 ) {
+            drop_peer(peer, bt_args);
+            continue;
+        }
+
+        if (bt_args->verbose) {
+            printf("ACCEPTED connection from leecher: '%s:%u'\n", inet_ntoa(leecher_info.sin_addr), ntohs(leecher_info.sin_port));
+        }
+        n_accepted++;
+    }
+
+    return n_accepted;
+}
+
+/**
+ * connect_failed() closes the socket of a connect that did not work out and schedules the next attempt, or
+ * drops the peer once it has had all of them
+ **/
+static void connect_failed(bt_args_t *bt_args, peer_t *peer, const char *why) {
+    peer_table_t *peers = &bt_args->peers;
+    int sock = peers->fd[peer->slot];
+    int backoff_ms = CONNECT_BACKOFF_MS;
+    int i;
+
+    if (sock >= 0) {
+        reactor_del(bt_args, sock);
+        close(sock);
+        peer_table_set_fd(peers, peer->slot, -1);
+    }
+    if (peers->flags[peer->slot] & PEER_CONNECTING) {
+        peers->flags[peer->slot] &= ~PEER_CONNECTING;
+        bt_args->n_half_open--;
+    }
+    peer->resolved = 0; // the next attempt checks the name again, against the resolver's cache
+
+    if (peer->connect_attempts >= CONNECT_MAX_ATTEMPTS) {
+        fprintf(stderr, "ERROR: Giving up on peer '%s:%u' after %d attempts: %s\n",
+                peer->host, peer->port, peer->connect_attempts, why);
+        drop_peer(peer, bt_args);
+        return;
+    }
+
+    for (i = 1; i < peer->connect_attempts && backoff_ms < CONNECT_BACKOFF_MAX_MS; i++) {
+        backoff_ms *= 2;
+    }
+    if (backoff_ms > CONNECT_BACKOFF_MAX_MS) {
+        backoff_ms = CONNECT_BACKOFF_MAX_MS;
+    }
+    peer->connect_at_ms = now_ms() + backoff_ms;
+    fprintf(stderr, "ERROR: Could not connect to peer '%s:%u': %s; trying again in %d ms.\n",
+            peer->host, peer->port, why, backoff_ms);
+}
+
+/**
+ * connect_start() opens a non-blocking socket and starts connecting it; the reactor reports EPOLLOUT once the
+ * connect is over
+ *
+ * Return: 0 if the connect is in progress, -1 (errno set) if it failed right away
+ **/
+static int connect_start(bt_args_t *bt_args, peer_t *peer) {
+    peer_table_t *peers = &bt_args->peers;
+    int sock;
+
+    peer->connect_attempts++;
+    if ( (sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP)) < 0 ) {
+        return -1;
+    }
+    if ( connect(sock, (struct sockaddr *) &peer->sockaddr, sizeof(peer->sockaddr)) < 0 && errno != EINPROGRESS ) {
+        close(sock);
+        return -1;
+    }
+    if ( peer_table_set_fd(peers, peer->slot, sock) < 0 ) {
+        close(sock);
+        errno = ENOMEM;
+        return -1;
+    }
+    if ( reactor_add(bt_args, sock) < 0 ) {
+        peer_table_set_fd(peers, peer->slot, -1);
+        close(sock);
+        return -1;
+    }
+
+    peers->flags[peer->slot] |= PEER_CONNECTING;
+    bt_args->n_half_open++;
+    peer->connect_at_ms = now_ms() + CONNECT_TIMEOUT_MS;
+    return 0;
+}
+
+/**
+ * connect_peers() walks the table from the end, so a peer dropped (and replaced by the last one) has its slot
+ * looked at no more. A peer known by name is only dialed once the resolver has its address
+ **/
+void connect_peers(bt_args_t *bt_args) {
+    peer_table_t *peers = &bt_args->peers;
+    long long now = now_ms();
+    const char *error;
+    peer_t *peer;
+    int slot;
+
+    for (slot = peers->n_peers - 1; slot >= 0; slot--) {
+        peer = peers->peer[slot];
+
+        if (peers->flags[slot] & PEER_CONNECTING) {
+            if (now >= peer->connect_at_ms) {
+                connect_failed(bt_args, peer, "timed out");
+            }
+        } else if ( peers->fd[slot] < 0 && now >= peer->connect_at_ms && bt_args->n_half_open < MAX_HALF_OPEN ) {
+            if (!peer->resolved) {
+                switch ( resolve_lookup(bt_args, peer->host, &peer->sockaddr.sin_addr, &error) ) {
+                    case 0: // being looked up; resolver_collect() makes the peer due again
+                        peer->connect_at_ms = now + CONNECT_TIMEOUT_MS;
+                        continue;
+                    case -1:
+                        peer->connect_attempts++;
+                        connect_failed(bt_args, peer, error);
+                        continue;
+                }
+                peer->resolved = 1;
+            }
+            if (bt_args->verbose) {
+                printf("CONNECTING to PEER: '%s:%u' (attempt %d)\n", peer->host, peer->port, peer->connect_attempts + 1);
+            }
+            if ( connect_start(bt_args, peer) < 0 ) {
+                connect_failed(bt_args, peer, strerror(errno));
+            }
+        }
+    }
+}
+
+/**
+ * connect_ready() reads the outcome of the connect off SO_ERROR; we speak first, the seeder answers with its
+ * handshake and bitfield
+ **/
+void connect_ready(bt_args_t *bt_args, peer_t *peer, uint32_t events) {
+    peer_table_t *peers = &bt_args->peers;
+    unsigned char handshake[HANDSHAKE_LEN];
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    if ( getsockopt(peers->fd[peer->slot], SOL_SOCKET, SO_ERROR, &err, &len) < 0 ) {
+        err = errno;
+    }
+    if ( err == 0 && (events & (EPOLLERR | EPOLLHUP)) ) {
+        err = ECONNREFUSED;
+    }
+    if (err) {
+        connect_failed(bt_args, peer, strerror(err));
+        return;
+    }
+    if ( !(events & EPOLLOUT) ) {
+        return; // still connecting
+    }
+
+    peers->flags[peer->slot] &= ~PEER_CONNECTING;
+    bt_args->n_half_open--;
+    peer->connect_attempts = 0;
+    printf("CONNECTION ESTABLISHED to PEER: '%s:%u'; peer id: %s\n", inet_ntoa(peer->sockaddr.sin_addr), peer->port, get_hashhex(peer->id));
+
+    if ( wire_init(bt_args, peer) < 0 ) {
+        drop_peer(peer, bt_args);
+        return;
+    }
+    printf("HANDSHAKE INIT to peer: %s port: %u; peer id: %s\n", inet_ntoa(peer->sockaddr.sin_addr), peer->port, get_hashhex(peer->id));
+    init_handshake(bt_args, handshake);
+    if ( wire_queue(bt_args, peer, handshake, HANDSHAKE_LEN) < 0 ) {
+        drop_peer(peer, bt_args);
+        return;
+    }
+    peer->hs_state |= HS_SENT;
+}
@@ -0,0 +1,131 @@
+#ifndef _BT_SOCK_H
+#define _BT_SOCK_H
+
+// standard stuff
+#include <stdint.h>
+#include <pthread.h>
+
+// networking stuff
+#include <sys/epoll.h>
+
+#include "bt_lib.h"
+
+/* maximum number of ready events pulled off the epoll queue in one wait */
+#define MAX_EVENTS 64
+
+/* backlog of pending connections the kernel queues for the seeder's listen socket */
+#define LISTEN_BACKLOG 128
+
+/* how long (in ms) one turn of the main loop waits for socket activity */
+#define LOOP_TICK_MS 1000
+
+/* events every socket is registered for: readable, writable again, peer hung up, edge-triggered */
+#define BT_EPOLL_EVENTS (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET)
+
+/* most connects to peers in progress at once; the other peers wait their turn */
+#define MAX_HALF_OPEN 8
+
+/* a connect not over after this long (ms) counts as failed */
+#define CONNECT_TIMEOUT_MS 5000
+
+/* wait before dialing a peer again after its first failed connect (ms); doubles with each failure up to
+ * CONNECT_BACKOFF_MAX_MS */
+#define CONNECT_BACKOFF_MS 1000
+#define CONNECT_BACKOFF_MAX_MS 30000
+
+/* failed connects in a row after which a peer is given up on */
+#define CONNECT_MAX_ATTEMPTS 5
+
+/**
+ * set_nonblocking(int sock) -> int
+ *
+ * switch sock to non-blocking mode so that reads, writes and accepts
+ * return EAGAIN instead of parking the whole client on one peer
+ *
+ * Return: 0 on success, -1 on failure
+ **/
+int set_nonblocking(int sock);
+
+/**
+ * reactor_init(bt_args_t *bt_args) -> int
+ *
+ * create the epoll instance that owns the listen socket and every peer
+ * socket of this client; stored in bt_args->epoll_fd
+ *
+ * Return: 0 on success, -1 on failure
+ **/
+int reactor_init(bt_args_t *bt_args);
+
+/**
+ * reactor_add(bt_args_t *bt_args, int sock) -> int
+ *
+ * register sock with the reactor for BT_EPOLL_EVENTS; events on it carry
+ * sock, which poll_peers() maps back to a peer through the peer table
+ *
+ * Return: 0 on success, -1 on failure
+ **/
+int reactor_add(bt_args_t *bt_args, int sock);
+
+/**
+ * reactor_del(bt_args_t *bt_args, int sock) -> int
+ *
+ * stop watching sock; must be called before sock is closed
+ *
+ * Return: 0 on success, -1 on failure
+ **/
+int reactor_del(bt_args_t *bt_args, int sock);
+
+/**
+ * spawn_helpers(pthread_t *threads, int n, void *(*run)(void *), void *arg) -> int
+ *
+ * start up to n helper threads running run(arg), their ids stored in
+ * threads. Helpers that hand results to the event loop wake it with
+ * wake_loop() on an eventfd the reactor watches. They block every signal:
+ * signals are for the main thread, which is the one that shuts down.
+ *
+ * Return: number of threads started (0 if none could be)
+ **/
+int spawn_helpers(pthread_t *threads, int n, void *(*run)(void *), void *arg);
+
+/**
+ * wake_loop(int event_fd) -> void
+ *
+ * called by a helper thread once it posted a result: bump event_fd so
+ * the event loop's next wait returns and collects it
+ **/
+void wake_loop(int event_fd);
+
+/**
+ * accept_peers(bt_args_t *bt_args) -> int
+ *
+ * drain the seeder's listen socket: accept every pending leecher connection
+ * (edge-triggered, so until EAGAIN), make it non-blocking and hand it to the
+ * reactor as a new peer
+ *
+ * Return: number of peers accepted
+ **/
+int accept_peers(bt_args_t *bt_args);
+
+/**
+ * connect_peers(bt_args_t *bt_args) -> void
+ *
+ * called once per turn of the event loop: start a non-blocking connect()
+ * to every peer without a socket whose time has come, at most
+ * MAX_HALF_OPEN in progress at once, and fail the connects that took
+ * longer than CONNECT_TIMEOUT_MS. A failed peer is dialed again after an
+ * exponential backoff and dropped after CONNECT_MAX_ATTEMPTS failures. A
+ * peer given by host name waits for resolve_lookup() first; a name that
+ * does not resolve counts as a failed connect.
+ **/
+void connect_peers(bt_args_t *bt_args);
+
+/**
+ * connect_ready(bt_args_t *bt_args, peer_t *peer, uint32_t events) -> void
+ *
+ * called by poll_peers() on the first event of a socket whose connect is
+ * in progress: on success the peer gets its buffers and our handshake is
+ * queued; on failure the connect is retried later as above
+ **/
+void connect_ready(bt_args_t *bt_args, peer_t *peer, uint32_t events);
+
+#endif
@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "bt_lib.h"
+#include "bt_verify.h"
+#include "bt_hash.h"
+#include "bt_io.h"
+#include "bt_sock.h"
+#include "bt_bitfield.h"
+#include "bt_resume.h"
+
+/**
+ * next_demanded() takes the oldest piece a peer is waiting for off the demand queue
+ *
+ * Return: its index, -1 if the queue is empty
+ **/
+static int next_demanded(verify_job_t *job) {
+    int i = -1;
+
+    pthread_mutex_lock(&job->lock);
+    if (job->demand_next < job->n_demand) {
+        i = job->demand[job->demand_next++];
+    }
+    pthread_mutex_unlock(&job->lock);
+    return i;
+}
+
+/**
+ * claim_piece() picks the next piece to hash: one peers asked for if any, else the next one of the scan that is
+ * still pending. The scan skips queued pieces, which were put on the demand queue under the lock before their
+ * state changed, so a worker that sees the scan run out still finds them there
+ *
+ * Return: the piece, -1 if none is left
+ **/
+static int claim_piece(verify_job_t *job) {
+    int num_pieces = job->bt_args->bt_info->num_pieces;
+    unsigned char pending;
+    int i;
+
+    while ( (i = next_demanded(job)) < 0 ) {
+        if ( (i = __atomic_fetch_add(&job->next_piece, 1, __ATOMIC_RELAXED)) >= num_pieces ) {
+            if ( (i = next_demanded(job)) < 0 ) {
+                return -1;
+            }
+            break;
+        }
+        pending = VERIFY_PENDING;
+        if ( __atomic_compare_exchange_n(&job->state[i], &pending, VERIFY_CLAIMED, 0, __ATOMIC_ACQ_REL,
+                __ATOMIC_RELAXED) ) {
+            return i;
+        }
+    }
+    __atomic_store_n(&job->state[i], VERIFY_CLAIMED, __ATOMIC_RELAXED);
+    return i;
+}
+
+/**
+ * verify_worker() hashes pieces until none are left, posting each result
+ **/
+static void * verify_worker(void *arg) {
+    verify_job_t *job = arg;
+    bt_args_t *bt_args = job->bt_args;
+    unsigned char result;
+    int i;
+
+    while ( !__atomic_load_n(&job->stop, __ATOMIC_RELAXED) && (i = claim_piece(job)) >= 0 ) {
+        result = verify_piece(&bt_args->store, bt_args->bt_info, i) ? VERIFY_VALID : VERIFY_BAD;
+        __atomic_store_n(&job->state[i], result, __ATOMIC_RELEASE);
+
+        pthread_mutex_lock(&job->lock);
+        job->results[job->n_results++] = i;
+        pthread_mutex_unlock(&job->lock);
+
+        wake_loop(job->event_fd);
+    }
+    return NULL;
+}
+
+/**
+ * piece_passed() sets a piece that checked out and tells the peers, unless that happened already
+ **/
+static void piece_passed(bt_args_t *bt_args, int index) {
+    if ( bitfield_test(bt_args->bitfield, index) ) {
+        return;
+    }
+    bitfield_set(bt_args->bitfield, index);
+    announce_piece(bt_args, index);
+    if (bt_args->verbose) {
+        printf("Piece %d verified.\n", index);
+    }
+}
+
+/**
+ * verify_finish() joins the workers once every piece is checked; the bitfield is complete now, so it is worth
+ * a fast-resume sidecar
+ **/
+static void verify_finish(bt_args_t *bt_args) {
+    verify_job_t *job = bt_args->verify;
+
+    printf("VERIFY COMPLETE: %d of %d pieces of '%s' verified.\n", job->n_valid, bt_args->bt_info->num_pieces,
+            payload_path(bt_args));
+    verify_free(bt_args);
+
+    store_advise(&bt_args->store, STORE_RANDOM);
+    resume_save(bt_args);
+}
+
+/**
+ * verify_start() starts one worker per core; the scan competes with serving for the disk, but requested pieces
+ * jump the queue (see verify_demand())
+ **/
+int verify_start(bt_args_t *bt_args) {
+    int num_pieces = bt_args->bt_info->num_pieces;
+    int n_threads = hash_threads(num_pieces);
+    verify_job_t *job;
+
+    if ( (job = calloc(1, sizeof(verify_job_t))) == NULL ) {
+        return -1;
+    }
+    job->bt_args = bt_args;
+    job->event_fd = -1;
+    pthread_mutex_init(&job->lock, NULL);
+
+    if ( (job->state = calloc(num_pieces, 1)) == NULL || (job->demand = malloc(num_pieces * sizeof(int))) == NULL ||
+            (job->results = malloc(num_pieces * sizeof(int))) == NULL ||
+            (job->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 || reactor_add(bt_args, job->event_fd) < 0 ) {
+        goto FAIL;
+    }
+    bt_args->verify = job;
+
+    job->n_threads = spawn_helpers(job->threads, n_threads, verify_worker, job);
+
+    if (job->n_threads == 0) {
+        bt_args->verify = NULL;
+        reactor_del(bt_args, job->event_fd);
+        goto FAIL;
+    }
+
+    printf("VERIFYING: '%s' in the background on %d threads; serving pieces as they pass.\n", payload_path(bt_args),
+            job->n_threads);
+    return 0;
+
+    FAIL:
+        if (job->event_fd >= 0) {
+            close(job->event_fd);
+        }
+        pthread_mutex_destroy(&job->lock);
+        free(job->results);
+        free(job->demand);
+        free(job->state);
+        free(job);
+        return -1;
+}
+
+/**
+ * verify_collect() drains the eventfd counter, then every result posted so far
+ **/
+void verify_collect(bt_args_t *bt_args) {
+    verify_job_t *job = bt_args->verify;
+    uint64_t count;
+    int n_results, i;
+
+    if (job == NULL) {
+        return;
+    }
+    if ( read(job->event_fd, &count, sizeof(count)) < 0 ) {
+        ;   // nothing new; the results are looked at anyway
+    }
+
+    pthread_mutex_lock(&job->lock);
+    n_results = job->n_results;
+    pthread_mutex_unlock(&job->lock);
+
+    for (; job->n_collected < n_results; job->n_collected++) {
+        i = job->results[job->n_collected];
+        job->n_checked++;
+        if ( __atomic_load_n(&job->state[i], __ATOMIC_ACQUIRE) == VERIFY_VALID ) {
+            job->n_valid++;
+            piece_passed(bt_args, i);
+        }
+    }
+
+    if (job->n_checked == bt_args->bt_info->num_pieces) {
+        verify_finish(bt_args);
+    }
+}
+
+/**
+ * verify_demand() queues a pending piece for the workers. Nothing is hashed here: the event loop never waits for
+ * the disk, and a piece a worker has claimed already is not hashed twice
+ **/
+int verify_demand(bt_args_t *bt_args, int index) {
+    verify_job_t *job = bt_args->verify;
+    unsigned char state = VERIFY_PENDING;
+
+    if (job == NULL) {
+        return 0;   // the recheck is over: the bitfield is final
+    }
+
+    pthread_mutex_lock(&job->lock);
+    if ( __atomic_compare_exchange_n(&job->state[index], &state, VERIFY_QUEUED, 0, __ATOMIC_ACQ_REL,
+            __ATOMIC_ACQUIRE) ) {
+        job->demand[job->n_demand++] = index;
+        state = VERIFY_QUEUED;
+    }
+    pthread_mutex_unlock(&job->lock);
+
+    // state now holds what the piece's check is at
+    if (state == VERIFY_VALID) {    // checked, result not collected yet
+        piece_passed(bt_args, index);
+        return 1;
+    }
+    return (state == VERIFY_BAD) ? 0 : -1;
+}
+
+/**
+ * verify_free() stops the workers at their next piece and waits for them
+ **/
+void verify_free(bt_args_t *bt_args) {
+    verify_job_t *job = bt_args->verify;
+    int i;
+
+    if (job == NULL) {
+        return;
+    }
+
+    __atomic_store_n(&job->stop, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < job->n_threads; i++) {
+        pthread_join(job->threads[i], NULL);
+    }
+
+    reactor_del(bt_args, job->event_fd);
+    close(job->event_fd);
+    pthread_mutex_destroy(&job->lock);
+    free(job->results);
+    free(job->demand);
+    free(job->state);
+    free(job);
+    bt_args->verify = NULL;
+}
@@ -0,0 +1,83 @@
+#ifndef _BT_VERIFY_H
+#define _BT_VERIFY_H
+
+#include <pthread.h>
+
+#include "bt_lib.h"
+#include "bt_hash.h"
+
+/* where the check of a piece stands, verify_job_t.state */
+#define VERIFY_PENDING 0   // not hashed yet
+#define VERIFY_CLAIMED 1   // being hashed
+#define VERIFY_VALID 2 // hashed, matches the torrent
+#define VERIFY_BAD 3   // hashed, does not match (or the file is short there)
+#define VERIFY_QUEUED 4    // not hashed yet, asked for by a peer: in the demand queue, ahead of the scan
+
+/* a background recheck of a seeder's payload. Worker threads scan the pieces front to back, taking the pieces
+ * peers asked for from demand[] first. Only the event loop touches bt_args->bitfield: workers hand their
+ * results over through results[] and wake it up through event_fd */
+typedef struct verify_job {
+    bt_args_t *bt_args; // the torrent and payload being checked
+    unsigned char *state;   // VERIFY_* of each piece (atomic)
+    int next_piece; // next piece of the sequential scan (atomic)
+    int stop;   // set to make workers quit early (atomic)
+
+    pthread_mutex_t lock;   // guards demand, n_demand, demand_next, results and n_results
+    int *demand;    // pieces queued by verify_demand(), in the order peers asked for them; each at most once
+    int n_demand;   // entries written to demand
+    int demand_next;    // next entry of demand to be claimed by a worker
+    int *results;   // pieces checked by the workers, in the order they finished
+    int n_results;  // entries written to results
+    int n_collected;    // entries the event loop has taken from results
+
+    int n_checked;  // pieces whose check is over, whoever ran it (event loop only)
+    int n_valid;    // of those, pieces that matched their hash
+    int event_fd;   // eventfd in the event loop's epoll set; workers add 1 per result
+    pthread_t threads[MAX_HASH_THREADS];
+    int n_threads;  // workers started
+} verify_job_t;
+
+/**
+ * verify_start(bt_args_t *bt_args) -> int
+ *
+ * start checking the payload in the background with bt_args->bitfield
+ * empty, so that serving can begin right away. Pieces are set in the
+ * bitfield and announced with BT_HAVE as they pass.
+ *
+ * Return: 0 if the check runs (bt_args->verify set), -1 if it could not
+ * be started and the payload has to be checked up front
+ **/
+int verify_start(bt_args_t *bt_args);
+
+/**
+ * verify_collect(bt_args_t *bt_args) -> void
+ *
+ * called by the event loop when the workers' event_fd is readable: take
+ * their results, announce the valid pieces and, once every piece is
+ * checked, wind the recheck down (bt_args->verify becomes NULL)
+ **/
+void verify_collect(bt_args_t *bt_args);
+
+/**
+ * verify_demand(bt_args_t *bt_args, int index) -> int
+ *
+ * a peer asked for piece index, which is not in bt_args->bitfield: have
+ * the workers check it next rather than when the scan gets there. The
+ * result is set and announced by verify_collect(); meanwhile the request
+ * waits at the head of the peer's upload queue (see flush_upload()).
+ * Asking again for a piece already queued does not queue it twice.
+ *
+ * Return: 1 if the piece is valid (and now set and announced), 0 if it
+ * failed its check or there is no recheck running, -1 while it is
+ * queued or being hashed
+ **/
+int verify_demand(bt_args_t *bt_args, int index);
+
+/**
+ * verify_free(bt_args_t *bt_args) -> void
+ *
+ * stop a recheck still running (on shutdown) and release it
+ **/
+void verify_free(bt_args_t *bt_args);
+
+#endif
@@ -0,0 +1,327 @@
+#define _GNU_SOURCE // memfd_create()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+
+#include "bt_lib.h"
+#include "bt_wire.h"
+#include "bt_bitfield.h"
+#include "bt_limit.h"
+
+/**
+ * get_be32() reads a big-endian 32-bit field from anywhere in a frame (fields need not be aligned)
+ **/
+static uint32_t get_be32(const unsigned char *p) {
+    uint32_t field;
+
+    memcpy(&field, p, 4);
+    return ntohl(field);
+}
+
+/**
+ * put_be32() writes a big-endian 32-bit field
+ **/
+static void put_be32(unsigned char *p, uint32_t value) {
+    value = htonl(value);
+    memcpy(p, &value, 4);
+}
+
+/**
+ * ring_size() is the capacity ring_init() gives a ring of at least min_size bytes
+ **/
+static size_t ring_size(size_t min_size) {
+    size_t size = RX_RING_MIN;
+
+    while (size < min_size) {
+        size <<= 1;
+    }
+    return size;
+}
+
+/**
+ * ring_init() maps a memfd of size bytes twice into one reserved range of 2 * size, so that the byte after the
+ * last one of the ring is its first one again
+ **/
+static int ring_init(bt_ring_t *ring, size_t min_size) {
+    size_t size = ring_size(min_size);
+    unsigned char *area;
+    int fd;
+
+    if ( (fd = memfd_create("bt_rx", MFD_CLOEXEC)) < 0 ) {
+        return -1;
+    }
+    if ( ftruncate(fd, size) < 0 ||
+            (area = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED ) {
+        close(fd);
+        return -1;
+    }
+    if ( mmap(area, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+            mmap(area + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ) {
+        munmap(area, 2 * size);
+        close(fd);
+        return -1;
+    }
+    close(fd);  // the mappings keep the memory alive
+
+    ring->buf = area;
+    ring->size = size;
+    ring->head = 0;
+    ring->tail = 0;
+    return 0;
+}
+
+/**
+ * wire_init() sizes both buffers so a whole BT_BITFILED fits: the ring must hold any frame we accept. Every ring
+ * of a torrent has the same size, so any spare one will do
+ **/
+int wire_init(bt_args_t *bt_args, peer_t *peer) {
+    int bitfield_msg = 5 + (bt_args->bt_info->num_pieces + 7) / 8;
+
+    if ( bt_args->n_spare_rx > 0 && bt_args->spare_rx[bt_args->n_spare_rx - 1].size == ring_size(4 + bitfield_msg) ) {
+        peer->rx = bt_args->spare_rx[--bt_args->n_spare_rx];
+        peer->rx.head = 0;
+        peer->rx.tail = 0;
+    } else if ( ring_init(&peer->rx, 4 + bitfield_msg) < 0 ) {
+        fprintf(stderr, "ERROR: Could not map a receive buffer: %s\n", strerror(errno));
+        return -1;
+    }
+
+    peer->tx_cap = TX_BUF_MIN + HANDSHAKE_LEN + bitfield_msg;
+    peer->tx_head = 0;
+    peer->tx_len = 0;
+    if ( (peer->tx_buf = slab_set_alloc(&bt_args->bufs, peer->tx_cap)) == NULL ) {
+        wire_free(bt_args, peer);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * wire_free() keeps the ring as a spare or unmaps it, and frees the send buffer
+ **/
+void wire_free(bt_args_t *bt_args, peer_t *peer) {
+    if (peer->rx.buf) {
+        if (bt_args->n_spare_rx < SPARE_RX_RINGS) {
+            bt_args->spare_rx[bt_args->n_spare_rx++] = peer->rx;
+        } else {
+            munmap(peer->rx.buf, 2 * peer->rx.size);
+        }
+        peer->rx.buf = NULL;
+    }
+    if (peer->tx_buf) {
+        slab_set_free(&bt_args->bufs, peer->tx_buf, peer->tx_cap);
+        peer->tx_buf = NULL;
+    }
+}
+
+/**
+ * wire_spares_free() unmaps every spare ring
+ **/
+void wire_spares_free(bt_args_t *bt_args) {
+    while (bt_args->n_spare_rx > 0) {
+        bt_ring_t *ring = &bt_args->spare_rx[--bt_args->n_spare_rx];
+
+        munmap(ring->buf, 2 * ring->size);
+    }
+}
+
+/**
+ * wire_fill() reads into the free part of the ring, as much as the download limit grants. Complete frames are
+ * always decoded before the next read, and no frame is bigger than the ring, so there is room for at least one byte
+ **/
+int wire_fill(bt_args_t *bt_args, peer_t *peer) {
+    bt_ring_t *rx = &peer->rx;
+    size_t room;
+    ssize_t n;
+
+    if ( (room = limit_grant(bt_args, peer, LIMIT_DOWN, rx->size - (rx->tail - rx->head))) == 0 ) {
+        return 0;   // held back; limit_turn() reads on once there are tokens
+    }
+
+    do {
+        n = read(bt_args->peers.fd[peer->slot], rx->buf + (rx->tail & (rx->size - 1)), room);
+    } while (n < 0 && errno == EINTR);
+
+    if (n == 0) {   // peer hung up
+        return -1;
+    }
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;   // nothing more for now
+        }
+        fprintf(stderr, "ERROR: Could not read from peer socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    rx->tail += n;
+    limit_charge(bt_args, peer, LIMIT_DOWN, n);
+    return (int) n;
+}
+
+/**
+ * wire_take() consumes len bytes from the front of the ring (the handshake, which has no length prefix)
+ *
+ * Return: pointer to the bytes, valid until the next read; NULL if fewer than len are in
+ **/
+unsigned char * wire_take(peer_t *peer, int len) {
+    bt_ring_t *rx = &peer->rx;
+    unsigned char *data = rx->buf + (rx->head & (rx->size - 1));
+
+    if (rx->tail - rx->head < (size_t) len) {
+        return NULL;
+    }
+    rx->head += len;
+    return data;
+}
+
+/**
+ * read_from_peer() checks the length prefix of the frame at the front of the ring and, once it is all there,
+ * decodes its fixed fields; variable-length payloads are left where they are and pointed to by msg->data. The
+ * frame is consumed right away: its bytes stay put until the next wire_fill(), after the caller is done with msg
+ **/
+int read_from_peer(bt_args_t *bt_args, peer_t *peer, bt_msg_t *msg) {
+    bt_ring_t *rx = &peer->rx;
+    unsigned char *frame = rx->buf + (rx->head & (rx->size - 1));
+    size_t avail = rx->tail - rx->head;
+    uint32_t len;
+
+    if (avail < 4) {
+        return 0;
+    }
+    if ( (len = get_be32(frame)) > rx->size - 4 ) {
+        return -1;  // bigger than any message of this torrent
+    }
+    if (avail < 4 + (size_t) len) {
+        return 0;   // partial frame; the rest comes with a later read
+    }
+    rx->head += 4 + len;
+
+    msg->length = len;
+    msg->data = NULL;
+    if (len == 0) {
+        msg->bt_type = BT_KEEP_ALIVE;
+        return 1;
+    }
+    msg->bt_type = frame[4];
+
+    switch (msg->bt_type) {
+        case BT_CHOKE:
+        case BT_UNCHOKE:
+        case BT_INTERESTED:
+        case BT_NOT_INTERESTED:
+            return (len == 1) ? 1 : -1;
+
+        case BT_HAVE:
+            if (len != 5) {
+                return -1;
+            }
+            msg->payload.have = get_be32(frame + 5);
+            return 1;
+
+        case BT_BITFILED:
+            msg->data = frame + 5;
+            return 1;
+
+        case BT_REQUEST:
+        case BT_CANCEL:
+            if (len != 13) {
+                return -1;
+            }
+            msg->payload.request.index = get_be32(frame + 5);
+            msg->payload.request.begin = get_be32(frame + 9);
+            msg->payload.request.length = get_be32(frame + 13);
+            return 1;
+
+        case BT_PIECE:
+            if (len < 9) {
+                return -1;
+            }
+            msg->payload.piece.index = get_be32(frame + 5);
+            msg->payload.piece.begin = get_be32(frame + 9);
+            msg->data = frame + 13;
+            return 1;
+
+        default:    // a message from a protocol extension; the caller skips it
+            return 1;
+    }
+}
+
+/**
+ * wire_queue() appends to the send buffer, first sliding what is unsent to the front if the end is in the way
+ **/
+int wire_queue(bt_args_t *bt_args, peer_t *peer, unsigned char *data, int len) {
+    if (peer->tx_len + len > peer->tx_cap && peer->tx_head > 0) {
+        memmove(peer->tx_buf, peer->tx_buf + peer->tx_head, peer->tx_len - peer->tx_head);
+        peer->tx_len -= peer->tx_head;
+        peer->tx_head = 0;
+    }
+    if (peer->tx_len + len > peer->tx_cap) {
+        return -1;
+    }
+
+    memcpy(peer->tx_buf + peer->tx_len, data, len);
+    peer->tx_len += len;
+    bt_args->peers.flags[peer->slot] |= PEER_TX_QUEUED;
+    return 0;
+}
+
+/**
+ * send_to_peer() encodes msg behind the messages already queued; they all leave together, in one system call,
+ * at the end of the event loop turn
+ **/
+int send_to_peer(bt_args_t *bt_args, peer_t *peer, bt_msg_t *msg) {
+    unsigned char frame[17];    // largest fixed-size message: BT_REQUEST/BT_CANCEL
+    int len;    // bytes of frame used
+    int extra = 0;  // variable-length payload following frame (BT_BITFILED bits)
+
+    switch (msg->bt_type) {
+        case BT_KEEP_ALIVE:
+            len = 4;
+            break;
+
+        case BT_CHOKE:
+        case BT_UNCHOKE:
+        case BT_INTERESTED:
+        case BT_NOT_INTERESTED:
+            len = 5;
+            break;
+
+        case BT_HAVE:
+            len = 9;
+            put_be32(frame + 5, msg->payload.have);
+            break;
+
+        case BT_BITFILED:
+            len = 5;
+            extra = bitfield_bytes(&msg->payload.bitfield);
+            break;
+
+        case BT_REQUEST:
+        case BT_CANCEL:
+            len = 17;
+            put_be32(frame + 5, msg->payload.request.index);
+            put_be32(frame + 9, msg->payload.request.begin);
+            put_be32(frame + 13, msg->payload.request.length);
+            break;
+
+        default:    // BT_PIECE goes through serve_request()
+            return -1;
+    }
+    put_be32(frame, len - 4 + extra);
+    frame[4] = msg->bt_type;
+
+    if (peer->tx_len - peer->tx_head + len + extra > peer->tx_cap) {
+        return 0;
+    }
+    wire_queue(bt_args, peer, frame, len);
+    if (extra) {
+        wire_queue(bt_args, peer, msg->payload.bitfield.bits, extra);
+    }
+    return 1;
+}
@@ -0,0 +1,74 @@
+#ifndef _BT_WIRE_H
+#define _BT_WIRE_H
+
+#include "bt_lib.h"
+
+/* smallest receive ring; grown to hold the torrent's BT_BITFILED message if that is bigger */
+#define RX_RING_MIN 65536
+
+/* send buffer room for control messages, on top of one handshake and one BT_BITFILED */
+#define TX_BUF_MIN 8192
+
+/* a peer is not read from while its send buffer has less room than this (see input_paused()) */
+#define TX_LOW_ROOM 512
+
+/**
+ * wire_init(bt_args_t *bt_args, peer_t *peer) -> int
+ *
+ * allocate the peer's receive ring and send buffer, sized for the
+ * largest message of this torrent; done once, when the peer gets its socket.
+ * The ring of a peer dropped earlier is reused if one is spare, and the
+ * send buffer comes from bt_args->bufs.
+ *
+ * Return: 0 on success, -1 on failure
+ **/
+int wire_init(bt_args_t *bt_args, peer_t *peer);
+
+/**
+ * wire_free(bt_args_t *bt_args, peer_t *peer) -> void
+ *
+ * give the peer's buffers back: the ring is kept for the next peer while
+ * there is room among the spares, else unmapped
+ **/
+void wire_free(bt_args_t *bt_args, peer_t *peer);
+
+/**
+ * wire_spares_free(bt_args_t *bt_args) -> void
+ *
+ * unmap the spare receive rings
+ **/
+void wire_spares_free(bt_args_t *bt_args);
+
+/**
+ * wire_fill(bt_args_t *bt_args, peer_t *peer) -> int
+ *
+ * read as much as the peer's socket has into the free part of its
+ * receive ring, in one read() straight into the ring, up to what the
+ * download limit grants (see limit_grant())
+ *
+ * Return: bytes read, 0 if the socket has nothing for now or the limit
+ * holds the peer back, -1 if the peer hung up or the read failed
+ **/
+int wire_fill(bt_args_t *bt_args, peer_t *peer);
+
+/**
+ * wire_take(peer_t *peer, int len) -> unsigned char *
+ *
+ * consume the next len bytes of the receive ring, e.g. the handshake
+ *
+ * Return: pointer to them (contiguous, valid until the next wire_fill()),
+ * NULL if fewer than len bytes have arrived
+ **/
+unsigned char * wire_take(peer_t *peer, int len);
+
+/**
+ * wire_queue(bt_args_t *bt_args, peer_t *peer, unsigned char *data, int len) -> int
+ *
+ * append len raw bytes to the peer's send buffer; they go out with the
+ * next flush_peers()
+ *
+ * Return: 0 on success, -1 if they do not fit
+ **/
+int wire_queue(bt_args_t *bt_args, peer_t *peer, unsigned char *data, int len);
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * sha1_bench: compares the SHA1 backends of bt_sha1.c on piece-sized messages, the way a recheck hashes them.
+ *
+ *   make bench && ./sha1_bench [piece_kib [total_mib]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bt_sha1.h"
+
+/* "abc", FIPS 180-4 example */
+static const unsigned char abc_digest[SHA1_DIGEST_LEN] = {
+    0xa9, 0x99, 0x3e, 0x36, 0x47, 0x06, 0x81, 0x6a, 0xba, 0x3e, 0x25, 0x71, 0x78, 0x50, 0xc2, 0x6c, 0x9c, 0xd0, 0xd8, 0x9d
+};
+
+static double now_s(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    size_t piece_len = 256 * 1024, total = 512UL * 1024 * 1024;
+    size_t n_pieces, i;
+    unsigned char *buf, *reference, digests[SHA1_LANES * SHA1_DIGEST_LEN], digest[SHA1_DIGEST_LEN];
+    const unsigned char *data[SHA1_LANES];
+    size_t len[SHA1_LANES];
+    double start, elapsed;
+    int backend, n, j, ok;
+
+    if (argc > 1) {
+        piece_len = strtoul(argv[1], NULL, 10) * 1024;
+    }
+    if (argc > 2) {
+        total = strtoul(argv[2], NULL, 10) * 1024 * 1024;
+    }
+    if (piece_len == 0 || total < piece_len) {
+        fprintf(stderr, "usage: %s [piece_kib [total_mib]]\n", argv[0]);
+        return 1;
+    }
+
+    // a working set the size of a small payload, hashed over and over until total bytes went through
+    n_pieces = 64;
+    if ( (buf = malloc(n_pieces * piece_len)) == NULL || (reference = malloc(n_pieces * SHA1_DIGEST_LEN)) == NULL ) {
+        return 1;
+    }
+    srand(1);
+    for (i = 0; i < n_pieces * piece_len; i++) {
+        buf[i] = rand();
+    }
+
+    if ( sha1_select(SHA1_SCALAR) < 0 ) {
+        return 1;
+    }
+    for (i = 0; i < n_pieces; i++) {
+        sha1(buf + i * piece_len, piece_len, reference + i * SHA1_DIGEST_LEN);
+    }
+
+    printf("%zu KiB pieces, %zu MiB per run\n", piece_len / 1024, total / (1024 * 1024));
+    printf("%-8s %12s %12s  %s\n", "backend", "one (MB/s)", "many (MB/s)", "check");
+
+    for (backend = 0; backend < SHA1_N_BACKENDS; backend++) {
+        if ( sha1_select(backend) < 0 ) {
+            printf("%-8s %12s %12s  not supported by this CPU\n", sha1_backend_name(backend), "-", "-");
+            continue;
+        }
+
+        // every backend must agree with the scalar one, and with the reference vector
+        sha1((const unsigned char *) "abc", 3, digest);
+        ok = memcmp(digest, abc_digest, SHA1_DIGEST_LEN) == 0;
+
+        start = now_s();
+        for (i = 0; i < total / piece_len; i++) {
+            sha1(buf + (i % n_pieces) * piece_len, piece_len, digest);
+            ok &= memcmp(digest, reference + (i % n_pieces) * SHA1_DIGEST_LEN, SHA1_DIGEST_LEN) == 0;
+        }
+        elapsed = now_s() - start;
+        printf("%-8s %12.0f ", sha1_backend_name(backend), total / elapsed / 1e6);
+
+        start = now_s();
+        for (i = 0; i < total / piece_len; i += n) {
+            n = SHA1_LANES;
+            for (j = 0; j < n; j++) {
+                data[j] = buf + ((i + j) % n_pieces) * piece_len;
+                len[j] = piece_len;
+            }
+            sha1_many(data, len, n, digests);
+            for (j = 0; j < n; j++) {
+                ok &= memcmp(digests + j * SHA1_DIGEST_LEN, reference + ((i + j) % n_pieces) * SHA1_DIGEST_LEN,
+                        SHA1_DIGEST_LEN) == 0;
+            }
+        }
+        elapsed = now_s() - start;
+        printf("%12.0f  %s\n", total / elapsed / 1e6, ok ? "ok" : "MISMATCH");
+    }
+
+    free(reference);
+    free(buf);
+    return 0;
+}